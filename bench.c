@@ -6,13 +6,37 @@
  */
 
 // A simple bench harness for skcms_Transform(), mostly to run in a profiler.
+//
+//    bench [-n loops] [-s src.icc] [-d dst.icc] [-p pattern]
+//    bench -c [-n loops] [-p pattern]
+//    bench -P [-l] [-n loops]
+//    bench -e [-n loops]
+//
+// -p picks the source image content: zero (the default), gradient, noise, or graphics.
+// All-zero pixels make table and CLUT lookups unrealistically cache- and branch-friendly,
+// so use one of the others when you want numbers that reflect real images.
+//
+// -c runs every pair of profiles drawn from the corpus below, skipping any that can't be
+// parsed or used as a destination, and reports each pair and a summary.
+//
+// -P instead measures skcms_Parse() throughput over that same corpus, or with -l,
+// skcms_ParseLazy().
+//
+// -e reports the speed and worst error of the default and precise skcms_Precision, decoding
+// and encoding with each kind of transfer function, against a double-precision reference.
+//
+// Compare out/gcc/bench with out/gcc.switch/bench (or the .native and .native-switch pair) to
+// see what threaded stage dispatch buys over the switch loop in GCC builds, and with
+// out/gcc.blocks/bench and out/gcc.noblocks/bench to see what running in blocks buys.
 
 #ifdef _MSC_VER
     #define _CRT_SECURE_NO_WARNINGS
 #endif
 
 #include "src/skcms_public.h"
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,88 +44,524 @@
 
 #define expect(cond) if (!(cond)) exit(1)
 
-static void load_file(const char* filename, void** buf, size_t* len) {
+static bool try_load_file(const char* filename, void** buf, size_t* len) {
     FILE* fp = fopen(filename, "rb");
-    expect(fp);
+    if (!fp) {
+        return false;
+    }
 
-    expect(fseek(fp, 0L, SEEK_END) == 0);
-    long size = ftell(fp);
-    expect(size > 0);
-    *len = (size_t)size;
-    rewind(fp);
+    bool ok = false;
+    if (fseek(fp, 0L, SEEK_END) == 0) {
+        long size = ftell(fp);
+        if (size > 0) {
+            *len = (size_t)size;
+            rewind(fp);
 
-    *buf = malloc(*len);
-    expect(*buf);
+            *buf = malloc(*len);
+            ok = *buf && fread(*buf, 1, *len, fp) == *len;
+            if (!ok) {
+                free(*buf);
+                *buf = NULL;
+            }
+        }
+    }
+    fclose(fp);
+    return ok;
+}
 
-    size_t bytes_read = fread(*buf, 1, *len, fp);
-    expect(bytes_read == *len);
+static void load_file(const char* filename, void** buf, size_t* len) {
+    expect(try_load_file(filename, buf, len));
 }
 
 // Just to keep us on our toes, we transform a non-power-of-two number of pixels.
 #define NPIXELS 255
 
-static float src_pixels[NPIXELS * 4],
-             dst_pixels[NPIXELS * 4];
+// Non-zero source content is a larger image that we walk through NPIXELS at a time,
+// so consecutive calls see different (but still spatially coherent) pixels.
+#define NCHUNKS 64
+#define IMAGE_W 120
+#define IMAGE_PIXELS (NPIXELS * NCHUNKS)
+#define IMAGE_H (IMAGE_PIXELS / IMAGE_W)
 
-int main(int argc, char** argv) {
-    int           n = 100000;
-    const char* src = NULL;
-    const char* dst = NULL;
+// We'll rotate through pixel formats to get samples from all the various stages.
+#define NFORMATS (skcms_PixelFormat_BGRA_ffff+1)
 
-    for (int i = 0; i < argc; i++) {
-        if (0 == strcmp(argv[i], "-n")) { n   = atoi(argv[++i]); }
-        if (0 == strcmp(argv[i], "-s")) { src =      argv[++i] ; }
-        if (0 == strcmp(argv[i], "-d")) { dst =      argv[++i] ; }
-    }
+typedef enum {
+    Pattern_Zero,
+    Pattern_Gradient,
+    Pattern_Noise,
+    Pattern_Graphics,
+} Pattern;
 
-    // Default to sRGB -> Display P3.
-    skcms_ICCProfile src_profile = *skcms_sRGB_profile(),
-                     dst_profile = *skcms_sRGB_profile();
-    dst_profile.toXYZD50 = (skcms_Matrix3x3){{
-        { 0.51512146f  , 0.29197692f , 0.15710449f},
-        { 0.24119567f  , 0.6922454f  , 0.0665741f },
-        {-0.0010375976f, 0.041885376f, 0.7840728f },
-    }};
-
-    void *src_buf = NULL,
-         *dst_buf = NULL;
-    size_t src_len,
-           dst_len;
-    if (src) {
-        load_file(src, &src_buf, &src_len);
-        if (!skcms_Parse(src_buf, src_len, &src_profile)) {
-            return 1;
+static const char* kPatternNames[] = { "zero", "gradient", "noise", "graphics" };
+
+static uint32_t rng_state = 0x12345678;
+
+static float next_random(void) {
+    // xorshift32, scaled to [0,1).
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state <<  5;
+    return (float)(rng_state >> 8) * (1.0f / (1<<24));
+}
+
+static float clamp01(float v) {
+    return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+static void fill_image(Pattern pattern, float* rgba) {
+    for (int y = 0; y < IMAGE_H; y++)
+    for (int x = 0; x < IMAGE_W; x++) {
+        float fx = (float)x / (IMAGE_W-1),
+              fy = (float)y / (IMAGE_H-1);
+        float* px = rgba + 4*(y*IMAGE_W + x);
+
+        switch (pattern) {
+            case Pattern_Zero:
+                px[0] = px[1] = px[2] = px[3] = 0;
+                break;
+
+            case Pattern_Gradient:
+                // Smooth ramps through most of the cube, with a soft alpha ramp too.
+                px[0] = fx;
+                px[1] = fy;
+                px[2] = 1 - 0.5f*(fx + fy);
+                px[3] = 0.5f + 0.5f*fx;
+                break;
+
+            case Pattern_Noise: {
+                // A smooth, mostly-muted base image plus per-pixel sensor-like grain.
+                float grain = (next_random() + next_random() + next_random() - 1.5f) * 0.08f;
+                float base  = 0.2f + 0.6f*fx*fy;
+                px[0] = clamp01(base + 0.15f*fx       + grain + 0.02f*(next_random() - 0.5f));
+                px[1] = clamp01(base + 0.10f*(1 - fy) + grain + 0.02f*(next_random() - 0.5f));
+                px[2] = clamp01(base - 0.10f*fx       + grain + 0.02f*(next_random() - 0.5f));
+                px[3] = 1;
+            } break;
+
+            case Pattern_Graphics: {
+                // Flat saturated blocks with hard edges, like UI, charts, or logos.
+                static const float kPalette[][3] = {
+                    {1,0,0}, {0,1,0}, {0,0,1}, {1,1,0}, {0,1,1}, {1,0,1},
+                    {1,1,1}, {0,0,0}, {1,0.5f,0}, {0.5f,0,1},
+                };
+                const int nPalette = (int)(sizeof(kPalette) / sizeof(*kPalette));
+                int block = ((x / 8) * 7 + (y / 8) * 13 + (x / 24) * (y / 16)) % nPalette;
+                px[0] = kPalette[block][0];
+                px[1] = kPalette[block][1];
+                px[2] = kPalette[block][2];
+                px[3] = (x % 8 == 0) ? 0.5f : 1.0f;
+            } break;
         }
     }
-    if (dst) {
-        load_file(dst, &dst_buf, &dst_len);
-        if (!skcms_Parse(dst_buf, dst_len, &dst_profile)) {
-            return 1;
-        }
+}
+
+// Source pixels in each of the NFORMATS formats.  Each chunk of NPIXELS starts
+// CHUNK_BYTES after the last, room enough for the widest (16 byte) format.
+#define CHUNK_BYTES (NPIXELS * 16)
+static void* src_images[NFORMATS];
+
+static void make_src_images(Pattern pattern) {
+    for (int fmt = 0; fmt < NFORMATS; fmt++) {
+        src_images[fmt] = calloc(NCHUNKS, CHUNK_BYTES);
+        expect(src_images[fmt]);
     }
+    if (pattern == Pattern_Zero) {
+        // All-zero bits are all-zero pixels in any format.
+        return;
+    }
+
+    float* rgba = malloc(IMAGE_PIXELS * 4 * sizeof(float));
+    expect(rgba);
+    fill_image(pattern, rgba);
 
-    // We'll rotate through pixel formats to get samples from all the various stages.
+    // Null profiles make this a plain format conversion.
+    for (int fmt = 0; fmt < NFORMATS; fmt++)
+    for (int c = 0; c < NCHUNKS; c++) {
+        expect(skcms_Transform(rgba + 4*c*NPIXELS, skcms_PixelFormat_RGBA_ffff,
+                                                   skcms_AlphaFormat_Unpremul, NULL,
+                               (char*)src_images[fmt] + c*CHUNK_BYTES, (skcms_PixelFormat)fmt,
+                                                   skcms_AlphaFormat_Unpremul, NULL,
+                               NPIXELS));
+    }
+    free(rgba);
+}
+
+static float dst_pixels[NPIXELS * 4];
+
+// Returns elapsed clock ticks for n calls to skcms_Transform(), NPIXELS each.
+static clock_t run_bench(int n, const skcms_ICCProfile* src_profile,
+                                const skcms_ICCProfile* dst_profile, bool* all_ok) {
     skcms_PixelFormat src_fmt = skcms_PixelFormat_RGB_565,
                       dst_fmt = skcms_PixelFormat_RGB_565;
-    const int wrap = skcms_PixelFormat_BGRA_ffff+1;
 
     clock_t start = clock();
-    bool all_ok = true;
     for (int i = 0; i < n; i++) {
+        const char* src = (const char*)src_images[src_fmt] + (i % NCHUNKS) * CHUNK_BYTES;
+
         const skcms_AlphaFormat upm = skcms_AlphaFormat_Unpremul;
-        all_ok &= skcms_Transform(src_pixels, src_fmt, upm, &src_profile,
-                                  dst_pixels, dst_fmt, upm, &dst_profile,
-                                  NPIXELS);
-        src_fmt = (src_fmt + 3) % wrap;
-        dst_fmt = (dst_fmt + 7) % wrap;
+        *all_ok &= skcms_Transform(src,        src_fmt, upm, src_profile,
+                                   dst_pixels, dst_fmt, upm, dst_profile,
+                                   NPIXELS);
+        src_fmt = (src_fmt + 3) % NFORMATS;
+        dst_fmt = (dst_fmt + 7) % NFORMATS;
+    }
+    return clock() - start;
+}
+
+static double ns_per_pixel(clock_t ticks, int n) {
+    return (double)ticks / (CLOCKS_PER_SEC * 1e-9) / ((double)n * NPIXELS);
+}
+
+static const char* kCorpus[] = {
+    "profiles/mobile/Display_P3_LUT.icc",
+    "profiles/mobile/Display_P3_parametric.icc",
+    "profiles/mobile/iPhone7p.icc",
+    "profiles/mobile/sRGB_LUT.icc",
+    "profiles/mobile/sRGB_parametric.icc",
+
+    "profiles/color.org/Lower_Left.icc",
+    "profiles/color.org/Lower_Right.icc",
+    "profiles/color.org/Upper_Left.icc",
+    "profiles/color.org/Upper_Right.icc",
+    "profiles/color.org/sRGB2014.icc",
+    "profiles/color.org/sRGB_ICC_v4_Appearance.icc",
+    "profiles/color.org/sRGB_v4_ICC_preference.icc",
+
+    "profiles/misc/AdobeColorSpin.icc",
+    "profiles/misc/AdobeRGB.icc",
+    "profiles/misc/Apple_Color_LCD.icc",
+    "profiles/misc/Apple_Wide_Color.icc",
+    "profiles/misc/BenQ_GL2450.icc",
+    "profiles/misc/BenQ_RL2455.icc",
+    "profiles/misc/Calibrated_A2B_XYZ_Mismatch.icc",
+    "profiles/misc/Coated_FOGRA27_CMYK.icc",
+    "profiles/misc/Coated_FOGRA39_CMYK.icc",
+    "profiles/misc/ColorLogic_ISO_Coated_CMYK.icc",
+    "profiles/misc/Color_Spin_Gamma_18.icc",
+    "profiles/misc/DisplayCal_ASUS_NonMonotonic.icc",
+    "profiles/misc/Dot_Gain_20_Grayscale.icc",
+    "profiles/misc/Generic_RGB_Gamma_18.icc",
+    "profiles/misc/Gray_Gamma_22.icc",
+    "profiles/misc/HD_709.icc",
+    "profiles/misc/Japan_Color_2001_Coated.icc",
+    "profiles/misc/Kodak_sRGB.icc",
+    "profiles/misc/Lexmark_X110.icc",
+    "profiles/misc/MR2416GSDF.icc",
+    "profiles/misc/MartiMaria_browsertest_A2B.icc",
+    "profiles/misc/MartiMaria_browsertest_HARD.icc",
+    "profiles/misc/P3_PQ_cicp.icc",
+    "profiles/misc/Phase_One_P25.icc",
+    "profiles/misc/PrintOpen_ISO_Coated_CMYK.icc",
+    "profiles/misc/Rec2020_HLG_cicp.icc",
+    "profiles/misc/Rec2020_PQ_cicp.icc",
+    "profiles/misc/SM245B.icc",
+    "profiles/misc/SWOP_Coated_20_GCR_CMYK.icc",
+    "profiles/misc/ThinkpadX1YogaV2.icc",
+    "profiles/misc/US_Web_Coated_SWOP_CMYK.icc",
+    "profiles/misc/XPS13_9360.icc",
+    "profiles/misc/XRite_GRACol7_340_CMYK.icc",
+    "profiles/misc/calibrated_nonzero_black.icc",
+    "profiles/misc/crbug_1017960_19.icc",
+    "profiles/misc/crbug_976551.icc",
+    "profiles/misc/sRGB_Calibrated_Heterogeneous.icc",
+    "profiles/misc/sRGB_Calibrated_Homogeneous.icc",
+    "profiles/misc/sRGB_HP.icc",
+    "profiles/misc/sRGB_HP_2.icc",
+    "profiles/misc/sRGB_ICC_v4_beta.icc",
+    "profiles/misc/sRGB_black_scaled.icc",
+    "profiles/misc/sRGB_lcms.icc",
+};
+
+#define NCORPUS ((int)(sizeof(kCorpus) / sizeof(*kCorpus)))
+
+static int run_corpus(int n) {
+    void*            bufs    [NCORPUS];
+    skcms_ICCProfile profiles[NCORPUS];
+    skcms_ICCProfile as_dst  [NCORPUS];
+    bool             src_ok  [NCORPUS];
+    bool             dst_ok  [NCORPUS];
+
+    for (int i = 0; i < NCORPUS; i++) {
+        size_t len = 0;
+        bufs[i] = NULL;
+        src_ok[i] = try_load_file(kCorpus[i], &bufs[i], &len)
+                 && skcms_Parse(bufs[i], len, &profiles[i]);
+
+        as_dst[i] = profiles[i];
+        dst_ok[i] = src_ok[i] && skcms_MakeUsableAsDestination(&as_dst[i]);
+
+        if (!src_ok[i]) {
+            fprintf(stderr, "skipping %s, can't load or parse it\n", kCorpus[i]);
+        }
+    }
+
+    bool   all_ok = true;
+    int    pairs  = 0;
+    double total  = 0,
+           worst  = 0;
+    int worst_src = 0,
+        worst_dst = 0;
+    for (int s = 0; s < NCORPUS; s++)
+    for (int d = 0; d < NCORPUS; d++) {
+        if (!src_ok[s] || !dst_ok[d]) {
+            continue;
+        }
+        double ns = ns_per_pixel(run_bench(n, &profiles[s], &as_dst[d], &all_ok), n);
+        printf("%-48s -> %-48s %.3g ns / pixel\n", kCorpus[s], kCorpus[d], ns);
+
+        pairs++;
+        total += ns;
+        if (worst < ns) {
+            worst     = ns;
+            worst_src = s;
+            worst_dst = d;
+        }
+    }
+
+    if (pairs > 0) {
+        printf("%d pairs x %d loops, mean %.3g ns / pixel, worst %.3g ns / pixel (%s -> %s)\n",
+               pairs, n, total / pairs, worst, kCorpus[worst_src], kCorpus[worst_dst]);
+    }
+
+    for (int i = 0; i < NCORPUS; i++) {
+        free(bufs[i]);
     }
+    return all_ok ? 0 : 1;
+}
 
-    clock_t ticks = clock() - start;
-    printf("%d loops in %g clock ticks, %.3g ns / pixel\n",
-            n, (double)ticks, (double)ticks / (CLOCKS_PER_SEC * 1e-9) / (n * NPIXELS));
+static int run_parse(int n, bool lazy) {
+    bool   all_ok = true;
+    double total_ticks  = 0;
+    long   total_parses = 0;
+    for (int i = 0; i < NCORPUS; i++) {
+        void*  buf = NULL;
+        size_t len = 0;
+        if (!try_load_file(kCorpus[i], &buf, &len)) {
+            fprintf(stderr, "skipping %s, can't load it\n", kCorpus[i]);
+            all_ok = false;
+            continue;
+        }
 
-    if (src_buf) { free(src_buf); }
-    if (dst_buf) { free(dst_buf); }
+        skcms_ICCProfile profile;
+        clock_t start = clock();
+        for (int j = 0; j < n; j++) {
+            all_ok &= lazy ? skcms_ParseLazy(buf, len, &profile)
+                           : skcms_Parse    (buf, len, &profile);
+        }
+        clock_t ticks = clock() - start;
+
+        printf("%-48s %.3g ns / parse\n",
+               kCorpus[i], (double)ticks / (CLOCKS_PER_SEC * 1e-9) / n);
+        total_ticks  += (double)ticks;
+        total_parses += n;
+        free(buf);
+    }
 
+    printf("%ld parses in %g clock ticks, %.3g parses / second\n",
+           total_parses, total_ticks, (double)total_parses * CLOCKS_PER_SEC / total_ticks);
     return all_ok ? 0 : 1;
 }
+
+// tf(x), like skcms_TransferFunction_eval() but in double precision, for x >= 0.
+static double eval_double(const skcms_TransferFunction* tf, double x) {
+    const double A = tf->a, B = tf->b, C = tf->c, D = tf->d, E = tf->e, F = tf->f;
+    switch (skcms_TransferFunction_getType(tf)) {
+        case skcms_TFType_Invalid: break;
+
+        case skcms_TFType_sRGBish:
+            return x < D ? C*x + F : pow(A*x + B, tf->g) + E;
+
+        case skcms_TFType_PQish:
+            return pow(fmax(A + B*pow(x, C), 0) / (D + E*pow(x, C)), F);
+
+        // For HLGish, a through f hold R, G, a, b, c, and K-1.
+        case skcms_TFType_HLGish:
+            return (F+1) * (x*A <= 1 ? pow(x*A, B) : exp((x-E)*C) + D);
+
+        case skcms_TFType_HLGinvish:
+            x /= (F+1);
+            return x <= 1 ? A * pow(x, B) : C * log(x - D) + E;
+    }
+    return 0;
+}
+
+#define PRECISION_SAMPLES 4096
+
+static int run_precision(int n) {
+    skcms_TransferFunction srgb = *skcms_sRGB_TransferFunction(),
+                           gamma = {2.2f, 1,0,0,0,0,0},
+                           pq, hlg;
+    expect(skcms_TransferFunction_makePQ (&pq));
+    expect(skcms_TransferFunction_makeHLG(&hlg));
+
+    const struct {
+        const char*                   name;
+        const skcms_TransferFunction* tf;
+        float                         max_linear;
+    } kCurves[] = {
+        {"sRGB",  &srgb,   1.0f},
+        {"gamma", &gamma,  1.0f},
+        {"PQ",    &pq,     1.0f},
+        {"HLG",   &hlg,   12.0f},
+    };
+    // skcms_Precision_Fast evaluates curves like the default, and float pixels never run in
+    // half floats, so it'd only repeat the default's numbers here.
+    const struct {
+        const char*     name;
+        skcms_Precision precision;
+    } kPrecisions[] = {
+        {"default", skcms_Precision_Default},
+        {"precise", skcms_Precision_Precise},
+    };
+
+    static float src[PRECISION_SAMPLES * 4],
+                 dst[PRECISION_SAMPLES * 4];
+
+    printf("%-6s %-7s %-9s %9s %12s %6s\n",
+           "curve", "", "precision", "ns/pixel", "max error", "bits");
+    for (int c = 0; c < (int)(sizeof(kCurves) / sizeof(*kCurves)); c++)
+    for (int encode = 0; encode < 2; encode++) {
+        skcms_ICCProfile linear  = *skcms_XYZD50_profile(),
+                         encoded = *skcms_XYZD50_profile();
+        skcms_SetTransferFunction(&encoded, kCurves[c].tf);
+
+        // Decoding uses the curve itself, encoding its inverse.
+        skcms_TransferFunction ref = *kCurves[c].tf;
+        float src_max = 1.0f,
+              dst_max = kCurves[c].max_linear;
+        if (encode) {
+            expect(skcms_TransferFunction_invert(kCurves[c].tf, &ref));
+            src_max = kCurves[c].max_linear;
+            dst_max = 1.0f;
+        }
+
+        for (int i = 0; i < PRECISION_SAMPLES; i++) {
+            float x = src_max * (float)i / (PRECISION_SAMPLES - 1);
+            src[4*i+0] = src[4*i+1] = src[4*i+2] = x;
+            src[4*i+3] = 1.0f;
+        }
+
+        for (int p = 0; p < (int)(sizeof(kPrecisions) / sizeof(*kPrecisions)); p++) {
+            const skcms_ICCProfile* from = encode ? &linear  : &encoded,
+                                  * to   = encode ? &encoded : &linear;
+            clock_t start = clock();
+            for (int loop = 0; loop < n; loop++) {
+                expect(skcms_TransformWithPrecision(
+                            src, skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, from,
+                            dst, skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, to,
+                            PRECISION_SAMPLES, kPrecisions[p].precision));
+            }
+            clock_t ticks = clock() - start;
+
+            // Report error as a fraction of the output's full range.
+            double max_err = 0;
+            for (int i = 0; i < PRECISION_SAMPLES * 4; i++) {
+                if (i % 4 != 3) {
+                    double err = fabs(dst[i] - eval_double(&ref, src[i])) / dst_max;
+                    max_err = fmax(max_err, err);
+                }
+            }
+
+            printf("%-6s %-7s %-9s %9.3g %12.3g %6.1f\n",
+                   kCurves[c].name, encode ? "encode" : "decode", kPrecisions[p].name,
+                   1e9 * (double)ticks / CLOCKS_PER_SEC / n / PRECISION_SAMPLES,
+                   max_err, max_err > 0 ? -log2(max_err) : INFINITY);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int           n = -1;
+    const char* src = NULL;
+    const char* dst = NULL;
+    bool     corpus = false;
+    bool      parse = false;
+    bool       lazy = false;
+    bool  precision = false;
+    Pattern pattern = Pattern_Zero;
+
+    for (int i = 0; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-n")) { n   = atoi(argv[++i]); }
+        if (0 == strcmp(argv[i], "-s")) { src =      argv[++i] ; }
+        if (0 == strcmp(argv[i], "-d")) { dst =      argv[++i] ; }
+        if (0 == strcmp(argv[i], "-c")) { corpus = true; }
+        if (0 == strcmp(argv[i], "-P")) { parse  = true; }
+        if (0 == strcmp(argv[i], "-l")) { lazy   = true; }
+        if (0 == strcmp(argv[i], "-e")) { precision = true; }
+        if (0 == strcmp(argv[i], "-p")) {
+            const char* name = argv[++i];
+            bool found = false;
+            for (int p = 0; p < (int)(sizeof(kPatternNames) / sizeof(*kPatternNames)); p++) {
+                if (0 == strcmp(name, kPatternNames[p])) {
+                    pattern = (Pattern)p;
+                    found = true;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "unknown pattern '%s'\n", name);
+                return 1;
+            }
+        }
+    }
+
+    if (parse) {
+        return run_parse(n < 0 ? 10000 : n, lazy);
+    }
+    if (precision) {
+        return run_precision(n < 0 ? 1000 : n);
+    }
+
+    make_src_images(pattern);
+
+    int result;
+    if (corpus) {
+        // There are thousands of pairs, so default to fewer loops for each.
+        result = run_corpus(n < 0 ? 1000 : n);
+    } else {
+        if (n < 0) {
+            n = 100000;
+        }
+
+        // Default to sRGB -> Display P3.
+        skcms_ICCProfile src_profile = *skcms_sRGB_profile(),
+                         dst_profile = *skcms_sRGB_profile();
+        dst_profile.toXYZD50 = (skcms_Matrix3x3){{
+            { 0.51512146f  , 0.29197692f , 0.15710449f},
+            { 0.24119567f  , 0.6922454f  , 0.0665741f },
+            {-0.0010375976f, 0.041885376f, 0.7840728f },
+        }};
+
+        void *src_buf = NULL,
+             *dst_buf = NULL;
+        size_t src_len,
+               dst_len;
+        if (src) {
+            load_file(src, &src_buf, &src_len);
+            if (!skcms_Parse(src_buf, src_len, &src_profile)) {
+                return 1;
+            }
+        }
+        if (dst) {
+            load_file(dst, &dst_buf, &dst_len);
+            if (!skcms_Parse(dst_buf, dst_len, &dst_profile)) {
+                return 1;
+            }
+        }
+
+        bool all_ok = true;
+        clock_t ticks = run_bench(n, &src_profile, &dst_profile, &all_ok);
+        printf("%d loops in %g clock ticks, %.3g ns / pixel\n",
+                n, (double)ticks, ns_per_pixel(ticks, n));
+
+        if (src_buf) { free(src_buf); }
+        if (dst_buf) { free(dst_buf); }
+        result = all_ok ? 0 : 1;
+    }
+
+    for (int fmt = 0; fmt < NFORMATS; fmt++) {
+        free(src_images[fmt]);
+    }
+    return result;
+}
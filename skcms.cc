@@ -41,6 +41,18 @@ void skcms_DisableRuntimeCPUDetection() {
     sAllowRuntimeCPUDetection = false;
 }
 
+static bool sAllowJIT = false;
+
+void skcms_EnableJIT(bool enable) {
+    sAllowJIT = enable;
+}
+
+static bool sAllowJITAVX512 = true;
+
+void skcms_AllowJITAVX512(bool allow) {
+    sAllowJITAVX512 = allow;
+}
+
 static float log2f_(float x) {
     // The first approximation of log2(x) is its exponent 'e', minus 127.
     int32_t bits;
@@ -270,10 +282,36 @@ static float eval_curve(const skcms_Curve* curve, float x) {
     return l + (h-l)*t;
 }
 
+// skcms_ApproximateCurve()'s curve-fitting kernels, from the best backend for this CPU.
+// These evaluate table curves and sRGBish transfer functions exactly as the scalar code does.
+struct FitKernels {
+    decltype(&baseline::roundtrip_errors) roundtrip_errors;
+    decltype(&baseline::rg_nonlinear)     rg_nonlinear;
+};
+static FitKernels fit_kernels();
+
+// We run those kernels on up to this many points at a time.
+static const int kFitChunk = 64;
+
 float skcms_MaxRoundtripError(const skcms_Curve* curve, const skcms_TransferFunction* inv_tf) {
     uint32_t N = curve->table_entries > 256 ? curve->table_entries : 256;
     const float dx = 1.0f / static_cast<float>(N - 1);
     float err = 0;
+
+    if (curve->table_entries && N <= (uint32_t)INT_MAX
+                             && classify(*inv_tf) == skcms_TFType_sRGBish) {
+        const FitKernels kernels = fit_kernels();
+        for (int i = 0; i < (int)N; i += kFitChunk) {
+            const int n = (int)N - i < kFitChunk ? (int)N - i : kFitChunk;
+            float errs[kFitChunk];
+            kernels.roundtrip_errors(curve, inv_tf, dx, i, n, errs);
+            for (int j = 0; j < n; j++) {
+                err = fmaxf_(err, errs[j]);
+            }
+        }
+        return err;
+    }
+
     for (uint32_t i = 0; i < N; i++) {
         float x = static_cast<float>(i) * dx,
               y = eval_curve(curve, x);
@@ -291,6 +329,9 @@ enum {
     // File signature
     skcms_Signature_acsp = 0x61637370,
 
+    // Profile class signatures
+    skcms_Signature_link = 0x6C696E6B,
+
     // Tag signatures
     skcms_Signature_rTRC = 0x72545243,
     skcms_Signature_gTRC = 0x67545243,
@@ -309,6 +350,10 @@ enum {
 
     skcms_Signature_CICP = 0x63696370,
 
+    skcms_Signature_desc = 0x64657363,
+    skcms_Signature_cprt = 0x63707274,
+    skcms_Signature_pseq = 0x70736571,
+
     // Type signatures
     skcms_Signature_curv = 0x63757276,
     skcms_Signature_mft1 = 0x6D667431,
@@ -317,6 +362,7 @@ enum {
     skcms_Signature_mBA  = 0x6D424120,
     skcms_Signature_para = 0x70617261,
     skcms_Signature_sf32 = 0x73663332,
+    skcms_Signature_mluc = 0x6D6C7563,
     // XYZ is also a PCS signature, so it's defined in skcms.h
     // skcms_Signature_XYZ = 0x58595A20,
 };
@@ -341,6 +387,24 @@ static uint32_t read_big_u32(const uint8_t* ptr) {
 #endif
 }
 
+static void write_big_u16(uint8_t* ptr, uint16_t v) {
+#if defined(_MSC_VER)
+    uint16_t be = _byteswap_ushort(v);
+#else
+    uint16_t be = __builtin_bswap16(v);
+#endif
+    memcpy(ptr, &be, sizeof(be));
+}
+
+static void write_big_u32(uint8_t* ptr, uint32_t v) {
+#if defined(_MSC_VER)
+    uint32_t be = _byteswap_ulong(v);
+#else
+    uint32_t be = __builtin_bswap32(v);
+#endif
+    memcpy(ptr, &be, sizeof(be));
+}
+
 static int32_t read_big_i32(const uint8_t* ptr) {
     return (int32_t)read_big_u32(ptr);
 }
@@ -1118,9 +1182,20 @@ static int fit_linear(const skcms_Curve* curve, int N, float tol,
     return lin_points;
 }
 
+// An identity table must map 0 to exactly 0 and 1 to exactly 1.  This is much cheaper
+// than fit_linear(), and rejects most of the (often large) tables we see while parsing.
+static bool table_ends_at_0_and_1(const skcms_Curve* curve) {
+    uint32_t last = curve->table_entries - 1;
+    if (curve->table_8) {
+        return curve->table_8[0] == 0 && curve->table_8[last] == 0xff;
+    }
+    return read_big_u16(curve->table_16) == 0 && read_big_u16(curve->table_16 + 2*last) == 0xffff;
+}
+
 // If this skcms_Curve holds an identity table, rewrite it as an identity skcms_TransferFunction.
 static void canonicalize_identity(skcms_Curve* curve) {
-    if (curve->table_entries && curve->table_entries <= (uint32_t)INT_MAX) {
+    if (curve->table_entries && curve->table_entries <= (uint32_t)INT_MAX
+                             && table_ends_at_0_and_1(curve)) {
         int N = (int)curve->table_entries;
 
         float c = 0.0f, d = 0.0f, f = 0.0f;
@@ -1135,6 +1210,43 @@ static void canonicalize_identity(skcms_Curve* curve) {
     }
 }
 
+static bool same_table(const skcms_Curve* a, const skcms_Curve* b) {
+    if (a->table_entries == 0 || a->table_entries != b->table_entries) {
+        return false;
+    }
+    if (a->table_8 && b->table_8) {
+        return 0 == memcmp(a->table_8, b->table_8, a->table_entries);
+    }
+    if (a->table_16 && b->table_16) {
+        return 0 == memcmp(a->table_16, b->table_16, 2*(size_t)a->table_entries);
+    }
+    return false;
+}
+
+// canonicalize_identity() each curve, reusing the result for any table we've already looked at.
+// Identity tables are often repeated across every channel, and proving a table is an identity
+// means fitting every entry, while comparing tables is comparatively free.
+static void canonicalize_identities(skcms_Curve* curves[], int n) {
+    skcms_Curve original[10];
+    assert(n <= ARRAY_COUNT(original));
+
+    for (int i = 0; i < n; i++) {
+        original[i] = *curves[i];
+
+        int j = 0;
+        while (j < i && !same_table(&original[j], curves[i])) {
+            j++;
+        }
+
+        if (j == i) {
+            canonicalize_identity(curves[i]);
+        } else if (curves[j]->table_entries == 0) {
+            // That earlier matching table was an identity, so this one is too.
+            *curves[i] = *curves[j];
+        }
+    }
+}
+
 static bool read_a2b(const skcms_ICCTag* tag, skcms_A2B* a2b, bool pcs_is_xyz) {
     bool ok = false;
     if (tag->type == skcms_Signature_mft1) { ok = read_tag_mft1(tag, a2b); }
@@ -1144,18 +1256,14 @@ static bool read_a2b(const skcms_ICCTag* tag, skcms_A2B* a2b, bool pcs_is_xyz) {
         return false;
     }
 
-    if (a2b->input_channels > 0) { canonicalize_identity(a2b->input_curves + 0); }
-    if (a2b->input_channels > 1) { canonicalize_identity(a2b->input_curves + 1); }
-    if (a2b->input_channels > 2) { canonicalize_identity(a2b->input_curves + 2); }
-    if (a2b->input_channels > 3) { canonicalize_identity(a2b->input_curves + 3); }
-
-    if (a2b->matrix_channels > 0) { canonicalize_identity(a2b->matrix_curves + 0); }
-    if (a2b->matrix_channels > 1) { canonicalize_identity(a2b->matrix_curves + 1); }
-    if (a2b->matrix_channels > 2) { canonicalize_identity(a2b->matrix_curves + 2); }
-
-    if (a2b->output_channels > 0) { canonicalize_identity(a2b->output_curves + 0); }
-    if (a2b->output_channels > 1) { canonicalize_identity(a2b->output_curves + 1); }
-    if (a2b->output_channels > 2) { canonicalize_identity(a2b->output_curves + 2); }
+    skcms_Curve* curves[ARRAY_COUNT(a2b->input_curves) +
+                        ARRAY_COUNT(a2b->matrix_curves) +
+                        ARRAY_COUNT(a2b->output_curves)];
+    int n = 0;
+    for (uint32_t i = 0; i < a2b->input_channels;  i++) { curves[n++] = a2b->input_curves  + i; }
+    for (uint32_t i = 0; i < a2b->matrix_channels; i++) { curves[n++] = a2b->matrix_curves + i; }
+    for (uint32_t i = 0; i < a2b->output_channels; i++) { curves[n++] = a2b->output_curves + i; }
+    canonicalize_identities(curves, n);
 
     return true;
 }
@@ -1169,19 +1277,105 @@ static bool read_b2a(const skcms_ICCTag* tag, skcms_B2A* b2a, bool pcs_is_xyz) {
         return false;
     }
 
-    if (b2a->input_channels > 0) { canonicalize_identity(b2a->input_curves + 0); }
-    if (b2a->input_channels > 1) { canonicalize_identity(b2a->input_curves + 1); }
-    if (b2a->input_channels > 2) { canonicalize_identity(b2a->input_curves + 2); }
+    skcms_Curve* curves[ARRAY_COUNT(b2a->input_curves) +
+                        ARRAY_COUNT(b2a->matrix_curves) +
+                        ARRAY_COUNT(b2a->output_curves)];
+    int n = 0;
+    for (uint32_t i = 0; i < b2a->input_channels;  i++) { curves[n++] = b2a->input_curves  + i; }
+    for (uint32_t i = 0; i < b2a->matrix_channels; i++) { curves[n++] = b2a->matrix_curves + i; }
+    for (uint32_t i = 0; i < b2a->output_channels; i++) { curves[n++] = b2a->output_curves + i; }
+    canonicalize_identities(curves, n);
+
+    return true;
+}
+
+// Like read_tag_mab(), for device links with three inputs and four (CMYK) outputs.  We read these
+// into a B2A, which runs input curves, CLUT, and output curves in the same order as an mAB's A
+// curves, CLUT, and B curves when there's no matrix.
+static bool read_tag_mab_link(const skcms_ICCTag* tag, skcms_B2A* b2a) {
+    if (tag->size < SAFE_SIZEOF(mAB_or_mBA_Layout)) {
+        return false;
+    }
+
+    const mAB_or_mBA_Layout* mABTag = (const mAB_or_mBA_Layout*)tag->buf;
+
+    b2a->input_channels  = mABTag->input_channels[0];
+    b2a->output_channels = mABTag->output_channels[0];
+    b2a->matrix_channels = 0;
+    if (b2a->input_channels  != ARRAY_COUNT(b2a->input_curves) ||
+        b2a->output_channels != ARRAY_COUNT(b2a->output_curves)) {
+        return false;
+    }
+
+    uint32_t b_curve_offset = read_big_u32(mABTag->b_curve_offset);
+    uint32_t matrix_offset  = read_big_u32(mABTag->matrix_offset);
+    uint32_t m_curve_offset = read_big_u32(mABTag->m_curve_offset);
+    uint32_t clut_offset    = read_big_u32(mABTag->clut_offset);
+    uint32_t a_curve_offset = read_big_u32(mABTag->a_curve_offset);
+
+    // Changing the number of channels takes a CLUT, and a B2A has nowhere to put "M" curves.
+    if (0 == b_curve_offset || 0 == a_curve_offset || 0 == clut_offset ||
+        0 != matrix_offset  || 0 != m_curve_offset) {
+        return false;
+    }
+
+    if (!read_curves(tag->buf, tag->size, a_curve_offset, b2a->input_channels,
+                     b2a->input_curves) ||
+        !read_curves(tag->buf, tag->size, b_curve_offset, b2a->output_channels,
+                     b2a->output_curves)) {
+        return false;
+    }
+
+    if (tag->size < clut_offset + SAFE_FIXED_SIZE(CLUT_Layout)) {
+        return false;
+    }
+    const CLUT_Layout* clut = (const CLUT_Layout*)(tag->buf + clut_offset);
+
+    if (clut->grid_byte_width[0] == 1) {
+        b2a->grid_8  = clut->variable;
+        b2a->grid_16 = nullptr;
+    } else if (clut->grid_byte_width[0] == 2) {
+        b2a->grid_8  = nullptr;
+        b2a->grid_16 = clut->variable;
+    } else {
+        return false;
+    }
+
+    uint64_t grid_size = b2a->output_channels * clut->grid_byte_width[0];
+    for (uint32_t i = 0; i < b2a->input_channels; ++i) {
+        b2a->grid_points[i] = clut->grid_points[i];
+        if (b2a->grid_points[i] < 2) {
+            return false;
+        }
+        grid_size *= b2a->grid_points[i];
+    }
+    return tag->size >= clut_offset + SAFE_FIXED_SIZE(CLUT_Layout) + grid_size;
+}
+
+// A device link's A2B tag converts straight from its input space to its output space (in pcs),
+// read into A2B when that output has three channels, or B2A when it's CMYK.
+static bool read_link(const skcms_ICCTag* tag, skcms_ICCProfile* profile) {
+    if (profile->pcs != skcms_Signature_CMYK) {
+        if (!read_a2b(tag, &profile->A2B, /*pcs_is_xyz=*/false)) {
+            return false;
+        }
+        profile->has_A2B = true;
+        return true;
+    }
 
-    if (b2a->matrix_channels > 0) { canonicalize_identity(b2a->matrix_curves + 0); }
-    if (b2a->matrix_channels > 1) { canonicalize_identity(b2a->matrix_curves + 1); }
-    if (b2a->matrix_channels > 2) { canonicalize_identity(b2a->matrix_curves + 2); }
+    skcms_B2A* b2a = &profile->B2A;
+    if (tag->type != skcms_Signature_mAB || !read_tag_mab_link(tag, b2a)) {
+        return false;
+    }
 
-    if (b2a->output_channels > 0) { canonicalize_identity(b2a->output_curves + 0); }
-    if (b2a->output_channels > 1) { canonicalize_identity(b2a->output_curves + 1); }
-    if (b2a->output_channels > 2) { canonicalize_identity(b2a->output_curves + 2); }
-    if (b2a->output_channels > 3) { canonicalize_identity(b2a->output_curves + 3); }
+    skcms_Curve* curves[ARRAY_COUNT(b2a->input_curves) +
+                        ARRAY_COUNT(b2a->output_curves)];
+    int n = 0;
+    for (uint32_t i = 0; i < b2a->input_channels;  i++) { curves[n++] = b2a->input_curves  + i; }
+    for (uint32_t i = 0; i < b2a->output_channels; i++) { curves[n++] = b2a->output_curves + i; }
+    canonicalize_identities(curves, n);
 
+    profile->has_B2A = true;
     return true;
 }
 
@@ -1208,39 +1402,156 @@ static bool read_cicp(const skcms_ICCTag* tag, skcms_CICP* cicp) {
     return true;
 }
 
+static void read_tag_entry(const skcms_ICCProfile* profile, const tag_Layout* entry,
+                           skcms_ICCTag* tag) {
+    tag->signature = read_big_u32(entry->signature);
+    tag->size      = read_big_u32(entry->size);
+    tag->buf       = read_big_u32(entry->offset) + profile->buffer;
+    tag->type      = read_big_u32(tag->buf);
+}
+
 void skcms_GetTagByIndex(const skcms_ICCProfile* profile, uint32_t idx, skcms_ICCTag* tag) {
     if (!profile || !profile->buffer || !tag) { return; }
     if (idx > profile->tag_count) { return; }
-    const tag_Layout* tags = get_tag_table(profile);
-    tag->signature = read_big_u32(tags[idx].signature);
-    tag->size      = read_big_u32(tags[idx].size);
-    tag->buf       = read_big_u32(tags[idx].offset) + profile->buffer;
-    tag->type      = read_big_u32(tag->buf);
+    read_tag_entry(profile, get_tag_table(profile) + idx, tag);
+}
+
+static const int kTagIndexSlots = ARRAY_COUNT(((skcms_ICCProfile*)nullptr)->tag_index);
+
+// We keep the index at most half full so probe sequences stay short, and its 1-based uint8_t
+// entries can't refer to more than 255 tags anyway.
+static const uint32_t kMaxIndexedTags = kTagIndexSlots / 2 < 255 ? kTagIndexSlots / 2 : 255;
+
+static int tag_index_slot(uint32_t sig) {
+    // Signatures are four ASCII characters that often differ only in one byte,
+    // so mix them with a multiplicative (Fibonacci) hash before taking the top bits.
+    static_assert(ARRAY_COUNT(((skcms_ICCProfile*)nullptr)->tag_index) == 512,
+                  "need to update tag_index_slot()");
+    return (int)((sig * 0x9E3779B1u) >> 23);
+}
+
+// Add tags[i] to the index, unless there's already a tag with that signature.
+static void add_to_tag_index(skcms_ICCProfile* profile, const tag_Layout* tags, uint32_t i) {
+    uint32_t sig = read_big_u32(tags[i].signature);
+    for (int slot = tag_index_slot(sig); ; slot = (slot + 1) % kTagIndexSlots) {
+        uint8_t entry = profile->tag_index[slot];
+        if (entry == 0) {
+            profile->tag_index[slot] = (uint8_t)(i + 1);
+            return;
+        }
+        if (read_big_u32(tags[entry - 1].signature) == sig) {
+            return;
+        }
+    }
 }
 
 bool skcms_GetTagBySignature(const skcms_ICCProfile* profile, uint32_t sig, skcms_ICCTag* tag) {
     if (!profile || !profile->buffer || !tag) { return false; }
     const tag_Layout* tags = get_tag_table(profile);
+
+    if (profile->has_tag_index) {
+        for (int slot = tag_index_slot(sig); ; slot = (slot + 1) % kTagIndexSlots) {
+            uint8_t entry = profile->tag_index[slot];
+            if (entry == 0) {
+                return false;
+            }
+            if (read_big_u32(tags[entry - 1].signature) == sig) {
+                read_tag_entry(profile, tags + (entry - 1), tag);
+                return true;
+            }
+        }
+    }
+
     for (uint32_t i = 0; i < profile->tag_count; ++i) {
         if (read_big_u32(tags[i].signature) == sig) {
-            tag->signature = sig;
-            tag->size      = read_big_u32(tags[i].size);
-            tag->buf       = read_big_u32(tags[i].offset) + profile->buffer;
-            tag->type      = read_big_u32(tag->buf);
+            read_tag_entry(profile, tags + i, tag);
             return true;
         }
     }
     return false;
 }
 
+// Device links put their output color space where other profiles put their PCS.
+static bool is_device_link(const skcms_ICCProfile* profile) {
+    return profile->pcs == skcms_Signature_RGB
+        || profile->pcs == skcms_Signature_CMYK;
+}
+
+// The color space of pixels transformed to this profile, or through it if it's a device link.
+static uint32_t output_color_space(const skcms_ICCProfile* profile) {
+    return is_device_link(profile) ? profile->pcs : profile->data_color_space;
+}
+
 static bool usable_as_src(const skcms_ICCProfile* profile) {
     return profile->has_A2B
-       || (profile->has_trc && profile->has_toXYZD50);
+       || profile->deferred_A2B
+       || (profile->has_trc && profile->has_toXYZD50)
+       || (profile->has_B2A && is_device_link(profile));
 }
 
-bool skcms_ParseWithA2BPriority(const void* buf, size_t len,
-                                const int priority[], const int priorities,
-                                skcms_ICCProfile* profile) {
+static bool has_deferred_tags(const skcms_ICCProfile* profile) {
+    return profile->deferred_A2B || profile->deferred_B2A || profile->deferred_CICP;
+}
+
+bool skcms_ResolveProfile(skcms_ICCProfile* profile) {
+    if (!profile) {
+        return false;
+    }
+    if (!has_deferred_tags(profile)) {
+        return true;
+    }
+
+    // Resolve into a copy, so a malformed tag partway through leaves profile as it was.
+    skcms_ICCProfile resolved = *profile;
+    bool pcs_is_xyz = resolved.pcs == skcms_Signature_XYZ;
+    skcms_ICCTag tag;
+
+    if (resolved.deferred_A2B) {
+        if (!skcms_GetTagBySignature(&resolved, resolved.deferred_A2B, &tag)) {
+            return false;
+        }
+        if (is_device_link(&resolved)) {
+            if (!read_link(&tag, &resolved)) {
+                // Malformed or unsupported device link
+                return false;
+            }
+        } else {
+            if (!read_a2b(&tag, &resolved.A2B, pcs_is_xyz)) {
+                // Malformed A2B tag
+                return false;
+            }
+            resolved.has_A2B = true;
+        }
+        resolved.deferred_A2B = 0;
+    }
+
+    if (resolved.deferred_B2A) {
+        if (!skcms_GetTagBySignature(&resolved, resolved.deferred_B2A, &tag) ||
+            !read_b2a(&tag, &resolved.B2A, pcs_is_xyz)) {
+            // Malformed B2A tag
+            return false;
+        }
+        resolved.has_B2A = true;
+        resolved.deferred_B2A = 0;
+    }
+
+    if (resolved.deferred_CICP) {
+        if (!skcms_GetTagBySignature(&resolved, skcms_Signature_CICP, &tag) ||
+            !read_cicp(&tag, &resolved.CICP)) {
+            // Malformed CICP tag
+            return false;
+        }
+        resolved.has_CICP = true;
+        resolved.deferred_CICP = false;
+    }
+
+    *profile = resolved;
+    return true;
+}
+
+static bool parse(const void* buf, size_t len,
+                  const int priority[], const int priorities,
+                  bool lazy, skcms_ICCProfile* profile) {
     static_assert(SAFE_SIZEOF(header_Layout) == 132, "need to update header code");
 
     if (!profile) {
@@ -1282,7 +1593,9 @@ bool skcms_ParseWithA2BPriority(const void* buf, size_t len,
         return false;
     }
 
-    // Validate that all tag entries have sane offset + size
+    // Validate that all tag entries have sane offset + size,
+    // indexing them by signature as we go for skcms_GetTagBySignature().
+    const bool index_tags = profile->tag_count <= kMaxIndexedTags;
     const tag_Layout* tags = get_tag_table(profile);
     for (uint32_t i = 0; i < profile->tag_count; ++i) {
         uint32_t tag_offset = read_big_u32(tags[i].offset);
@@ -1291,9 +1604,23 @@ bool skcms_ParseWithA2BPriority(const void* buf, size_t len,
         if (tag_size < 4 || tag_end > profile->size) {
             return false;
         }
+        if (index_tags) {
+            add_to_tag_index(profile, tags, i);
+        }
+    }
+    profile->has_tag_index = index_tags;
+
+    // enum { perceptual, relative_colormetric, saturation }
+    for (int i = 0; i < priorities; i++) {
+        if (priority[i] < 0 || priority[i] > 2) {
+            return false;
+        }
     }
 
-    if (profile->pcs != skcms_Signature_XYZ && profile->pcs != skcms_Signature_Lab) {
+    // Device links may instead convert straight to RGB or CMYK.
+    if (profile->pcs != skcms_Signature_XYZ && profile->pcs != skcms_Signature_Lab &&
+        !(read_big_u32(header->profile_class) == skcms_Signature_link &&
+          is_device_link(profile))) {
         return false;
     }
 
@@ -1343,50 +1670,212 @@ bool skcms_ParseWithA2BPriority(const void* buf, size_t len,
         }
     }
 
+    // Note which A2B, B2A, and CICP tags we want, to be decoded by skcms_ResolveProfile().
     for (int i = 0; i < priorities; i++) {
-        // enum { perceptual, relative_colormetric, saturation }
-        if (priority[i] < 0 || priority[i] > 2) {
-            return false;
-        }
         uint32_t sig = skcms_Signature_A2B0 + static_cast<uint32_t>(priority[i]);
         skcms_ICCTag tag;
         if (skcms_GetTagBySignature(profile, sig, &tag)) {
-            if (!read_a2b(&tag, &profile->A2B, pcs_is_xyz)) {
-                // Malformed A2B tag
-                return false;
-            }
-            profile->has_A2B = true;
+            profile->deferred_A2B = sig;
             break;
         }
     }
 
-    for (int i = 0; i < priorities; i++) {
-        // enum { perceptual, relative_colormetric, saturation }
-        if (priority[i] < 0 || priority[i] > 2) {
-            return false;
-        }
+    // Device links only go one way.
+    for (int i = 0; i < priorities && !is_device_link(profile); i++) {
         uint32_t sig = skcms_Signature_B2A0 + static_cast<uint32_t>(priority[i]);
         skcms_ICCTag tag;
         if (skcms_GetTagBySignature(profile, sig, &tag)) {
-            if (!read_b2a(&tag, &profile->B2A, pcs_is_xyz)) {
-                // Malformed B2A tag
-                return false;
-            }
-            profile->has_B2A = true;
+            profile->deferred_B2A = sig;
             break;
         }
     }
 
     skcms_ICCTag cicp_tag;
-    if (skcms_GetTagBySignature(profile, skcms_Signature_CICP, &cicp_tag)) {
-        if (!read_cicp(&cicp_tag, &profile->CICP)) {
-            // Malformed CICP tag
-            return false;
+    profile->deferred_CICP = skcms_GetTagBySignature(profile, skcms_Signature_CICP, &cicp_tag);
+
+    if (!lazy && !skcms_ResolveProfile(profile)) {
+        return false;
+    }
+    return usable_as_src(profile);
+}
+
+bool skcms_ParseWithA2BPriority(const void* buf, size_t len,
+                                const int priority[], const int priorities,
+                                skcms_ICCProfile* profile) {
+    return parse(buf, len, priority, priorities, /*lazy=*/false, profile);
+}
+
+bool skcms_ParseLazyWithA2BPriority(const void* buf, size_t len,
+                                    const int priority[], const int priorities,
+                                    skcms_ICCProfile* profile) {
+    return parse(buf, len, priority, priorities, /*lazy=*/true, profile);
+}
+
+static uint64_t hash_bytes(const void* buf, size_t len) {
+    // A simple multiply-rotate hash, 8 bytes at a time.  It only needs to be quick and spread
+    // distinct inputs around.
+    const uint8_t* bytes = (const uint8_t*)buf;
+    uint64_t h = len;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        h = (h ^ word) * 0x9E3779B97F4A7C15ull;
+        h = (h << 31) | (h >> 33);
+        bytes += 8;
+        len   -= 8;
+    }
+    while (len --> 0) {
+        h = (h ^ *bytes++) * 0x9E3779B97F4A7C15ull;
+    }
+    return h ^ (h >> 29);
+}
+
+static const uint8_t* rebase(const uint8_t* ptr, const uint8_t* from, const uint8_t* to) {
+    return ptr ? to + (ptr - from) : nullptr;
+}
+
+static void rebase_curve(skcms_Curve* curve, const uint8_t* from, const uint8_t* to) {
+    // Parametric curves alias their table pointers with skcms_TransferFunction floats.
+    if (curve->table_entries) {
+        curve->table_8  = rebase(curve->table_8 , from, to);
+        curve->table_16 = rebase(curve->table_16, from, to);
+    }
+}
+
+// Point a profile parsed from one buffer at an identical copy of that buffer.
+static void rebase_profile(skcms_ICCProfile* profile, const uint8_t* to) {
+    const uint8_t* from = profile->buffer;
+    profile->buffer = to;
+
+    for (int i = 0; i < ARRAY_COUNT(profile->trc); i++) {
+        rebase_curve(profile->trc + i, from, to);
+    }
+
+    skcms_A2B* a2b = &profile->A2B;
+    for (int i = 0; i < ARRAY_COUNT(a2b->input_curves); i++) {
+        rebase_curve(a2b->input_curves + i, from, to);
+    }
+    for (int i = 0; i < ARRAY_COUNT(a2b->matrix_curves); i++) {
+        rebase_curve(a2b->matrix_curves + i, from, to);
+    }
+    for (int i = 0; i < ARRAY_COUNT(a2b->output_curves); i++) {
+        rebase_curve(a2b->output_curves + i, from, to);
+    }
+    a2b->grid_8  = rebase(a2b->grid_8 , from, to);
+    a2b->grid_16 = rebase(a2b->grid_16, from, to);
+
+    skcms_B2A* b2a = &profile->B2A;
+    for (int i = 0; i < ARRAY_COUNT(b2a->input_curves); i++) {
+        rebase_curve(b2a->input_curves + i, from, to);
+    }
+    for (int i = 0; i < ARRAY_COUNT(b2a->matrix_curves); i++) {
+        rebase_curve(b2a->matrix_curves + i, from, to);
+    }
+    for (int i = 0; i < ARRAY_COUNT(b2a->output_curves); i++) {
+        rebase_curve(b2a->output_curves + i, from, to);
+    }
+    b2a->grid_8  = rebase(b2a->grid_8 , from, to);
+    b2a->grid_16 = rebase(b2a->grid_16, from, to);
+}
+
+// skcms_ParseBatch() takes at most this many profiles, so its table's size fits in 32 bits.
+static const int kMaxBatch = 1 << 30;
+
+// Our dedupe hash table has a power of two number of slots, at least twice n <= kMaxBatch.
+static uint32_t batch_table_slots(int n) {
+    uint32_t slots = 1;
+    while (slots < 2*(uint32_t)n) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+size_t skcms_ParseBatchScratchCount(int n) {
+    return 0 < n && n <= kMaxBatch ? batch_table_slots(n) + 2*(size_t)n : 0;
+}
+
+typedef struct {
+    const skcms_ProfileData* data;
+    skcms_ICCProfile*        profiles;
+    bool*                    ok;
+    const uint32_t*          unique;
+} BatchParse;
+
+static void parse_unique(void* arg, int k) {
+    const BatchParse* batch = (const BatchParse*)arg;
+    uint32_t i = batch->unique[k];
+    batch->ok[i] = skcms_Parse(batch->data[i].buf, batch->data[i].len, batch->profiles + i);
+}
+
+int skcms_ParseBatch(const skcms_ProfileData data[], int n,
+                     skcms_ICCProfile profiles[], bool ok[],
+                     uint32_t scratch[],
+                     skcms_ParallelFor* parallel_for, void* parallel_ctx) {
+    if (n <= 0 || n > kMaxBatch || !data || !profiles || !ok || !scratch) {
+        return 0;
+    }
+
+    // scratch holds our hash table (1 + index of the first buffer with each hash, or 0),
+    // then each buffer's hash, then each buffer's leader, the first buffer identical to it.
+    const uint32_t slots = batch_table_slots(n);
+    uint32_t* table   = scratch;
+    uint32_t* hashes  = scratch + slots;
+    uint32_t* leaders = scratch + slots + n;
+    memset(table, 0, slots * SAFE_SIZEOF(*table));
+
+    int unique = 0;
+    for (int i = 0; i < n; i++) {
+        // We always memcmp() before treating two buffers as the same, so 32 bits is plenty here.
+        uint64_t h = hash_bytes(data[i].buf, data[i].len);
+        hashes[i]  = (uint32_t)(h ^ (h >> 32));
+        leaders[i] = (uint32_t)i;
+
+        for (uint32_t slot = hashes[i] & (slots-1); ; slot = (slot+1) & (slots-1)) {
+            if (table[slot] == 0) {
+                table[slot] = (uint32_t)i + 1;
+                break;
+            }
+            uint32_t j = table[slot] - 1;
+            if (hashes[j] == hashes[i] && data[j].len == data[i].len &&
+                (data[i].len == 0 || 0 == memcmp(data[j].buf, data[i].buf, data[i].len))) {
+                leaders[i] = j;
+                break;
+            }
+        }
+        if (leaders[i] == (uint32_t)i) {
+            unique++;
         }
-        profile->has_CICP = true;
     }
 
-    return usable_as_src(profile);
+    // We're done with hashes, so reuse that space to list the unique buffers.
+    uint32_t* uniques = hashes;
+    for (int i = 0, k = 0; i < n; i++) {
+        if (leaders[i] == (uint32_t)i) {
+            uniques[k++] = (uint32_t)i;
+        }
+    }
+
+    BatchParse batch = { data, profiles, ok, uniques };
+    if (parallel_for) {
+        parallel_for(parallel_ctx, unique, parse_unique, &batch);
+    } else {
+        for (int k = 0; k < unique; k++) {
+            parse_unique(&batch, k);
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        uint32_t j = leaders[i];
+        if (j != (uint32_t)i) {
+            ok[i] = ok[j];
+            // A failed parse leaves nothing worth copying.
+            if (ok[i]) {
+                profiles[i] = profiles[j];
+                rebase_profile(profiles + i, (const uint8_t*)data[i].buf);
+            }
+        }
+    }
+    return n - unique;
 }
 
 
@@ -1483,6 +1972,13 @@ const skcms_ICCProfile* skcms_sRGB_profile() {
 
         false, // has_CICP, followed by cicp itself which we don't care about.
         { 0, 0, 0, 0 },
+
+        0,     // deferred_A2B
+        0,     // deferred_B2A
+        false, // deferred_CICP
+
+        false, // has_tag_index, followed by the index itself, moot here
+        { 0 },
     };
     return &sRGB_profile;
 }
@@ -1579,6 +2075,13 @@ const skcms_ICCProfile* skcms_XYZD50_profile() {
 
         false, // has_CICP, followed by cicp itself which we don't care about.
         { 0, 0, 0, 0 },
+
+        0,     // deferred_A2B
+        0,     // deferred_B2A
+        false, // deferred_CICP
+
+        false, // has_tag_index, followed by the index itself, moot here
+        { 0 },
     };
 
     return &XYZD50_profile;
@@ -1618,64 +2121,223 @@ const uint8_t skcms_252_random_bytes[] = {
     112, 36, 224, 136, 202, 76, 94, 98, 175, 213
 };
 
-bool skcms_ApproximatelyEqualProfiles(const skcms_ICCProfile* A, const skcms_ICCProfile* B) {
-    // Test for exactly equal profiles first.
-    if (A == B || 0 == memcmp(A,B, sizeof(skcms_ICCProfile))) {
-        return true;
-    }
+// skcms_ProfileFingerprint() of each skcms_KnownProfile, in enum order.
+// tests.c checks these against freshly computed fingerprints.
+static const skcms_Fingerprint kKnownFingerprints[] = {
+    // sRGB
+    {{
+         52,  86,  50, 164, 214,  30,  76, 102,  23,  25,  14,  47,  30,  17,  73,  94,  72,   9,
+         77, 137,  39, 108,  59,  46,  28,  23,  17, 110,  71,  38, 161, 163,  21,  77,  95,  12,
+         45,  68,  44,  68,  38, 141, 166, 141, 157,  76,  98, 142, 124, 134,  79,  65,  85,  26,
+         42,  21,  84, 138, 119,  14, 139,  76, 156, 118,  65,  32,  12,   5,  57, 210, 239, 102,
+        127,  64, 143, 137, 183,  44,  34,  16, 119,  74, 114,  69,  72,  74,  47,  55,  44,  61,
+         31,  16,  69, 137, 141,  83, 142, 203, 111, 131,  72, 111,  66, 118,  16, 117, 141, 134,
+         57,  77,  25,  84,  43,   5,  85, 149,  51,   8,   9,   8,  24,  15, 102,  38,  43,  80,
+         29,  13, 123,  40,  42,   5,  72, 101, 113,  11,  11,  26,  35,  55,  12,  77,  49,  19,
+        142, 105, 142, 181, 173,  88, 163, 115, 182,  92,  55,  30,  64, 108,  47,  82, 135,  62,
+         25,  15,  15,  98, 178,  29,  81, 128,  36, 120, 101,  12,  33,  23,  38,  53,  46,  13,
+         14,   9,  51,   6,   3,  27,  63,  44,  29, 105,  96, 107,  85,  55,  96,  57,  97,  14,
+         81,  40,  91,  47,  23,  38,  43,  48,  79,  93, 102, 139,  42,  66,  21,  50,  36, 129,
+         17,  10,  49,  88,  46,   6,  89, 151,  20,   3,   2,  12,  79,  89, 164,  99, 169,  27,
+         67,  41,  44,  57,  69,  57,  92,  59,  34,  84, 141,  63,  77,  48,  24,  80,  96, 132,
+    }, false, 0x2f924c573dd0bab5ull},
+    // Display P3
+    {{
+         43,  83,  48, 153, 211,  14,  69, 100,  17,  29,  15,  51,  34,  18,  80, 103,  75,   4,
+         60, 132,  31, 125,  63,  46,  30,  24,  17, 124,  75,  36, 165, 164,   9,  74,  94,   5,
+         38,  67,  43,  76,  41, 152, 175, 143, 161,  68,  96, 148, 123, 133,  76,  60,  83,  21,
+         49,  23,  91, 148, 121,   5, 159,  81, 167, 137,  70,  30,  13,   6,  63, 205, 237,  92,
+        148,  69, 153, 126, 180,  32,  38,  18, 130,  63, 111,  66,  73,  74,  45,  59,  45,  63,
+         36,  17,  75, 138, 141,  80, 125, 198, 104, 150,  77, 117,  51, 114,   7, 111, 139, 135,
+         52,  75,  21, 100,  47,   3,  67, 144,  43,   7,   9,   8,  26,  15, 112,  36,  43,  85,
+         31,  15, 135,  41,  42,   2,  63,  99, 116,  11,  11,  28,  30,  54,   9,  87,  51,  17,
+        155, 108, 149, 187, 174,  83, 179, 119, 192, 106,  58,  29,  51, 104,  42,  67, 131,  56,
+         29,  16,  16,  76, 172,  16,  68, 125,  28, 130, 103,   5,  37,  24,  40,  57,  47,  10,
+         14,  10,  55,   7,   3,  29,  70,  46,  29, 108,  97, 110,  95,  58, 102,  46,  94,   7,
+         94,  43,  98,  55,  25,  40,  41,  48,  83,  90, 101, 145,  35,  64,  18,  52,  37, 140,
+         18,  10,  53, 103,  50,   3,  73, 146,   9,   3,   2,  13,  75,  88, 173,  79, 164,  15,
+         77,  43,  45,  54,  68,  57, 104,  62,  33,  68, 137,  57,  87,  51,  23,  75,  94, 138,
+    }, false, 0xdc8dc6e7431b89ecull},
+    // Adobe RGB (1998)
+    {{
+         32,  77,  49, 147, 206,  21,  65,  98,  19,  31,  16,  50,  36,  19,  78, 117,  84,   8,
+         43, 121,  33, 145,  77,  49,  33,  25,  17, 142,  88,  40, 174, 171,  16,  74,  94,   8,
+         31,  62,  43,  82,  45, 148, 185, 152, 161,  57,  89, 145, 125, 135,  79,  57,  82,  23,
+         54,  26,  89, 162, 132,  11, 178,  96, 164, 159,  86,  34,  12,   5,  61, 204, 236,  99,
+        168,  84, 152, 119, 174,  38,  39,  18, 126,  51, 103,  68,  76,  77,  47,  64,  48,  63,
+         39,  19,  74, 143, 145,  84, 110, 186, 107, 171,  92, 118,  37, 105,  10, 104, 135, 135,
+         48,  73,  23, 118,  60,   6,  49, 131,  45,   5,   8,   7,  24,  14, 108,  32,  40,  83,
+         30,  14, 129,  43,  43,   4,  52,  92, 114,   9,  10,  27,  25,  51,   9, 101,  61,  19,
+        168, 119, 148, 196, 182,  88, 195, 131, 189, 122,  70,  32,  38,  96,  43,  52, 121,  58,
+         32,  19,  16,  54, 156,  19,  56, 117,  31, 144, 113,  10,  40,  26,  40,  63,  51,  12,
+         13,   8,  54,   6,   3,  28,  79,  52,  30, 113, 101, 111, 105,  65, 101,  35,  87,   9,
+        108,  54,  98,  64,  32,  41,  38,  46,  81,  87,  99, 142,  29,  60,  18,  52,  37, 135,
+         18,  10,  52, 122,  63,   6,  58, 135,  13,   3,   1,  12,  67,  84, 168,  61, 151,  18,
+         88,  51,  46,  51,  67,  58, 119,  73,  36,  51, 125,  59, 101,  60,  25,  67,  90, 135,
+    }, false, 0xb6a282bf50764ad8ull},
+    // Rec. 2020 with the PQ transfer function
+    {{
+          3,  11,   2,  66, 172,   7,   5,  14,   1,   1,   0,   3,   2,   1,   9,  40,  18,   0,
+         13,  53,   3,  96,  40,   2,   1,   1,   0,  80,  33,   1, 122,  75,   1,   6,  11,   0,
+          2,   5,   2,  15,   6,  70, 100,  50,  78,  12,  15,  57,  22,  26,   7,   3,   8,   1,
+          4,   2,  13, 120,  55,   0, 139,  57,  97, 155,  64,   0,   1,   0,   5, 143, 214,  17,
+        118,  48,  73,  33,  96,   5,   7,   2,  41,   7,  24,   5,   6,   5,   2,   4,   2,   5,
+          2,   1,   8,  37,  33,   8,  46, 169,  22, 137,  57,  28,   8,  32,   1,  17,  34,  41,
+          2,   6,   1,  57,  24,   0,  18,  71,   4,   0,   0,   0,   4,   1,  25,   2,   2,  10,
+          7,   3,  46,   2,   2,   0,   7,  16,  24,   0,   0,   1,   1,   3,   0,  26,  11,   0,
+         84,  37,  61, 152,  89,   9, 154,  65, 163,  50,  21,   1,   6,  23,   2,  12,  46,   5,
+          1,   0,   0,  37, 149,   7,   9,  36,   2,  77,  35,   0,   1,   1,   2,   5,   3,   0,
+          1,   0,   3,   0,   0,   1,  10,   4,   1,  17,  11,  22,  19,   8,  18,   4,  16,   1,
+         24,  10,  17,   6,   2,   2,   2,   2,   9,  12,  13,  53,   1,   5,   0,   9,   3,  51,
+          1,   0,   3,  64,  26,   0,  17,  69,   3,   0,   0,   0,  18,  13, 105,  27, 111,   5,
+         14,   6,   2,   2,   4,   3,  41,  17,   1,  14,  55,   5,  25,  11,   0,  10,  12,  44,
+    }, false, 0xc2855a4a30b74339ull},
+    // Rec. 2020 with the HLG transfer function, scaled to [0,1] as in real profiles
+    {{
+         12,  37,  19, 100, 189,   9,  26,  46,   7,  13,   6,  20,  14,   7,  35,  77,  43,   1,
+         23,  88,  13, 126,  54,  18,  14,  10,   7, 114,  55,  14, 151, 117,   3,  30,  41,   2,
+         11,  26,  17,  40,  19, 110, 142,  89, 118,  27,  44,  99,  62,  69,  32,  22,  35,   8,
+         22,   9,  43, 145,  84,   1, 164,  71, 133, 164,  70,  12,   4,   2,  26, 173, 226,  44,
+        148,  61, 112,  65, 135,  15,  19,   7,  80,  21,  58,  27,  30,  30,  18,  25,  18,  25,
+         16,   7,  32,  81,  77,  34,  65, 178,  52, 159,  69,  65,  18,  66,   3,  48,  75,  82,
+         19,  31,   8,  91,  38,   1,  28, 104,  18,   2,   4,   3,  11,   6,  61,  12,  16,  38,
+         16,   6,  86,  17,  17,   1,  22,  46,  61,   4,   4,  11,   9,  21,   3,  60,  30,   7,
+        125,  67, 102, 175, 127,  35, 177,  88, 179,  87,  40,  12,  16,  54,  17,  25,  83,  23,
+         14,   7,   7,  41, 159,   9,  26,  73,  12, 113,  65,   1,  16,  10,  16,  27,  20,   4,
+          5,   3,  22,   2,   1,  12,  37,  21,  11,  53,  42,  57,  53,  28,  51,  15,  46,   2,
+         60,  24,  48,  28,  11,  16,  14,  18,  36,  38,  44,  94,  11,  26,   7,  25,  16,  91,
+          7,   4,  21,  97,  41,   1,  32, 104,   4,   1,   0,   6,  35,  39, 140,  39, 136,   8,
+         44,  22,  18,  19,  27,  22,  79,  39,  13,  26,  91,  23,  59,  29,   9,  30,  41,  85,
+    }, false, 0xba3f7f413d3c2f61ull},
+    // XYZD50
+    {{
+          8, 179, 128, 204, 253,  38, 134, 184,  68, 102,  32, 138,  99,  39, 169, 215, 119,  26,
+          3, 223,  95, 239,  52, 132, 114,  74,  81, 234,  97, 116, 244, 205,  30, 154, 173,  12,
+         51, 159, 122, 153,  61, 226, 236, 178, 229,  55, 181, 220, 191, 194, 160, 126, 168,  82,
+        131,  18, 180, 245, 163,  22, 246,  69, 235, 252,  57, 108,  14,   6, 152, 240, 255, 171,
+        242,  20, 227, 177, 238,  96,  85,  16, 211,  70, 200, 149, 155, 146, 127, 145, 100, 151,
+        109,  19, 165, 208, 195, 164, 137, 254, 182, 248,  64, 201,  45, 209,   5, 147, 207, 210,
+        113, 162,  83, 225,   9,  31,  15, 231, 115,  37,  58,  53,  24,  49, 197,  56, 120, 172,
+         48,  21, 214, 129, 111,  11,  50, 187, 196,  34,  60, 103,  71, 144,  47, 203,  77,  80,
+        232, 140, 222, 250, 206, 166, 247, 139, 249, 221,  72, 106,  27, 199, 117,  54, 219, 135,
+        118,  40,  79,  41, 251,  46,  93, 212,  92, 233, 148,  28, 121,  63, 123, 158, 105,  59,
+         29,  42, 143,  23,   0, 107, 176,  87, 104, 183, 156, 193, 189,  90, 188,  65, 190,  17,
+        198,   7, 186, 161,   1, 124,  78, 125, 170, 133, 174, 218,  67, 157,  75, 101,  89, 217,
+         62,  33, 141, 228,  25,  35,  91, 230,   4,   2,  13,  73,  86, 167, 237,  84, 243,  44,
+        185,  66, 130, 110, 150, 142, 216,  88, 112,  36, 224, 136, 202,  76,  94,  98, 175, 213,
+    }, false, 0x912d695d8da227dcull},
+};
 
+bool skcms_ProfileFingerprint(const skcms_ICCProfile* profile, skcms_Fingerprint* fp) {
     // For now this is the essentially the same strategy we use in test_only.c
-    // for our skcms_Transform() smoke tests:
-    //    1) transform A to XYZD50
-    //    2) transform B to XYZD50
-    //    3) return true if they're similar enough
-    // Our current criterion in 3) is maximum 1 bit error per XYZD50 byte.
+    // for our skcms_Transform() smoke tests: transform to XYZD50 and record the result.
 
     // skcms_252_random_bytes are 252 of a random shuffle of all possible bytes.
     // 252 is evenly divisible by 3 and 4.  Only 192, 10, 241, and 43 are missing.
 
-    // We want to allow otherwise equivalent profiles tagged as grayscale and RGB
-    // to be treated as equal.  But CMYK profiles are a totally different ballgame.
-    const auto CMYK = skcms_Signature_CMYK;
-    if ((A->data_color_space == CMYK) != (B->data_color_space == CMYK)) {
-        return false;
-    }
-
     // Interpret as RGB_888 if data color space is RGB or GRAY, RGBA_8888 if CMYK.
     // TODO: working with RGBA_8888 either way is probably fastest.
     skcms_PixelFormat fmt = skcms_PixelFormat_RGB_888;
     size_t npixels = 84;
-    if (A->data_color_space == skcms_Signature_CMYK) {
+    fp->cmyk = profile->data_color_space == skcms_Signature_CMYK;
+    if (fp->cmyk) {
         fmt = skcms_PixelFormat_RGBA_8888;
         npixels = 63;
     }
 
-    // TODO: if A or B is a known profile (skcms_sRGB_profile, skcms_XYZD50_profile),
-    // use pre-canned results and skip that skcms_Transform() call?
-    uint8_t dstA[252],
-            dstB[252];
-    if (!skcms_Transform(
-                skcms_252_random_bytes,     fmt, skcms_AlphaFormat_Unpremul, A,
-                dstA, skcms_PixelFormat_RGB_888, skcms_AlphaFormat_Unpremul, skcms_XYZD50_profile(),
-                npixels)) {
-        return false;
-    }
+    memset(fp->xyz, 0, sizeof(fp->xyz));
     if (!skcms_Transform(
-                skcms_252_random_bytes,     fmt, skcms_AlphaFormat_Unpremul, B,
-                dstB, skcms_PixelFormat_RGB_888, skcms_AlphaFormat_Unpremul, skcms_XYZD50_profile(),
+                skcms_252_random_bytes, fmt, skcms_AlphaFormat_Unpremul,
+                profile,
+                fp->xyz, skcms_PixelFormat_RGB_888, skcms_AlphaFormat_Unpremul,
+                skcms_XYZD50_profile(),
                 npixels)) {
         return false;
     }
 
-    // TODO: make sure this final check has reasonable codegen.
-    for (size_t i = 0; i < 252; i++) {
-        if (abs((int)dstA[i] - (int)dstB[i]) > 1) {
-            return false;
+    fp->hash = hash_bytes(fp->xyz, sizeof(fp->xyz)) ^ (fp->cmyk ? 1 : 0);
+    return true;
+}
+
+bool skcms_ApproximatelyEqualFingerprints(const skcms_Fingerprint* A,
+                                          const skcms_Fingerprint* B) {
+    // We want to allow otherwise equivalent profiles tagged as grayscale and RGB
+    // to be treated as equal.  But CMYK profiles are a totally different ballgame.
+    if (A->cmyk != B->cmyk) {
+        return false;
+    }
+
+    // Our current criterion is maximum 1 bit error per XYZD50 byte.
+    for (size_t i = 0; i < sizeof(A->xyz); i++) {
+        if (abs((int)A->xyz[i] - (int)B->xyz[i]) > 1) {
+            return false;
         }
     }
     return true;
 }
 
+const skcms_Fingerprint* skcms_KnownProfileFingerprint(skcms_KnownProfile known) {
+    int i = (int)known - 1;
+    return 0 <= i && i < ARRAY_COUNT(kKnownFingerprints) ? kKnownFingerprints + i : nullptr;
+}
+
+skcms_KnownProfile skcms_IdentifyFingerprint(const skcms_Fingerprint* fp) {
+    for (int i = 0; i < ARRAY_COUNT(kKnownFingerprints); i++) {
+        if (skcms_ApproximatelyEqualFingerprints(fp, kKnownFingerprints + i)) {
+            return (skcms_KnownProfile)(i + 1);
+        }
+    }
+    return skcms_KnownProfile_Unknown;
+}
+
+skcms_KnownProfile skcms_IdentifyProfile(const skcms_ICCProfile* profile) {
+    skcms_Fingerprint fp;
+    return skcms_ProfileFingerprint(profile, &fp) ? skcms_IdentifyFingerprint(&fp)
+                                                  : skcms_KnownProfile_Unknown;
+}
+
+// Our two static profiles are the most common arguments to skcms_ApproximatelyEqualProfiles(),
+// and we already know their fingerprints.
+static const skcms_Fingerprint* canned_fingerprint(const skcms_ICCProfile* profile) {
+    if (profile == skcms_sRGB_profile()) {
+        return skcms_KnownProfileFingerprint(skcms_KnownProfile_sRGB);
+    }
+    if (profile == skcms_XYZD50_profile()) {
+        return skcms_KnownProfileFingerprint(skcms_KnownProfile_XYZD50);
+    }
+    return nullptr;
+}
+
+bool skcms_ApproximatelyEqualProfiles(const skcms_ICCProfile* A, const skcms_ICCProfile* B) {
+    // Test for exactly equal profiles first.
+    if (A == B || 0 == memcmp(A,B, sizeof(skcms_ICCProfile))) {
+        return true;
+    }
+
+    // CMYK never matches RGB or gray, so don't bother fingerprinting.
+    const auto CMYK = skcms_Signature_CMYK;
+    if ((A->data_color_space == CMYK) != (B->data_color_space == CMYK)) {
+        return false;
+    }
+
+    skcms_Fingerprint fpA, fpB;
+    const skcms_Fingerprint* a = canned_fingerprint(A);
+    const skcms_Fingerprint* b = canned_fingerprint(B);
+    if (!a) {
+        if (!skcms_ProfileFingerprint(A, &fpA)) {
+            return false;
+        }
+        a = &fpA;
+    }
+    if (!b) {
+        if (!skcms_ProfileFingerprint(B, &fpB)) {
+            return false;
+        }
+        b = &fpB;
+    }
+    return skcms_ApproximatelyEqualFingerprints(a, b);
+}
+
 bool skcms_TRCs_AreApproximateInverse(const skcms_ICCProfile* profile,
                                       const skcms_TransferFunction* inv_tf) {
     if (!profile || !profile->has_trc) {
@@ -2010,35 +2672,7 @@ bool skcms_TransferFunction_invert(const skcms_TransferFunction* src, skcms_Tran
 //    ∂r/∂b =  g(ay + b)^(g-1)
 //          -  g(ad + b)^(g-1)
 
-// Return the residual of roundtripping skcms_Curve(x) through f_inv(y) with parameters P,
-// and fill out the gradient of the residual into dfdP.
-static float rg_nonlinear(float x,
-                          const skcms_Curve* curve,
-                          const skcms_TransferFunction* tf,
-                          float dfdP[3]) {
-    const float y = eval_curve(curve, x);
-
-    const float g = tf->g, a = tf->a, b = tf->b,
-                c = tf->c, d = tf->d, f = tf->f;
-
-    const float Y = fmaxf_(a*y + b, 0.0f),
-                D =        a*d + b;
-    assert (D >= 0);
-
-    // The gradient.
-    dfdP[0] = logf_(Y)*powf_(Y, g)
-            - logf_(D)*powf_(D, g);
-    dfdP[1] = y*g*powf_(Y, g-1)
-            - d*g*powf_(D, g-1);
-    dfdP[2] =   g*powf_(Y, g-1)
-            -   g*powf_(D, g-1);
-
-    // The residual.
-    const float f_inv = powf_(Y, g)
-                      - powf_(D, g)
-                      + c*d + f;
-    return x - f_inv;
-}
+// rg_nonlinear() in Transform_inl.h evaluates these residuals and gradients.
 
 static bool gauss_newton_step(const skcms_Curve* curve,
                                     skcms_TransferFunction* tf,
@@ -2084,17 +2718,25 @@ static bool gauss_newton_step(const skcms_Curve* curve,
     // 1,2) evaluate lhs and evaluate rhs
     //   We want to evaluate Jf only once, but both lhs and rhs involve Jf^T,
     //   so we'll have to update lhs and rhs at the same time.
-    for (int i = 0; i < N; i++) {
-        float x = x0 + static_cast<float>(i)*dx;
-
-        float dfdP[3] = {0,0,0};
-        float resid = rg_nonlinear(x,curve,tf, dfdP);
-
-        for (int r = 0; r < 3; r++) {
-            for (int c = 0; c < 3; c++) {
-                lhs.vals[r][c] += dfdP[r] * dfdP[c];
+    //   We evaluate residuals and Jf a chunk at a time with fit_kernels(),
+    //   but accumulate them here one point at a time, in order.
+    assert(curve->table_entries > 0);
+    const FitKernels kernels = fit_kernels();
+    for (int i = 0; i < N; i += kFitChunk) {
+        const int n = N - i < kFitChunk ? N - i : kFitChunk;
+        float resids[kFitChunk], dfdg[kFitChunk], dfda[kFitChunk], dfdb[kFitChunk];
+        kernels.rg_nonlinear(curve, tf, x0, dx, i, n, resids, dfdg, dfda, dfdb);
+
+        for (int j = 0; j < n; j++) {
+            const float dfdP[3] = { dfdg[j], dfda[j], dfdb[j] },
+                        resid   = resids[j];
+
+            for (int r = 0; r < 3; r++) {
+                for (int c = 0; c < 3; c++) {
+                    lhs.vals[r][c] += dfdP[r] * dfdP[c];
+                }
+                rhs.vals[r] += dfdP[r] * resid;
             }
-            rhs.vals[r] += dfdP[r] * resid;
         }
     }
 
@@ -2359,6 +3001,54 @@ static CpuType cpu_type() {
     #endif
 }
 
+static FitKernels fit_kernels() {
+    switch (cpu_type()) {
+        case CpuType::SKX:
+            #if !defined(SKCMS_DISABLE_SKX)
+                return { skx::roundtrip_errors, skx::rg_nonlinear };
+            #endif
+
+        case CpuType::HSW:
+            #if !defined(SKCMS_DISABLE_HSW)
+                return { hsw::roundtrip_errors, hsw::rg_nonlinear };
+            #endif
+
+        case CpuType::Baseline:
+            break;
+    }
+    return { baseline::roundtrip_errors, baseline::rg_nonlinear };
+}
+
+// The half-float pipeline only pays off with AVX-512 FP16 arithmetic.  SKCMS_FORCE_F16 uses it
+// wherever it's compiled in, emulated in software if need be, so it can be tested anywhere.
+#if defined(SKCMS_FORCE_F16)
+    #define SKCMS_MAY_USE_F16 1
+#elif defined(SKCMS_PORTABLE) || !defined(__x86_64__) || defined(SKCMS_FORCE_BASELINE)
+    #define SKCMS_MAY_USE_F16 0
+#else
+    #define SKCMS_MAY_USE_F16 1
+#endif
+
+static bool f16_available() {
+    #if defined(SKCMS_FORCE_F16)
+        return true;
+    #elif !SKCMS_MAY_USE_F16
+        return false;
+    #else
+        static const bool available = []{
+            // cpu_type() has checked the prerequisites, and that we may check at all.
+            if (cpu_type() != CpuType::SKX) {
+                return false;
+            }
+            uint32_t eax, ebx, ecx, edx;
+            __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                                         : "0"(7), "2"(0));
+            return (edx & (1u<<23)) != 0;  // AVX512-FP16
+        }();
+        return available;
+    #endif
+}
+
 static bool tf_is_gamma(const skcms_TransferFunction& tf) {
     return tf.g > 0 && tf.a == 1 &&
            tf.b == 0 && tf.c == 0 && tf.d == 0 && tf.e == 0 && tf.f == 0;
@@ -2402,6 +3092,138 @@ static OpAndArg select_curve_op(const skcms_Curve* curve, int channel) {
     return OpAndArg{op.table, curve};
 }
 
+// Which of the PreparedTF or PreparedHLG contexts does this op take, if either?
+enum class CurveCtx { None, TF, HLG };
+
+static CurveCtx curve_ctx(Op op) {
+    switch (op) {
+        case Op::gamma_r:  case Op::gamma_g:  case Op::gamma_b:  case Op::gamma_a:
+        case Op::gamma_rgb:
+        case Op::tf_r:     case Op::tf_g:     case Op::tf_b:     case Op::tf_a:
+        case Op::tf_rgb:
+        case Op::pq_r:     case Op::pq_g:     case Op::pq_b:     case Op::pq_a:
+        case Op::pq_rgb:
+            return CurveCtx::TF;
+
+        case Op::hlg_r:    case Op::hlg_g:    case Op::hlg_b:    case Op::hlg_a:
+        case Op::hlg_rgb:
+        case Op::hlginv_r: case Op::hlginv_g: case Op::hlginv_b: case Op::hlginv_a:
+        case Op::hlginv_rgb:
+            return CurveCtx::HLG;
+
+        default:
+            return CurveCtx::None;
+    }
+}
+
+// Each parametric curve op has a _precise variant, in a set laid out like the default ones.
+// skcms_Precision_Fast evaluates curves like skcms_Precision_Default.
+static Op with_precision(Op op, skcms_Precision precision) {
+    static constexpr int kStride = (int)Op::gamma_r_precise - (int)Op::gamma_r;
+    static_assert((int)Op::hlginv_rgb_precise - (int)Op::hlginv_rgb == kStride, "");
+    return precision == skcms_Precision_Precise ? (Op)((int)op + kStride) : op;
+}
+
+static void prepare_tf(const skcms_TransferFunction& tf, PreparedTF* p) {
+    static_assert(sizeof(tf) == sizeof(*p), "");
+    memcpy(p, &tf, sizeof(tf));
+}
+
+static void prepare_hlg(const skcms_TransferFunction& tf, PreparedHLG* hlg) {
+    TF_HLGish p;
+    classify(tf, nullptr, &p);
+
+    const float log2_e = 1.4426950408889634074f,
+                ln_2   = 0.69314718f;
+    hlg->R        = p.R;
+    hlg->G        = p.G;
+    hlg->b        = p.b;
+    hlg->c        = p.c;
+    hlg->K        = p.K_minus_1 + 1;
+    hlg->inv_K    = 1 / hlg->K;
+    hlg->a_log2e  = p.a * log2_e;
+    hlg->ac_log2e = p.a * p.c * log2_e;
+    hlg->a_ln2    = p.a * ln_2;
+}
+
+// Linear [0,1] (0-10000 nits) to PQ encoded, as pq_encode() does in the tonemap stages.
+static float pq_encode_(float Y) {
+    float Ym = powf_(Y, 1305/8192.0f);
+    return powf_((107/128.0f + (2413/128.0f)*Ym) / (1 + (2392/128.0f)*Ym), 2523/32.0f);
+}
+
+// Pick the tonemap op and derive its constants for src, a TRC source, or return false if src
+// isn't PQ or HLG or the parameters make no sense.
+static bool prepare_tone_map(const skcms_ToneMap& tm, const skcms_ICCProfile* src,
+                             Op* op, ToneMapCtx* ctx) {
+    if (!(tm.source_peak  > 0 && tm.source_peak  < INFINITY_) ||
+        !(tm.target_white > 0 && tm.target_white < INFINITY_)) {
+        return false;
+    }
+
+    // How many nits does linear 1.0 from src's curves stand for?  PQ's are absolute, with
+    // 1.0 at 10000 nits.  HLG's are relative, and we put their peak signal at source_peak.
+    const skcms_Curve* curve = &src->trc[1];
+    const bool parametric = curve->table_entries == 0;
+    float unit_nits;
+    if ((src->has_CICP && src->CICP.transfer_characteristics == 16) ||
+            (!src->has_CICP && parametric && skcms_TransferFunction_isPQish(&curve->parametric))) {
+        unit_nits = 10000;
+    } else if ((src->has_CICP && src->CICP.transfer_characteristics == 18) ||
+            (!src->has_CICP && parametric && skcms_TransferFunction_isHLGish(&curve->parametric))) {
+        const float signal_peak = eval_curve(curve, 1.0f);
+        if (!(signal_peak > 0)) {
+            return false;
+        }
+        unit_nits = tm.source_peak / signal_peak;
+    } else {
+        return false;
+    }
+
+    *ctx = ToneMapCtx{};
+    switch (tm.curve) {
+        case skcms_ToneMapCurve_BT2390: {
+            *op = Op::tonemap_bt2390;
+            ctx->in_scale    = unit_nits / 10000;
+            ctx->out_scale   = 10000 / tm.target_white;
+            ctx->pq_peak     = pq_encode_(tm.source_peak / 10000);
+            ctx->inv_pq_peak = 1 / ctx->pq_peak;
+            ctx->max_lum     = pq_encode_(tm.target_white / 10000) * ctx->inv_pq_peak;
+            ctx->ks          = 1.5f * ctx->max_lum - 0.5f;
+            ctx->inv_1_ks    = ctx->ks < 1 ? 1 / (1 - ctx->ks) : 0;
+        } return true;
+
+        case skcms_ToneMapCurve_Reinhard: {
+            const float peak = tm.source_peak / tm.target_white;
+            *op = Op::tonemap_reinhard;
+            ctx->in_scale  = unit_nits / tm.target_white;
+            ctx->out_scale = 1;
+            ctx->inv_peak2 = 1 / (peak * peak);
+        } return true;
+    }
+    return false;
+}
+
+// Derive gamut_map's luminance weights from dst's gamut and its knee from mapping.
+static bool prepare_gamut_map(skcms_GamutMapping mapping, const skcms_ICCProfile* dst,
+                              GamutMapCtx* ctx) {
+    const float* Y = dst->toXYZD50.vals[1];
+    const float sum = Y[0] + Y[1] + Y[2];
+    if (!(sum > 0)) {
+        return false;
+    }
+    ctx->wr = Y[0] / sum;
+    ctx->wg = Y[1] / sum;
+    ctx->wb = Y[2] / sum;
+
+    switch (mapping) {
+        case skcms_GamutMapping_Clip:       return false;
+        case skcms_GamutMapping_Desaturate: ctx->knee = 1.0f; return true;
+        case skcms_GamutMapping_SoftClip:   ctx->knee = 0.8f; return true;
+    }
+    return false;
+}
+
 static int select_curve_ops(const skcms_Curve* curves, int numChannels, OpAndArg* ops) {
     // We process the channels in reverse order, yielding ops in ABGR order.
     // (Working backwards allows us to fuse trailing B+G+R ops into a single RGB op.)
@@ -2500,311 +3322,2111 @@ bool skcms_Transform(const void*             src,
                      skcms_PixelFormat       dstFmt,
                      skcms_AlphaFormat       dstAlpha,
                      const skcms_ICCProfile* dstProfile,
-                     size_t                  nz) {
-    const size_t dst_bpp = bytes_per_pixel(dstFmt),
-                 src_bpp = bytes_per_pixel(srcFmt);
-    // Let's just refuse if the request is absurdly big.
-    if (nz * dst_bpp > INT_MAX || nz * src_bpp > INT_MAX) {
-        return false;
-    }
-    int n = (int)nz;
-
-    // Null profiles default to sRGB. Passing null for both is handy when doing format conversion.
-    if (!srcProfile) {
-        srcProfile = skcms_sRGB_profile();
-    }
-    if (!dstProfile) {
-        dstProfile = skcms_sRGB_profile();
-    }
+                     size_t                  npixels) {
+    return skcms_TransformWithPrecision(src, srcFmt, srcAlpha, srcProfile,
+                                        dst, dstFmt, dstAlpha, dstProfile,
+                                        npixels, skcms_Precision_Default);
+}
 
-    // We can't transform in place unless the PixelFormats are the same size.
-    if (dst == src && dst_bpp != src_bpp) {
-        return false;
-    }
-    // TODO: more careful alias rejection (like, dst == src + 1)?
+using RunProgramFn = void(*)(const Op*, const void**, ptrdiff_t,
+                             const char*, char*, int, size_t, size_t);
 
-    Op          program[32];
-    const void* context[32];
+// Checking that the half-float pipeline is precise enough runs a few thousand pixels through both
+// pipelines, so it's not worth it for smaller transforms.
+static const int kF16MinPixels = 16384;
 
-    Op*          ops      = program;
-    const void** contexts = context;
+// The JIT compiles each program once, which costs about as much as transforming a few thousand
+// pixels.  Finding it in the JIT's cache after that costs about as much as a few pixels, but
+// short transforms gain little from compiled code anyway.
+static const int kJITMinPixels = 256;
 
-    auto add_op = [&](Op o) {
-        *ops++ = o;
-        *contexts++ = nullptr;
-    };
+// The JIT runs only when the caller has opted in, and only where there's a vector ISA to emit.
+static bool jit_enabled() {
+    return sAllowJIT && cpu_type() != CpuType::Baseline;
+}
 
-    auto add_op_ctx = [&](Op o, const void* c) {
-        *ops++ = o;
-        *contexts++ = c;
-    };
+// The JIT emits AVX-512 code on SKX machines, unless a test wants the AVX2 emitter instead.
+static bool jit_avx512() {
+    return cpu_type() == CpuType::SKX && sAllowJITAVX512;
+}
 
-    auto add_curve_ops = [&](const skcms_Curve* curves, int numChannels) {
-        OpAndArg oa[4];
-        assert(numChannels <= ARRAY_COUNT(oa));
+// The probe's mixed pixels take every combination of these 8-bit levels in r, g, and b,
+// crowded toward 0 and full, where the curves are steepest and the matrix rounds most.
+static const uint8_t kProbeGrid[] = { 0,1,2,4,8,16,32,64,96,128,160,192,224,248,254,255 };
+static const int     kProbeGridCount = (int)(sizeof(kProbeGrid) / sizeof(*kProbeGrid)),
+                     kProbeMixed     = kProbeGridCount * kProbeGridCount * kProbeGridCount;
+
+// Writes pixel p of the probe set used by f16_is_precise(): every level of red alone, of green
+// alone, of blue alone, and of gray, each with that level of alpha, then the opaque kProbeGrid
+// pixels, then skcms_252_random_bytes.
+static void write_probe_pixel(int p, skcms_PixelFormat fmt, int levels, size_t bpp, char* dst) {
+    if (p >= 4*levels + kProbeMixed) {
+        memcpy(dst, skcms_252_random_bytes + (size_t)(p - 4*levels - kProbeMixed)*bpp, bpp);
+        return;
+    }
+    int r, g, b, a;
+    if (p >= 4*levels) {
+        const int i = p - 4*levels,
+                  n = kProbeGridCount;
+        r = kProbeGrid[i     % n] * (levels-1) / 255;
+        g = kProbeGrid[i / n % n] * (levels-1) / 255;
+        b = kProbeGrid[i / n / n] * (levels-1) / 255;
+        a = levels-1;
+    } else {
+        const int level = p % levels;
+        const int pattern = p / levels;
+        r = (pattern == 0 || pattern == 3) ? level : 0;
+        g = (pattern == 1 || pattern == 3) ? level : 0;
+        b = (pattern == 2 || pattern == 3) ? level : 0;
+        a = level;
+    }
 
-        int numOps = select_curve_ops(curves, numChannels, oa);
+    uint32_t px;
+    if ((fmt >> 1) == (skcms_PixelFormat_RGBA_1010102 >> 1)) {
+        px = (uint32_t)r << 0 | (uint32_t)g << 10 | (uint32_t)b << 20 | (uint32_t)(a>>8) << 30;
+    } else {
+        px = (uint32_t)r << 0 | (uint32_t)g <<  8 | (uint32_t)b << 16 | (uint32_t)a      << 24;
+    }
+    for (size_t i = 0; i < bpp; i++) {
+        dst[i] = (char)(px >> (8*i));
+    }
+}
 
-        for (int i = 0; i < numOps; ++i) {
-            add_op_ctx(oa[i].op, oa[i].arg);
+// Is every channel of every pixel within 1 LSB of each other?
+static bool within_one_lsb(skcms_PixelFormat fmt, const char* x, const char* y, int npixels) {
+    if ((fmt >> 1) == (skcms_PixelFormat_RGBA_1010102 >> 1)) {
+        for (int i = 0; i < npixels; i++) {
+            uint32_t X, Y;
+            memcpy(&X, x + 4*i, 4);
+            memcpy(&Y, y + 4*i, 4);
+            for (int shift = 0; shift < 32; shift += 10) {
+                const int mask = shift == 30 ? 0x3 : 0x3ff;
+                if (abs((int)(X >> shift & mask) - (int)(Y >> shift & mask)) > 1) {
+                    return false;
+                }
+            }
         }
-    };
-
-    // These are always parametric curves of some sort.
-    skcms_Curve dst_curves[3];
-    dst_curves[0].table_entries =
-    dst_curves[1].table_entries =
-    dst_curves[2].table_entries = 0;
-
-    skcms_Matrix3x3        from_xyz;
-
-    switch (srcFmt >> 1) {
-        default: return false;
-        case skcms_PixelFormat_A_8              >> 1: add_op(Op::load_a8);          break;
-        case skcms_PixelFormat_G_8              >> 1: add_op(Op::load_g8);          break;
-        case skcms_PixelFormat_ABGR_4444        >> 1: add_op(Op::load_4444);        break;
-        case skcms_PixelFormat_RGB_565          >> 1: add_op(Op::load_565);         break;
-        case skcms_PixelFormat_RGB_888          >> 1: add_op(Op::load_888);         break;
-        case skcms_PixelFormat_RGBA_8888        >> 1: add_op(Op::load_8888);        break;
-        case skcms_PixelFormat_RGBA_1010102     >> 1: add_op(Op::load_1010102);     break;
-        case skcms_PixelFormat_RGB_101010x_XR   >> 1: add_op(Op::load_101010x_XR);  break;
-        case skcms_PixelFormat_RGBA_10101010_XR >> 1: add_op(Op::load_10101010_XR); break;
-        case skcms_PixelFormat_RGB_161616LE     >> 1: add_op(Op::load_161616LE);    break;
-        case skcms_PixelFormat_RGBA_16161616LE  >> 1: add_op(Op::load_16161616LE);  break;
-        case skcms_PixelFormat_RGB_161616BE     >> 1: add_op(Op::load_161616BE);    break;
-        case skcms_PixelFormat_RGBA_16161616BE  >> 1: add_op(Op::load_16161616BE);  break;
-        case skcms_PixelFormat_RGB_hhh_Norm     >> 1: add_op(Op::load_hhh);         break;
-        case skcms_PixelFormat_RGBA_hhhh_Norm   >> 1: add_op(Op::load_hhhh);        break;
-        case skcms_PixelFormat_RGB_hhh          >> 1: add_op(Op::load_hhh);         break;
-        case skcms_PixelFormat_RGBA_hhhh        >> 1: add_op(Op::load_hhhh);        break;
-        case skcms_PixelFormat_RGB_fff          >> 1: add_op(Op::load_fff);         break;
-        case skcms_PixelFormat_RGBA_ffff        >> 1: add_op(Op::load_ffff);        break;
+        return true;
+    }
+    const size_t bytes = (size_t)npixels * bytes_per_pixel(fmt);
+    for (size_t i = 0; i < bytes; i++) {
+        if (abs((int)(uint8_t)x[i] - (int)(uint8_t)y[i]) > 1) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        case skcms_PixelFormat_RGBA_8888_sRGB >> 1:
-            add_op(Op::load_8888);
-            add_op_ctx(Op::tf_rgb, skcms_sRGB_TransferFunction());
-            break;
+// Which of r, g, and b (bits 0, 1, and 2) each curve op the half-float pipeline runs applies to.
+static int f16_curve_channels(Op op) {
+    switch (op) {
+        case Op::gamma_r:   case Op::tf_r:   return 1;
+        case Op::gamma_g:   case Op::tf_g:   return 2;
+        case Op::gamma_b:   case Op::tf_b:   return 4;
+        case Op::gamma_rgb: case Op::tf_rgb: return 7;
+        default:                             return 0;
     }
-    if (srcFmt == skcms_PixelFormat_RGB_hhh_Norm ||
-        srcFmt == skcms_PixelFormat_RGBA_hhhh_Norm) {
-        add_op(Op::clamp);
+}
+
+// Applies one of those curve ops to x in floats.
+static float eval_f16_curve(Op op, const PreparedTF& tf, float x) {
+    switch (op) {
+        case Op::tf_r: case Op::tf_g: case Op::tf_b: case Op::tf_rgb: {
+            skcms_TransferFunction f;
+            memcpy(&f, &tf, sizeof(f));
+            return skcms_TransferFunction_eval(&f, x);
+        }
+        default:
+            return x < 0 ? -powf_(-x, tf.g) : powf_(x, tf.g);
     }
-    if (srcFmt & 1) {
-        add_op(Op::swap_rb);
+}
+
+// Rounding the ops that work per channel makes errors relative to each value, which the probe's
+// ramps measure exhaustively.  matrix_3x3 is different: rounding each row's products and sums
+// errs relative to its inputs, not its output, so where the output cancels toward 0 a steep
+// encoding curve after it (12.92x for sRGB, unbounded for pure gammas) magnifies that error far
+// past what any handful of probe pixels would find.  So bound that part analytically, allowing
+// about kHalfRoundings half-float roundings (the coefficient, the input, the product, and the
+// sums) per term, and pass only programs where it stays under half an LSB in every channel.
+static bool f16_mixing_is_bounded(const Op* program, const void** contexts, ptrdiff_t programSize,
+                                  skcms_PixelFormat dstFmt) {
+    const bool  is_1010102     = (dstFmt >> 1) == (skcms_PixelFormat_RGBA_1010102 >> 1);
+    const float kHalfRoundings = 4,
+                half_ulp       = kHalfRoundings / 2048,  // Each rounds by 2^-11 relative to 1.
+                lsb            = is_1010102 ? 1/1023.0f : 1/255.0f;
+    float hi [3] = {1,1,1},  // Bounds on each channel's magnitude.
+          err[3] = {0,0,0};  // Bounds on the error the matrices' mixing has added to each channel.
+
+    for (ptrdiff_t i = 0; i < programSize; i++) {
+        const Op op = program[i];
+        if (op == Op::swap_rb) {
+            float t = hi [0]; hi [0] = hi [2]; hi [2] = t;
+                  t = err[0]; err[0] = err[2]; err[2] = t;
+        } else if (op == Op::clamp) {
+            for (int c = 0; c < 3; c++) {
+                hi[c] = fminf_(hi[c], 1.0f);
+            }
+        } else if (op == Op::unpremul) {
+            // Dividing by small alphas would magnify any error without bound.
+            if (err[0] > 0 || err[1] > 0 || err[2] > 0) {
+                return false;
+            }
+        } else if (op == Op::matrix_3x3) {
+            const float* m = (const float*)contexts[i];
+            float row_hi[3], row_err[3];
+            for (int r = 0; r < 3; r++) {
+                float sum = 0, mixed_err = 0;
+                bool  mixes = false;
+                for (int c = 0; c < 3; c++) {
+                    const float m_rc = fabsf_(m[3*r+c]);
+                    sum       += m_rc * hi [c];
+                    mixed_err += m_rc * err[c];
+                    mixes      = mixes || (c != r && m_rc != 0);
+                }
+                row_hi [r] = sum;
+                row_err[r] = mixed_err + (mixes ? sum * half_ulp : 0);
+            }
+            memcpy(hi , row_hi , sizeof(hi));
+            memcpy(err, row_err, sizeof(err));
+        } else if (int channels = f16_curve_channels(op)) {
+            const PreparedTF& tf = *(const PreparedTF*)contexts[i];
+            for (int c = 0; c < 3; c++) {
+                if (!(channels & (1 << c))) {
+                    continue;
+                }
+                // The worst |f(x+err) - f(x)| over [-hi,hi], sampled every err or so.
+                if (err[c] > 0) {
+                    const int steps = (int)fminf_(2*hi[c] / err[c], 8192) + 1;
+                    float worst = 0;
+                    for (int k = 0; k <= steps; k++) {
+                        const float x = hi[c] * (2 * (float)k / (float)steps - 1);
+                        worst = fmaxf_(worst, fabsf_(eval_f16_curve(op, tf, x + err[c])
+                                                   - eval_f16_curve(op, tf, x)));
+                    }
+                    err[c] = worst;
+                }
+                hi[c] = fmaxf_(fabsf_(eval_f16_curve(op, tf, 0    )),
+                               fabsf_(eval_f16_curve(op, tf, hi[c])));
+            }
+        }
     }
-    skcms_ICCProfile gray_dst_profile;
-    if ((dstFmt >> 1) == (skcms_PixelFormat_G_8 >> 1)) {
-        // When transforming to gray, stop at XYZ (by setting toXYZ to identity), then transform
-        // luminance (Y) by the destination transfer function.
-        gray_dst_profile = *dstProfile;
-        skcms_SetXYZD50(&gray_dst_profile, &skcms_XYZD50_profile()->toXYZD50);
-        dstProfile = &gray_dst_profile;
+    for (int c = 0; c < 3; c++) {
+        if (!(err[c] <= 0.5f * lsb)) {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (srcProfile->data_color_space == skcms_Signature_CMYK) {
-        // Photoshop creates CMYK images as inverse CMYK.
-        // These happen to be the only ones we've _ever_ seen.
-        add_op(Op::invert);
-        // With CMYK, ignore the alpha type, to avoid changing K or conflating CMY with K.
-        srcAlpha = skcms_AlphaFormat_Unpremul;
+// The half-float pipeline is used only if it lands within 1 LSB of the float pipeline for every
+// pixel of the probe set, and the error matrix_3x3 mixes in is provably small.  Its other ops
+// are per-channel, so ramping each channel alone covers each curve at every input level, and
+// the gray, grid, and random pixels exercise how they combine.
+static bool f16_is_precise(RunProgramFn run, const Op* program, const void** contexts,
+                           ptrdiff_t programSize,
+                           skcms_PixelFormat srcFmt, skcms_PixelFormat dstFmt) {
+    const size_t src_bpp = bytes_per_pixel(srcFmt),
+                 dst_bpp = bytes_per_pixel(dstFmt);
+    if (src_bpp > 4 || dst_bpp > 4 ||
+            !f16_mixing_is_bounded(program, contexts, programSize, dstFmt)) {
+        return false;
     }
+    const int levels = (srcFmt >> 1) == (skcms_PixelFormat_RGBA_1010102 >> 1) ? 1024 : 256,
+              total  = 4*levels + kProbeMixed + (int)(sizeof(skcms_252_random_bytes) / src_bpp);
 
-    if (srcAlpha == skcms_AlphaFormat_Opaque) {
-        add_op(Op::force_opaque);
-    } else if (srcAlpha == skcms_AlphaFormat_PremulAsEncoded) {
-        add_op(Op::unpremul);
+    static const int kChunk = 64;
+    char src[4*kChunk], want[4*kChunk], got[4*kChunk];
+    for (int p = 0; p < total; p += kChunk) {
+        const int n = total - p < kChunk ? total - p : kChunk;
+        for (int i = 0; i < n; i++) {
+            write_probe_pixel(p+i, srcFmt, levels, src_bpp, src + (size_t)i*src_bpp);
+        }
+        run(program, contexts, programSize, src, want, n, src_bpp, dst_bpp);
+        if (!f16::run_program(program, contexts, programSize, src, got, n, src_bpp, dst_bpp) ||
+                !within_one_lsb(dstFmt, want, got, n)) {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (dstProfile != srcProfile) {
+// f16_is_precise() depends only on the ops, the values in their contexts, and the formats, so
+// its verdicts are cached by those, like the JIT caches its code.  matrix_3x3 and the curves in
+// PreparedTFs are the only contexts the half-float pipeline reads; any other op with a context
+// is one it doesn't support, so the verdict there is false whatever the context holds.
+//
+// Only builds that may use the half-float pipeline need the cache.  Those are all GCC or Clang
+// builds, so its lock uses their __atomic builtins.
+#if SKCMS_MAY_USE_F16
+static const int kF16MaxKey    = 128,
+                 kF16CacheSize = 16;
+static struct {
+    uint32_t key[kF16MaxKey];
+    int      key_len;
+    bool     precise;
+} gF16Verdicts[kF16CacheSize];
+static int      gF16Cached = 0;
+static uint32_t gF16Next   = 0;  // Once every slot is used, new verdicts replace them in turn.
+static bool     gF16Lock   = false;
+
+static void lock_f16_verdicts() {
+    while (__atomic_test_and_set(&gF16Lock, __ATOMIC_ACQUIRE)) {}
+}
+static void unlock_f16_verdicts() {
+    __atomic_clear(&gF16Lock, __ATOMIC_RELEASE);
+}
 
-        if (!prep_for_destination(dstProfile,
-                                  &from_xyz,
-                                  &dst_curves[0].parametric,
-                                  &dst_curves[1].parametric,
-                                  &dst_curves[2].parametric)) {
-            return false;
+// Returns the key's length, or 0 if it doesn't fit.
+static int f16_key(const Op* program, const void** contexts, ptrdiff_t programSize,
+                   skcms_PixelFormat srcFmt, skcms_PixelFormat dstFmt, uint32_t key[kF16MaxKey]) {
+    int len = 0;
+    key[len++] = (uint32_t)srcFmt;
+    key[len++] = (uint32_t)dstFmt;
+    for (ptrdiff_t i = 0; i < programSize; i++) {
+        const int floats = program[i] == Op::matrix_3x3           ? 9
+                         : curve_ctx(program[i]) == CurveCtx::TF ? 7  // PreparedTF g,a,b,c,d,e,f
+                         : 0;
+        if (len + 1 + floats > kF16MaxKey) {
+            return 0;
         }
+        key[len++] = (uint32_t)program[i];
+        if (floats) {
+            memcpy(key + len, contexts[i], 4 * (size_t)floats);
+            len += floats;
+        }
+    }
+    return len;
+}
 
-        if (srcProfile->has_A2B) {
-            if (srcProfile->A2B.input_channels) {
-                add_curve_ops(srcProfile->A2B.input_curves,
-                              (int)srcProfile->A2B.input_channels);
-                add_op(Op::clamp);
-                add_op_ctx(Op::clut_A2B, &srcProfile->A2B);
-            }
+// Returns the cached verdict's slot for key, or -1.  Call with gF16Lock held.
+static int find_f16_verdict(const uint32_t* key, int key_len) {
+    for (int i = 0; i < gF16Cached; i++) {
+        if (gF16Verdicts[i].key_len == key_len &&
+                0 == memcmp(gF16Verdicts[i].key, key, sizeof(*key) * (size_t)key_len)) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-            if (srcProfile->A2B.matrix_channels == 3) {
-                add_curve_ops(srcProfile->A2B.matrix_curves, /*numChannels=*/3);
+static bool f16_is_precise_cached(RunProgramFn run, const Op* program, const void** contexts,
+                                  ptrdiff_t programSize,
+                                  skcms_PixelFormat srcFmt, skcms_PixelFormat dstFmt) {
+    uint32_t key[kF16MaxKey];
+    const int key_len = f16_key(program, contexts, programSize, srcFmt, dstFmt, key);
+    if (key_len == 0) {
+        return f16_is_precise(run, program, contexts, programSize, srcFmt, dstFmt);
+    }
+
+    lock_f16_verdicts();
+    int slot = find_f16_verdict(key, key_len);
+    const bool found   = slot >= 0,
+               verdict = found && gF16Verdicts[slot].precise;
+    unlock_f16_verdicts();
+    if (found) {
+        return verdict;
+    }
+
+    // Check without holding the lock.  Another thread may race us to the same verdict.
+    const bool precise = f16_is_precise(run, program, contexts, programSize, srcFmt, dstFmt);
+
+    lock_f16_verdicts();
+    slot = find_f16_verdict(key, key_len);
+    if (slot < 0) {
+        slot = gF16Cached < kF16CacheSize ? gF16Cached++
+                                          : (int)(gF16Next++ % (uint32_t)kF16CacheSize);
+        memcpy(gF16Verdicts[slot].key, key, sizeof(*key) * (size_t)key_len);
+        gF16Verdicts[slot].key_len = key_len;
+        gF16Verdicts[slot].precise = precise;
+    }
+    unlock_f16_verdicts();
+    return precise;
+}
+#else
+static bool f16_is_precise_cached(RunProgramFn run, const Op* program, const void** contexts,
+                                  ptrdiff_t programSize,
+                                  skcms_PixelFormat srcFmt, skcms_PixelFormat dstFmt) {
+    return f16_is_precise(run, program, contexts, programSize, srcFmt, dstFmt);
+}
+#endif
 
-                static const skcms_Matrix3x4 I = {{
-                    {1,0,0,0},
-                    {0,1,0,0},
-                    {0,0,1,0},
-                }};
-                if (0 != memcmp(&I, &srcProfile->A2B.matrix, sizeof(I))) {
-                    add_op_ctx(Op::matrix_3x4, &srcProfile->A2B.matrix);
-                }
+// skcms_TransformPlanar() loads and stores planes with these ops.  Their program runs whole
+// blocks of kPlanarBlock pixels, a multiple of every backend's N, so run_program() never needs
+// its interleaved handling of leftover pixels.
+struct Planar {
+    LoadPlanesCtx  src;
+    StorePlanesCtx dst;
+    Op             load, store;
+    size_t         src_bytes, dst_bytes;  // Per sample.
+};
+static const int kPlanarBlock = 16;
+
+static void run_planar(RunProgramFn run, const Op* program, const void** contexts,
+                       ptrdiff_t programSize, Planar* planar, int n) {
+    const int blocks = n - n % kPlanarBlock;
+    run(program, contexts, programSize, nullptr, nullptr, blocks, 0,0);
+
+    // Run any leftover pixels through a block-sized set of our own planes.
+    if (n > blocks) {
+        char src[4][4*kPlanarBlock] = {{0}},
+             dst[4][4*kPlanarBlock] = {{0}};
+        const size_t leftover = (size_t)(n - blocks);
+        for (int c = 0; c < 4; c++) {
+            if (planar->src.plane[c]) {
+                memcpy(src[c], planar->src.plane[c] + (size_t)blocks*planar->src_bytes,
+                       leftover*planar->src_bytes);
+                planar->src.plane[c] = src[c];
             }
-
-            if (srcProfile->A2B.output_channels == 3) {
-                add_curve_ops(srcProfile->A2B.output_curves, /*numChannels=*/3);
+        }
+        char* dst_plane[4];
+        for (int c = 0; c < 4; c++) {
+            dst_plane[c] = planar->dst.plane[c];
+            if (dst_plane[c]) {
+                planar->dst.plane[c] = dst[c];
             }
-
-            if (srcProfile->pcs == skcms_Signature_Lab) {
-                add_op(Op::lab_to_xyz);
+        }
+        run(program, contexts, programSize, nullptr, nullptr, kPlanarBlock, 0,0);
+        for (int c = 0; c < 4; c++) {
+            if (dst_plane[c]) {
+                memcpy(dst_plane[c] + (size_t)blocks*planar->dst_bytes, dst[c],
+                       leftover*planar->dst_bytes);
             }
-
-        } else if (srcProfile->has_trc && srcProfile->has_toXYZD50) {
-            add_curve_ops(srcProfile->trc, /*numChannels=*/3);
-        } else {
-            return false;
         }
+    }
+}
 
-        // A2B sources are in XYZD50 by now, but TRC sources are still in their original gamut.
-        assert (srcProfile->has_A2B || srcProfile->has_toXYZD50);
+// skcms_TransformYUV() loads each row of its image with load_yuv, storing them to dst in
+// blocks of kPlanarBlock pixels as run_planar() does.
+struct YUV {
+    const skcms_YUVImage* image;
+    YUVRowCtx             row;
+    char*                 dst;
+    size_t                dst_stride;
+};
 
-        if (dstProfile->has_B2A) {
-            // B2A needs its input in XYZD50, so transform TRC sources now.
-            if (!srcProfile->has_A2B) {
-                add_op_ctx(Op::matrix_3x3, &srcProfile->toXYZD50);
-            }
+static void run_yuv(RunProgramFn run, const Op* program, const void** contexts,
+                    ptrdiff_t programSize, YUV* yuv, size_t dst_bpp) {
+    const skcms_YUVImage& img = *yuv->image;
+    YUVRowCtx& row = yuv->row;
+
+    const size_t bytes         = (size_t)row.bytes,
+                 chroma_bytes  = (size_t)row.chroma_step * bytes;
+    const bool   is_420        = img.subsampling == skcms_ChromaSubsampling_420;
+    const int    chroma_height = is_420 ? (img.height + 1) / 2 : img.height,
+                 blocks        = img.width - img.width % kPlanarBlock;
+
+    for (int y = 0; y < img.height; y++) {
+        // 4:2:0 chroma sits between pairs of rows, a quarter of the way to the nearer row.
+        int   c[2] = { is_420 ? y/2 : y, is_420 ? y/2 : y };
+        float t    = 0;
+        if (is_420 && row.bilinear) {
+            c[0] = (y & 1) ? y/2 : y/2 - 1;
+            c[1] = c[0] + 1;
+            t    = (y & 1) ? 0.25f : 0.75f;
+            c[0] = c[0] < 0                 ? 0                 : c[0];
+            c[1] = c[1] > chroma_height - 1 ? chroma_height - 1 : c[1];
+        }
 
-            if (dstProfile->pcs == skcms_Signature_Lab) {
-                add_op(Op::xyz_to_lab);
+        row.y = (const char*)img.y + (size_t)y * img.y_stride;
+        for (int k = 0; k < 2; k++) {
+            const char* cb = (const char*)img.cb + (size_t)c[k] * img.cb_stride;
+            row.cb[k] = cb;
+            row.cr[k] = img.cr ? (const char*)img.cr + (size_t)c[k] * img.cr_stride
+                               : cb + bytes;
+        }
+        row.t            = t;
+        row.width        = img.width;
+        row.chroma_width = (img.width + 1) / 2;
+
+        char* dst = yuv->dst + (size_t)y * yuv->dst_stride;
+        run(program, contexts, programSize, nullptr, dst, blocks, 0, dst_bpp);
+
+        // Run any leftover pixels as one more block into our own buffer, with the row
+        // starting where they do.  Lanes past the end of the row repeat its last pixel.
+        if (img.width > blocks) {
+            row.y += (size_t)blocks * bytes;
+            for (int k = 0; k < 2; k++) {
+                row.cb[k] += (size_t)(blocks/2) * chroma_bytes;
+                row.cr[k] += (size_t)(blocks/2) * chroma_bytes;
             }
+            row.width        -= blocks;
+            row.chroma_width -= blocks/2;
 
-            if (dstProfile->B2A.input_channels == 3) {
-                add_curve_ops(dstProfile->B2A.input_curves, /*numChannels=*/3);
-            }
+            char tmp[16*kPlanarBlock];
+            run(program, contexts, programSize, nullptr, tmp, kPlanarBlock, 0, dst_bpp);
+            memcpy(dst + (size_t)blocks * dst_bpp, tmp, (size_t)(img.width - blocks) * dst_bpp);
+        }
+    }
+}
+
+// skcms_TransformImage() runs its program a row at a time, in blocks of kPlanarBlock pixels as
+// run_planar() does, so the dither stage always knows where each run of pixels starts.
+struct Image {
+    const char* src;
+    char*       dst;
+    size_t      src_stride, dst_stride;
+    int         width, height;
+    DitherCtx   dither;
+};
+
+static void run_image(RunProgramFn run, const Op* program, const void** contexts,
+                      ptrdiff_t programSize, Image* img, size_t src_bpp, size_t dst_bpp) {
+    const int blocks = img->width - img->width % kPlanarBlock;
+
+    for (int y = 0; y < img->height; y++) {
+        const char* src = img->src + (size_t)y * img->src_stride;
+        char*       dst = img->dst + (size_t)y * img->dst_stride;
+
+        img->dither.x0 = 0;
+        img->dither.y  = y;
+        run(program, contexts, programSize, src, dst, blocks, src_bpp,dst_bpp);
+
+        // Run any leftover pixels as one more block through our own buffers.
+        if (img->width > blocks) {
+            const size_t leftover = (size_t)(img->width - blocks);
+            char tmp_src[16*kPlanarBlock] = {0},
+                 tmp_dst[16*kPlanarBlock];
+            memcpy(tmp_src, src + (size_t)blocks * src_bpp, leftover * src_bpp);
+
+            img->dither.x0 = blocks;
+            run(program, contexts, programSize, tmp_src, tmp_dst, kPlanarBlock, src_bpp,dst_bpp);
+            memcpy(dst + (size_t)blocks * dst_bpp, tmp_dst, leftover * dst_bpp);
+        }
+    }
+}
+
+static bool is_ycbcr(const skcms_ICCProfile* profile) {
+    return profile->has_CICP && profile->CICP.matrix_coefficients != 0;
+}
+
+// The bit depth of fmt's channels for YCbCr code values, 0 for float formats, or -1 if fmt
+// can't hold YCbCr.
+static int ycbcr_depth(skcms_PixelFormat fmt) {
+    switch (fmt >> 1) {
+        case skcms_PixelFormat_RGB_888         >> 1:
+        case skcms_PixelFormat_RGBA_8888       >> 1: return 8;
+        case skcms_PixelFormat_RGBA_1010102    >> 1: return 10;
+        case skcms_PixelFormat_RGB_161616LE    >> 1:
+        case skcms_PixelFormat_RGBA_16161616LE >> 1:
+        case skcms_PixelFormat_RGB_161616BE    >> 1:
+        case skcms_PixelFormat_RGBA_16161616BE >> 1: return 16;
+        case skcms_PixelFormat_RGB_hhh_Norm    >> 1:
+        case skcms_PixelFormat_RGBA_hhhh_Norm  >> 1:
+        case skcms_PixelFormat_RGB_hhh         >> 1:
+        case skcms_PixelFormat_RGBA_hhhh       >> 1:
+        case skcms_PixelFormat_RGB_fff         >> 1:
+        case skcms_PixelFormat_RGBA_ffff       >> 1: return 0;
+    }
+    return -1;
+}
+
+// Build the affine transform from YCbCr as loaded from a format of the given depth,
+// code values scaled to [0,1], to R'G'B'.
+static bool ycbcr_to_rgb(const skcms_CICP& cicp, int depth, skcms_Matrix3x4* m) {
+    float kr, kb;
+    switch (cicp.matrix_coefficients) {
+        case 1:         kr = 0.2126f; kb = 0.0722f; break;  // BT.709
+        case 5: case 6: kr = 0.299f;  kb = 0.114f;  break;  // BT.601
+        case 9:         kr = 0.2627f; kb = 0.0593f; break;  // BT.2020 non-constant luminance
+        default: return false;
+    }
+    if (depth < 0) {
+        return false;
+    }
+    const float kg = 1 - kr - kb;
+
+    // First undo the range and offsets: Y = ys*y + yo, Cb = cs*cb + co, Cr = cs*cr + co.
+    float ys = 1, yo = 0,
+          cs = 1, co = 0;
+    if (depth > 0) {
+        const float max  = (float)((1 << depth) - 1),
+                    unit = (float)(1 << (depth - 8));
+        if (cicp.video_full_range_flag) {
+            co = -(float)(1 << (depth - 1)) / max;
+        } else {
+            ys = max / (219*unit);  yo =  -16/219.0f;
+            cs = max / (224*unit);  co = -128/224.0f;
+        }
+    }
+
+    // Then R' = Y + cr_r*Cr, G' = Y + cb_g*Cb + cr_g*Cr, and B' = Y + cb_b*Cb.
+    const float cr_r = 2 - 2*kr,
+                cb_b = 2 - 2*kb,
+                cb_g = -2*kb*(1 - kb) / kg,
+                cr_g = -2*kr*(1 - kr) / kg;
+    *m = {{
+        { ys,      0,      cr_r*cs,  yo +        cr_r*co },
+        { ys, cb_g*cs,     cr_g*cs,  yo + cb_g*co + cr_g*co },
+        { ys, cb_b*cs,        0,     yo + cb_b*co },
+    }};
+    return true;
+}
+
+static bool rgb_to_ycbcr(const skcms_CICP& cicp, int depth, skcms_Matrix3x4* m) {
+    skcms_Matrix3x4 fwd;
+    if (!ycbcr_to_rgb(cicp, depth, &fwd)) {
+        return false;
+    }
+    skcms_Matrix3x3 A = {{
+        { fwd.vals[0][0], fwd.vals[0][1], fwd.vals[0][2] },
+        { fwd.vals[1][0], fwd.vals[1][1], fwd.vals[1][2] },
+        { fwd.vals[2][0], fwd.vals[2][1], fwd.vals[2][2] },
+    }}, inv;
+    if (!skcms_Matrix3x3_invert(&A, &inv)) {
+        return false;
+    }
+    for (int r = 0; r < 3; r++) {
+        m->vals[r][3] = 0;
+        for (int c = 0; c < 3; c++) {
+            m->vals[r][c]  = inv.vals[r][c];
+            m->vals[r][3] -= inv.vals[r][c] * fwd.vals[c][3];
+        }
+    }
+    return true;
+}
+
+// Ops appended by skcms_TransformBuilder, to run just before the destination's clamp and store.
+// skcms' own ops for a transform never number more than the rest of kMaxOps.
+static const int kMaxAppendedOps = kMaxOps / 2;
+struct Appended {
+    Op          ops     [kMaxAppendedOps];
+    const void* contexts[kMaxAppendedOps];
+    int         count;
+};
+
+// skcms_TransformChain() converts through at most this many profiles, counting src and dst.
+static const int kMaxChainProfiles = 8;
+
+// Parametric curve ops take one of these, prepared by build_program().  A conversion has at most
+// 4+3+3 curves from an A2B source and 3+3+4 to a B2A destination, and the sRGB formats add one
+// each to load and store.  Chains convert once per hop, so they bring a pool of their own, as
+// big as any program could use: every program spends at least a load and a store on other ops.
+union PreparedCurve {
+    PreparedTF  tf;
+    PreparedHLG hlg;
+};
+static const int kMaxCurveOps      = 1 + 10 + 10 + 1,
+                 kMaxChainCurveOps = kMaxOps - 2;
+
+// A built program, along with the storage behind any contexts build_program() prepared for it.
+// Contexts may also point into the source and destination profiles, which must outlive it.
+struct Program {
+    Op           ops     [kMaxOps];
+    const void*  contexts[kMaxOps];
+    ptrdiff_t    size;
+    RunProgramFn run;
+
+    PreparedCurve    curves[kMaxCurveOps];
+    skcms_Curve      dst_curves[3];
+    skcms_Matrix3x3  from_xyz[kMaxChainProfiles - 1];  // One for each conversion.
+    skcms_Matrix3x4  from_ycbcr, to_ycbcr;
+    ToneMapCtx       tone_map;
+    GamutMapCtx      gamut_map;
+};
+
+// Resolved copies of profiles skcms_ParseLazy() deferred, or for gray destinations, a copy that
+// stops at XYZ.  Programs point into these too, so they must outlive the program.  They're big,
+// so build_program() only takes them when needs_profile_copies() says it must.
+struct ProfileCopies {
+    skcms_ICCProfile src, dst;
+};
+
+static bool needs_profile_copies(const skcms_ICCProfile* srcProfile,
+                                 const skcms_ICCProfile* dstProfile,
+                                 skcms_PixelFormat       dstFmt) {
+    return (srcProfile && has_deferred_tags(srcProfile))
+        || (dstProfile && has_deferred_tags(dstProfile))
+        || (dstFmt >> 1) == (skcms_PixelFormat_G_8 >> 1);
+}
+
+static RunProgramFn select_run_program() {
+    auto run = baseline::run_program;
+    switch (cpu_type()) {
+        case CpuType::SKX:
+            #if !defined(SKCMS_DISABLE_SKX)
+                run = skx::run_program;
+                break;
+            #endif
+
+        case CpuType::HSW:
+            #if !defined(SKCMS_DISABLE_HSW)
+                run = hsw::run_program;
+                break;
+            #endif
+
+        case CpuType::Baseline:
+            break;
+    }
+    return run;
+}
+
+// Builds a program converting from srcProfile to dstProfile, by way of any nvia profiles in via.
+// Chains prepare their curves in chain_curves, kMaxChainCurveOps of them, rather than in p.
+static bool build_program(skcms_PixelFormat              srcFmt,
+                          skcms_AlphaFormat              srcAlpha,
+                          const skcms_ICCProfile*        srcProfile,
+                          const skcms_ICCProfile* const* via,
+                          int                            nvia,
+                          skcms_PixelFormat              dstFmt,
+                          skcms_AlphaFormat              dstAlpha,
+                          const skcms_ICCProfile*        dstProfile,
+                          skcms_Precision                precision,
+                          const skcms_ToneMap*           tone_map,
+                          skcms_GamutMapping             gamut_mapping,
+                          const Appended*                appended,
+                          Planar*                        planar,
+                          YUV*                           yuv,
+                          Image*                         image,
+                          ProfileCopies*                 copies,
+                          PreparedCurve*                 chain_curves,
+                          Program*                       p) {
+    // A device link converts all the way on its own, so it's both the src and dst profile.
+    const bool link = srcProfile && is_device_link(srcProfile);
+    if (link) {
+        if ((dstProfile && dstProfile != srcProfile) || nvia > 0 ||
+                gamut_mapping != skcms_GamutMapping_Clip) {
+            return false;
+        }
+        dstProfile = srcProfile;
+    }
+
+    // Null profiles default to sRGB. Passing null for both is handy when doing format conversion.
+    if (!srcProfile) {
+        srcProfile = skcms_sRGB_profile();
+    }
+    if (!dstProfile) {
+        dstProfile = skcms_sRGB_profile();
+    }
+
+    // Decode anything skcms_ParseLazy() left for later.
+    if (has_deferred_tags(srcProfile)) {
+        if (!copies) {
+            return false;
+        }
+        copies->src = *srcProfile;
+        if (!skcms_ResolveProfile(&copies->src)) {
+            return false;
+        }
+        srcProfile = &copies->src;
+    }
+    // skcms_TransformYUV() lets through profiles whose CICP hadn't been read yet.
+    if (yuv && !is_ycbcr(srcProfile)) {
+        return false;
+    }
+    if (link) {
+        dstProfile = srcProfile;
+    } else if (has_deferred_tags(dstProfile)) {
+        if (!copies) {
+            return false;
+        }
+        copies->dst = *dstProfile;
+        if (!skcms_ResolveProfile(&copies->dst)) {
+            return false;
+        }
+        dstProfile = &copies->dst;
+    }
+
+    // Intermediate profiles are used as-is, so they must already be resolved.
+    for (int k = 0; k < nvia; k++) {
+        if (has_deferred_tags(via[k])) {
+            return false;
+        }
+    }
+
+    Op*          ops      = p->ops;
+    const void** contexts = p->contexts;
+
+    // A long enough chain of profiles can run out of room for ops; we check once we're done.
+    bool overflow = false;
+
+    auto add_op_ctx = [&](Op o, const void* c) {
+        // lab_to_xyz and xyz_to_lab undo each other, as they would between two Lab PCS profiles.
+        if (ops > p->ops && ((o == Op::xyz_to_lab && ops[-1] == Op::lab_to_xyz) ||
+                             (o == Op::lab_to_xyz && ops[-1] == Op::xyz_to_lab))) {
+            ops--;
+            contexts--;
+            return;
+        }
+        if (ops == p->ops + ARRAY_COUNT(p->ops)) {
+            overflow = true;
+            return;
+        }
+        *ops++ = o;
+        *contexts++ = c;
+    };
+
+    auto add_op = [&](Op o) {
+        add_op_ctx(o, nullptr);
+    };
+
+    // Parametric curve ops take a context prepared here, which must outlive the program,
+    // and come in a variant for each precision.
+    PreparedCurve* const curves     = chain_curves ? chain_curves : p->curves;
+    PreparedCurve* const curves_end = chain_curves ? chain_curves + kMaxChainCurveOps
+                                                   : p->curves + kMaxCurveOps;
+    PreparedCurve*       next_curve = curves;
+
+    auto add_curve_op = [&](OpAndArg oa) {
+        const skcms_TransferFunction* tf = (const skcms_TransferFunction*)oa.arg;
+        const CurveCtx ctx = curve_ctx(oa.op);
+        if (ctx != CurveCtx::None) {
+            if (next_curve == curves_end) {
+                overflow = true;
+                return;
+            }
+            if (ctx == CurveCtx::TF) {
+                prepare_tf(*tf, &next_curve->tf);
+                oa.arg = &next_curve->tf;
+            } else {
+                prepare_hlg(*tf, &next_curve->hlg);
+                oa.arg = &next_curve->hlg;
+            }
+            oa.op = with_precision(oa.op, precision);
+            next_curve++;
+        }
+        add_op_ctx(oa.op, oa.arg);
+    };
+
+    auto add_curve_ops = [&](const skcms_Curve* curves, int numChannels) {
+        OpAndArg oa[4];
+        assert(numChannels <= ARRAY_COUNT(oa));
+
+        int numOps = select_curve_ops(curves, numChannels, oa);
+
+        for (int i = 0; i < numOps; ++i) {
+            add_curve_op(oa[i]);
+        }
+    };
+
+    // These are always parametric curves of some sort.
+    skcms_Curve* dst_curves = p->dst_curves;
+    dst_curves[0].table_entries =
+    dst_curves[1].table_entries =
+    dst_curves[2].table_entries = 0;
+
+    ToneMapCtx&      tone_map_ctx  = p->tone_map;
+    GamutMapCtx&     gamut_map_ctx = p->gamut_map;
+
+    if (planar) {
+        add_op_ctx(planar->load, &planar->src);
+    } else if (yuv) {
+        add_op_ctx(Op::load_yuv, &yuv->row);
+    } else {
+        switch (srcFmt >> 1) {
+            default: return false;
+            case skcms_PixelFormat_A_8              >> 1: add_op(Op::load_a8);          break;
+            case skcms_PixelFormat_G_8              >> 1: add_op(Op::load_g8);          break;
+            case skcms_PixelFormat_ABGR_4444        >> 1: add_op(Op::load_4444);        break;
+            case skcms_PixelFormat_RGB_565          >> 1: add_op(Op::load_565);         break;
+            case skcms_PixelFormat_RGB_888          >> 1: add_op(Op::load_888);         break;
+            case skcms_PixelFormat_RGBA_8888        >> 1: add_op(Op::load_8888);        break;
+            case skcms_PixelFormat_RGBA_1010102     >> 1: add_op(Op::load_1010102);     break;
+            case skcms_PixelFormat_RGB_101010x_XR   >> 1: add_op(Op::load_101010x_XR);  break;
+            case skcms_PixelFormat_RGBA_10101010_XR >> 1: add_op(Op::load_10101010_XR); break;
+            case skcms_PixelFormat_RGB_161616LE     >> 1: add_op(Op::load_161616LE);    break;
+            case skcms_PixelFormat_RGBA_16161616LE  >> 1: add_op(Op::load_16161616LE);  break;
+            case skcms_PixelFormat_RGB_161616BE     >> 1: add_op(Op::load_161616BE);    break;
+            case skcms_PixelFormat_RGBA_16161616BE  >> 1: add_op(Op::load_16161616BE);  break;
+            case skcms_PixelFormat_RGB_hhh_Norm     >> 1: add_op(Op::load_hhh);         break;
+            case skcms_PixelFormat_RGBA_hhhh_Norm   >> 1: add_op(Op::load_hhhh);        break;
+            case skcms_PixelFormat_RGB_hhh          >> 1: add_op(Op::load_hhh);         break;
+            case skcms_PixelFormat_RGBA_hhhh        >> 1: add_op(Op::load_hhhh);        break;
+            case skcms_PixelFormat_RGB_fff          >> 1: add_op(Op::load_fff);         break;
+            case skcms_PixelFormat_RGBA_ffff        >> 1: add_op(Op::load_ffff);        break;
+
+            case skcms_PixelFormat_RGBA_8888_sRGB >> 1:
+                add_op(Op::load_8888);
+                add_curve_op(OpAndArg{Op::tf_rgb, skcms_sRGB_TransferFunction()});
+                break;
+        }
+    }
+    if (srcFmt == skcms_PixelFormat_RGB_hhh_Norm ||
+        srcFmt == skcms_PixelFormat_RGBA_hhhh_Norm) {
+        add_op(Op::clamp);
+    }
+    if (srcFmt & 1) {
+        add_op(Op::swap_rb);
+    }
+    if ((dstFmt >> 1) == (skcms_PixelFormat_G_8 >> 1) && !link) {
+        // When transforming to gray, stop at XYZ (by setting toXYZ to identity), then transform
+        // luminance (Y) by the destination transfer function.
+        if (!copies) {
+            return false;
+        }
+        if (dstProfile != &copies->dst) {
+            copies->dst = *dstProfile;
+        }
+        skcms_SetXYZD50(&copies->dst, &skcms_XYZD50_profile()->toXYZD50);
+        dstProfile = &copies->dst;
+    }
+
+    if (srcProfile->data_color_space == skcms_Signature_CMYK) {
+        // Photoshop creates CMYK images as inverse CMYK.
+        // These happen to be the only ones we've _ever_ seen.
+        add_op(Op::invert);
+        // With CMYK, ignore the alpha type, to avoid changing K or conflating CMY with K.
+        srcAlpha = skcms_AlphaFormat_Unpremul;
+    }
+
+    if (srcAlpha == skcms_AlphaFormat_Opaque) {
+        add_op(Op::force_opaque);
+    } else if (srcAlpha == skcms_AlphaFormat_PremulAsEncoded) {
+        add_op(Op::unpremul);
+    }
+
+    // YCbCr sources become R'G'B' right away, and YCbCr destinations are encoded from R'G'B'
+    // at the end, each with one matrix_3x4.  Premultiplied YCbCr doesn't make much sense.
+    skcms_Matrix3x4& from_ycbcr = p->from_ycbcr;
+    skcms_Matrix3x4& to_ycbcr   = p->to_ycbcr;
+    if (is_ycbcr(srcProfile)) {
+        if (srcAlpha == skcms_AlphaFormat_PremulAsEncoded ||
+                !ycbcr_to_rgb(srcProfile->CICP, ycbcr_depth(srcFmt), &from_ycbcr)) {
+            return false;
+        }
+        add_op_ctx(Op::matrix_3x4, &from_ycbcr);
+    }
+
+    // Tone mapping needs a conversion to some other profile to sit in.
+    if (tone_map && (dstProfile == srcProfile || srcProfile->has_A2B)) {
+        return false;
+    }
+
+    static const skcms_Matrix3x4 I = {{
+        {1,0,0,0},
+        {0,1,0,0},
+        {0,0,1,0},
+    }};
+
+    auto add_a2b_ops = [&](const skcms_A2B& a2b) {
+        if (a2b.input_channels) {
+            add_curve_ops(a2b.input_curves, (int)a2b.input_channels);
+            add_op(Op::clamp);
+            add_op_ctx(Op::clut_A2B, &a2b);
+        }
+
+        if (a2b.matrix_channels == 3) {
+            add_curve_ops(a2b.matrix_curves, /*numChannels=*/3);
+
+            if (0 != memcmp(&I, &a2b.matrix, sizeof(I))) {
+                add_op_ctx(Op::matrix_3x4, &a2b.matrix);
+            }
+        }
+
+        if (a2b.output_channels == 3) {
+            add_curve_ops(a2b.output_curves, /*numChannels=*/3);
+        }
+    };
+
+    auto add_b2a_ops = [&](const skcms_B2A& b2a) {
+        if (b2a.input_channels == 3) {
+            add_curve_ops(b2a.input_curves, /*numChannels=*/3);
+        }
+
+        if (b2a.matrix_channels == 3) {
+            if (0 != memcmp(&I, &b2a.matrix, sizeof(I))) {
+                add_op_ctx(Op::matrix_3x4, &b2a.matrix);
+            }
+
+            add_curve_ops(b2a.matrix_curves, /*numChannels=*/3);
+        }
+
+        if (b2a.output_channels) {
+            add_op(Op::clamp);
+            add_op_ctx(Op::clut_B2A, &b2a);
+
+            add_curve_ops(b2a.output_curves, (int)b2a.output_channels);
+        }
+    };
+
+    // Converts from one profile to the next, leaving r,g,b encoded as the next would store them.
+    auto add_conversion = [&](const skcms_ICCProfile* from,
+                              const skcms_ICCProfile* to,
+                              skcms_Matrix3x3&        from_xyz) -> bool {
+        if (!prep_for_destination(to,
+                                  &from_xyz,
+                                  &dst_curves[0].parametric,
+                                  &dst_curves[1].parametric,
+                                  &dst_curves[2].parametric)) {
+            return false;
+        }
+
+        if (from->has_A2B) {
+            add_a2b_ops(from->A2B);
+
+            if (from->pcs == skcms_Signature_Lab) {
+                add_op(Op::lab_to_xyz);
+            }
+
+        } else if (from->has_trc && from->has_toXYZD50) {
+            add_curve_ops(from->trc, /*numChannels=*/3);
+
+            // Tone map while we're linear and still in the source gamut.
+            if (tone_map) {
+                Op op;
+                if (!prepare_tone_map(*tone_map, from, &op, &tone_map_ctx)) {
+                    return false;
+                }
+                add_op_ctx(op, &tone_map_ctx);
+            }
+        } else {
+            return false;
+        }
+
+        // A2B sources are in XYZD50 by now, but TRC sources are still in their original gamut.
+        assert (from->has_A2B || from->has_toXYZD50);
+
+        if (to->has_B2A) {
+            if (gamut_mapping != skcms_GamutMapping_Clip) {
+                return false;
+            }
+
+            // B2A needs its input in XYZD50, so transform TRC sources now.
+            if (!from->has_A2B) {
+                add_op_ctx(Op::matrix_3x3, &from->toXYZD50);
+            }
+
+            if (to->pcs == skcms_Signature_Lab) {
+                add_op(Op::xyz_to_lab);
+            }
+
+            add_b2a_ops(to->B2A);
+        } else {
+            // This is a TRC destination.
+            // We'll concat any src->xyz matrix with our xyz->dst matrix into one src->dst matrix.
+            // (A2B sources are already in XYZD50, making that src->xyz matrix I.)
+            static const skcms_Matrix3x3 I = {{
+                { 1.0f, 0.0f, 0.0f },
+                { 0.0f, 1.0f, 0.0f },
+                { 0.0f, 0.0f, 1.0f },
+            }};
+            const skcms_Matrix3x3* to_xyz = from->has_A2B ? &I : &from->toXYZD50;
+
+            // There's a chance the source and destination gamuts are identical,
+            // in which case we can skip the gamut transform.
+            if (0 != memcmp(&to->toXYZD50, to_xyz, sizeof(skcms_Matrix3x3))) {
+                // Concat the entire gamut transform into from_xyz,
+                // now slightly misnamed but it's a handy spot to stash the result.
+                from_xyz = skcms_Matrix3x3_concat(&from_xyz, to_xyz);
+                add_op_ctx(Op::matrix_3x3, &from_xyz);
+            }
+
+            // Map into the destination gamut while we're still linear.
+            if (gamut_mapping != skcms_GamutMapping_Clip) {
+                if (!prepare_gamut_map(gamut_mapping, to, &gamut_map_ctx)) {
+                    return false;
+                }
+                add_op_ctx(Op::gamut_map, &gamut_map_ctx);
+            }
+
+            // Encode back to dst RGB using its parametric transfer functions.
+            OpAndArg oa[3];
+            int numOps = select_curve_ops(dst_curves, /*numChannels=*/3, oa);
+            for (int index = 0; index < numOps; ++index) {
+                assert(oa[index].op != Op::table_r &&
+                       oa[index].op != Op::table_g &&
+                       oa[index].op != Op::table_b &&
+                       oa[index].op != Op::table_a);
+                add_curve_op(oa[index]);
+            }
+        }
+        return true;
+    };
+
+    // A device link is a whole conversion on its own, src and dst both.
+    if (link) {
+        if (srcProfile->has_A2B) {
+            add_a2b_ops(srcProfile->A2B);
+        } else {
+            add_b2a_ops(srcProfile->B2A);
+        }
+    }
+
+    // Convert through each profile in turn, usually straight from srcProfile to dstProfile.
+    const skcms_ICCProfile* from = srcProfile;
+    for (int k = 0; k <= nvia; k++) {
+        const skcms_ICCProfile* to = k < nvia ? via[k] : dstProfile;
+        if (to != from && !add_conversion(from, to, p->from_xyz[k])) {
+            return false;
+        }
+        from = to;
+    }
+
+    if (appended) {
+        for (int i = 0; i < appended->count; i++) {
+            add_op_ctx(appended->ops[i], appended->contexts[i]);
+        }
+    }
+
+    if (is_ycbcr(dstProfile)) {
+        if (dstAlpha == skcms_AlphaFormat_PremulAsEncoded ||
+                !rgb_to_ycbcr(dstProfile->CICP, ycbcr_depth(dstFmt), &to_ycbcr)) {
+            return false;
+        }
+        add_op_ctx(Op::matrix_3x4, &to_ycbcr);
+    }
+
+    // Clamp here before premul to make sure we're clamping to normalized values _and_ gamut,
+    // not just to values that fit in [0,1].
+    //
+    // E.g. r = 1.1, a = 0.5 would fit fine in fixed point after premul (ra=0.55,a=0.5),
+    // but would be carrying r > 1, which is really unexpected for downstream consumers.
+    if (dstFmt < skcms_PixelFormat_RGB_hhh) {
+        add_op(Op::clamp);
+    }
+
+    if (output_color_space(dstProfile) == skcms_Signature_CMYK) {
+        // Photoshop creates CMYK images as inverse CMYK.
+        // These happen to be the only ones we've _ever_ seen.
+        add_op(Op::invert);
+
+        // CMYK has no alpha channel, so make sure dstAlpha is a no-op.
+        dstAlpha = skcms_AlphaFormat_Unpremul;
+    }
+
+    if (dstAlpha == skcms_AlphaFormat_Opaque) {
+        add_op(Op::force_opaque);
+    } else if (dstAlpha == skcms_AlphaFormat_PremulAsEncoded) {
+        add_op(Op::premul);
+    }
+    if (dstFmt & 1) {
+        add_op(Op::swap_rb);
+    }
+
+    // Dither right before the store quantizes, after any encoding it does itself.  Dithered
+    // premultiplied color mustn't pass alpha, unless encoding has already taken it past.
+    auto add_dither = [&](bool premul) {
+        if (image && image->dither.ranks) {
+            image->dither.premul = premul;
+            add_op_ctx(Op::dither, &image->dither);
+        }
+    };
+    if ((dstFmt >> 1) != (skcms_PixelFormat_RGBA_8888_sRGB >> 1)) {
+        add_dither(dstAlpha == skcms_AlphaFormat_PremulAsEncoded);
+    }
+
+    if (planar) {
+        add_op_ctx(planar->store, &planar->dst);
+    } else {
+        switch (dstFmt >> 1) {
+            default: return false;
+            case skcms_PixelFormat_A_8             >> 1: add_op(Op::store_a8);         break;
+            case skcms_PixelFormat_G_8             >> 1: add_op(Op::store_g8);         break;
+            case skcms_PixelFormat_ABGR_4444       >> 1: add_op(Op::store_4444);       break;
+            case skcms_PixelFormat_RGB_565         >> 1: add_op(Op::store_565);        break;
+            case skcms_PixelFormat_RGB_888         >> 1: add_op(Op::store_888);        break;
+            case skcms_PixelFormat_RGBA_8888       >> 1: add_op(Op::store_8888);       break;
+            case skcms_PixelFormat_RGBA_1010102    >> 1: add_op(Op::store_1010102);    break;
+            case skcms_PixelFormat_RGB_161616LE    >> 1: add_op(Op::store_161616LE);   break;
+            case skcms_PixelFormat_RGBA_16161616LE >> 1: add_op(Op::store_16161616LE); break;
+            case skcms_PixelFormat_RGB_161616BE    >> 1: add_op(Op::store_161616BE);   break;
+            case skcms_PixelFormat_RGBA_16161616BE >> 1: add_op(Op::store_16161616BE); break;
+            case skcms_PixelFormat_RGB_hhh_Norm    >> 1: add_op(Op::store_hhh);        break;
+            case skcms_PixelFormat_RGBA_hhhh_Norm  >> 1: add_op(Op::store_hhhh);       break;
+            case skcms_PixelFormat_RGB_101010x_XR  >> 1: add_op(Op::store_101010x_XR); break;
+            case skcms_PixelFormat_RGB_hhh         >> 1: add_op(Op::store_hhh);        break;
+            case skcms_PixelFormat_RGBA_hhhh       >> 1: add_op(Op::store_hhhh);       break;
+            case skcms_PixelFormat_RGB_fff         >> 1: add_op(Op::store_fff);        break;
+            case skcms_PixelFormat_RGBA_ffff       >> 1: add_op(Op::store_ffff);       break;
+
+            case skcms_PixelFormat_RGBA_8888_sRGB >> 1:
+                add_curve_op(OpAndArg{Op::tf_rgb, skcms_sRGB_Inverse_TransferFunction()});
+                add_dither(false);
+                add_op(Op::store_8888);
+                break;
+        }
+    }
+
+    if (overflow) {
+        return false;
+    }
+    p->size = ops - p->ops;
+    p->run  = select_run_program();
+    return true;
+}
+
+// Runs n interleaved pixels through a built program, using the fastest backend that can.
+static void run_pixels(Program* p, skcms_Precision precision,
+                       skcms_PixelFormat srcFmt, skcms_PixelFormat dstFmt,
+                       const char* src, char* dst, int n) {
+    const size_t dst_bpp = bytes_per_pixel(dstFmt),
+                 src_bpp = bytes_per_pixel(srcFmt);
+
+    // skcms_Precision_Fast may run the program in half floats, when it's supported and precise.
+    if (precision == skcms_Precision_Fast && n >= kF16MinPixels && f16_available() &&
+            f16_is_precise_cached(p->run, p->ops, p->contexts, p->size, srcFmt, dstFmt) &&
+            f16::run_program(p->ops, p->contexts, p->size, src, dst, n, src_bpp,dst_bpp)) {
+        return;
+    }
+
+    // Long enough runs of pixels are worth compiling the program for, where we can.
+    if (n >= kJITMinPixels && jit_enabled() &&
+            jit::run_program(p->ops, p->contexts, p->size, src, dst, n, src_bpp,dst_bpp,
+                             jit_avx512())) {
+        return;
+    }
+
+    p->run(p->ops, p->contexts, p->size, src, dst, n, src_bpp,dst_bpp);
+}
+
+static bool transform_with_copies(const void*, skcms_PixelFormat, skcms_AlphaFormat,
+                                  const skcms_ICCProfile*,
+                                  void*, skcms_PixelFormat, skcms_AlphaFormat,
+                                  const skcms_ICCProfile*,
+                                  size_t, skcms_Precision, const skcms_ToneMap*,
+                                  skcms_GamutMapping, Planar*, YUV*, Image*);
+
+// skcms_TransformWithPrecision(), skcms_TransformPlanar(), skcms_TransformYUV() and
+// skcms_TransformImage() share everything but loading and storing.  With planar or yuv set,
+// srcFmt (and for planar, dstFmt) are the interleaved RGBA formats with the same samples,
+// standing in for them when deciding about clamping.  With image set, nz is its width.
+//
+// The profiles outlive the call, so the program points into them directly, leaving any
+// ProfileCopies it needs to transform_with_copies() and off this common path's stack.
+static bool transform(const void*             src,
+                      skcms_PixelFormat       srcFmt,
+                      skcms_AlphaFormat       srcAlpha,
+                      const skcms_ICCProfile* srcProfile,
+                      void*                   dst,
+                      skcms_PixelFormat       dstFmt,
+                      skcms_AlphaFormat       dstAlpha,
+                      const skcms_ICCProfile* dstProfile,
+                      size_t                  nz,
+                      skcms_Precision         precision,
+                      const skcms_ToneMap*    tone_map,
+                      skcms_GamutMapping      gamut_mapping,
+                      Planar*                 planar,
+                      YUV*                    yuv,
+                      Image*                  image,
+                      ProfileCopies*          copies = nullptr) {
+    if (!copies && needs_profile_copies(srcProfile, dstProfile, dstFmt)) {
+        return transform_with_copies(src, srcFmt, srcAlpha, srcProfile,
+                                     dst, dstFmt, dstAlpha, dstProfile,
+                                     nz, precision, tone_map, gamut_mapping,
+                                     planar, yuv, image);
+    }
+
+    const size_t dst_bpp = bytes_per_pixel(dstFmt),
+                 src_bpp = bytes_per_pixel(srcFmt);
+    // Let's just refuse if the request is absurdly big.
+    if (nz * dst_bpp > INT_MAX || nz * src_bpp > INT_MAX) {
+        return false;
+    }
+    int n = (int)nz;
+
+    // We can't transform in place unless the PixelFormats are the same size.
+    // (skcms_TransformPlanar() checks its planes itself.)
+    if (!planar && dst == src && dst_bpp != src_bpp) {
+        return false;
+    }
+    // TODO: more careful alias rejection (like, dst == src + 1)?
+
+    Program p;
+    if (!build_program(srcFmt, srcAlpha, srcProfile, nullptr, 0, dstFmt, dstAlpha, dstProfile,
+                       precision, tone_map, gamut_mapping, nullptr, planar, yuv, image,
+                       copies, nullptr, &p)) {
+        return false;
+    }
+
+    if (planar) {
+        run_planar(p.run, p.ops, p.contexts, p.size, planar, n);
+        return true;
+    }
+    if (yuv) {
+        run_yuv(p.run, p.ops, p.contexts, p.size, yuv, dst_bpp);
+        return true;
+    }
+    if (image) {
+        run_image(p.run, p.ops, p.contexts, p.size, image, src_bpp, dst_bpp);
+        return true;
+    }
+
+    run_pixels(&p, precision, srcFmt, dstFmt, (const char*)src, (char*)dst, n);
+    return true;
+}
+
+SKCMS_NOINLINE
+static bool transform_with_copies(const void*             src,
+                                  skcms_PixelFormat       srcFmt,
+                                  skcms_AlphaFormat       srcAlpha,
+                                  const skcms_ICCProfile* srcProfile,
+                                  void*                   dst,
+                                  skcms_PixelFormat       dstFmt,
+                                  skcms_AlphaFormat       dstAlpha,
+                                  const skcms_ICCProfile* dstProfile,
+                                  size_t                  nz,
+                                  skcms_Precision         precision,
+                                  const skcms_ToneMap*    tone_map,
+                                  skcms_GamutMapping      gamut_mapping,
+                                  Planar*                 planar,
+                                  YUV*                    yuv,
+                                  Image*                  image) {
+    ProfileCopies copies;
+    return transform(src, srcFmt, srcAlpha, srcProfile,
+                     dst, dstFmt, dstAlpha, dstProfile,
+                     nz, precision, tone_map, gamut_mapping,
+                     planar, yuv, image, &copies);
+}
+
+bool skcms_TransformWithPrecision(const void*             src,
+                                  skcms_PixelFormat       srcFmt,
+                                  skcms_AlphaFormat       srcAlpha,
+                                  const skcms_ICCProfile* srcProfile,
+                                  void*                   dst,
+                                  skcms_PixelFormat       dstFmt,
+                                  skcms_AlphaFormat       dstAlpha,
+                                  const skcms_ICCProfile* dstProfile,
+                                  size_t                  npixels,
+                                  skcms_Precision         precision) {
+    return transform(src, srcFmt, srcAlpha, srcProfile,
+                     dst, dstFmt, dstAlpha, dstProfile,
+                     npixels, precision, nullptr, skcms_GamutMapping_Clip,
+                     nullptr, nullptr, nullptr);
+}
+
+bool skcms_TransformWithToneMap(const void*             src,
+                                skcms_PixelFormat       srcFmt,
+                                skcms_AlphaFormat       srcAlpha,
+                                const skcms_ICCProfile* srcProfile,
+                                void*                   dst,
+                                skcms_PixelFormat       dstFmt,
+                                skcms_AlphaFormat       dstAlpha,
+                                const skcms_ICCProfile* dstProfile,
+                                size_t                  npixels,
+                                const skcms_ToneMap*    toneMap) {
+    if (!toneMap) {
+        return false;
+    }
+    return transform(src, srcFmt, srcAlpha, srcProfile,
+                     dst, dstFmt, dstAlpha, dstProfile,
+                     npixels, skcms_Precision_Default, toneMap, skcms_GamutMapping_Clip,
+                     nullptr, nullptr, nullptr);
+}
+
+bool skcms_TransformWithGamutMapping(const void*             src,
+                                     skcms_PixelFormat       srcFmt,
+                                     skcms_AlphaFormat       srcAlpha,
+                                     const skcms_ICCProfile* srcProfile,
+                                     void*                   dst,
+                                     skcms_PixelFormat       dstFmt,
+                                     skcms_AlphaFormat       dstAlpha,
+                                     const skcms_ICCProfile* dstProfile,
+                                     size_t                  npixels,
+                                     skcms_GamutMapping      mapping,
+                                     const skcms_ToneMap*    toneMap) {
+    return transform(src, srcFmt, srcAlpha, srcProfile,
+                     dst, dstFmt, dstAlpha, dstProfile,
+                     npixels, skcms_Precision_Default, toneMap, mapping,
+                     nullptr, nullptr, nullptr);
+}
+
+// Which ops handle planes of fmt, how big are its samples, and which interleaved format
+// has the same samples?
+static bool plane_format(skcms_PlaneFormat fmt, Op* load, Op* store, size_t* bytes,
+                         skcms_PixelFormat* interleaved) {
+    switch (fmt) {
+        case skcms_PlaneFormat_8:
+            *load = Op::load_planar_8;  *store = Op::store_planar_8;  *bytes = 1;
+            *interleaved = skcms_PixelFormat_RGBA_8888;
+            return true;
+        case skcms_PlaneFormat_10:
+            *load = Op::load_planar_10; *store = Op::store_planar_10; *bytes = 2;
+            *interleaved = skcms_PixelFormat_RGBA_1010102;
+            return true;
+        case skcms_PlaneFormat_16:
+            *load = Op::load_planar_16; *store = Op::store_planar_16; *bytes = 2;
+            *interleaved = skcms_PixelFormat_RGBA_16161616LE;
+            return true;
+        case skcms_PlaneFormat_h:
+            *load = Op::load_planar_h;  *store = Op::store_planar_h;  *bytes = 2;
+            *interleaved = skcms_PixelFormat_RGBA_hhhh;
+            return true;
+        case skcms_PlaneFormat_f:
+            *load = Op::load_planar_f;  *store = Op::store_planar_f;  *bytes = 4;
+            *interleaved = skcms_PixelFormat_RGBA_ffff;
+            return true;
+    }
+    return false;
+}
+
+bool skcms_TransformPlanar(const void* const       src[4],
+                           skcms_PlaneFormat       srcFmt,
+                           skcms_AlphaFormat       srcAlpha,
+                           const skcms_ICCProfile* srcProfile,
+                           void* const             dst[4],
+                           skcms_PlaneFormat       dstFmt,
+                           skcms_AlphaFormat       dstAlpha,
+                           const skcms_ICCProfile* dstProfile,
+                           size_t                  npixels) {
+    Planar planar;
+    Op unused;
+    skcms_PixelFormat srcLike, dstLike;
+    if (!plane_format(srcFmt, &planar.load, &unused, &planar.src_bytes, &srcLike) ||
+        !plane_format(dstFmt, &unused, &planar.store, &planar.dst_bytes, &dstLike)) {
+        return false;
+    }
+
+    const skcms_ICCProfile* out = srcProfile && is_device_link(srcProfile) ? srcProfile
+                                                                           : dstProfile;
+    const bool src_cmyk = srcProfile && srcProfile->data_color_space == skcms_Signature_CMYK,
+               dst_cmyk = out        && output_color_space(out)     == skcms_Signature_CMYK;
+    for (int c = 0; c < 4; c++) {
+        planar.src.plane[c] = (const char*)src[c];
+        planar.dst.plane[c] = (char*)dst[c];
+
+        // Only alpha planes may be missing, not the K of CMYK.
+        if ((!src[c] && (c < 3 || src_cmyk)) ||
+            (!dst[c] && (c < 3 || dst_cmyk))) {
+            return false;
+        }
+        // We can't transform a plane in place unless its samples stay the same size.
+        if (src[c] && src[c] == dst[c] && planar.src_bytes != planar.dst_bytes) {
+            return false;
+        }
+    }
+
+    return transform(nullptr, srcLike, srcAlpha, srcProfile,
+                     nullptr, dstLike, dstAlpha, dstProfile,
+                     npixels, skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                     &planar, nullptr, nullptr);
+}
+
+bool skcms_TransformYUV(const skcms_YUVImage*   src,
+                        skcms_ChromaFilter      filter,
+                        const skcms_ICCProfile* srcProfile,
+                        void*                   dst,
+                        size_t                  dstStride,
+                        skcms_PixelFormat       dstFmt,
+                        skcms_AlphaFormat       dstAlpha,
+                        const skcms_ICCProfile* dstProfile) {
+    if (!src || !src->y || !src->cb || !dst || src->width <= 0 || src->height <= 0 ||
+            dstStride < (size_t)src->width * bytes_per_pixel(dstFmt) ||
+            !srcProfile || !(is_ycbcr(srcProfile) || srcProfile->deferred_CICP)) {
+        // A lazily parsed profile's CICP isn't read until build_program() resolves it.
+        return false;
+    }
+    if (src->subsampling != skcms_ChromaSubsampling_420 &&
+        src->subsampling != skcms_ChromaSubsampling_422) {
+        return false;
+    }
+
+    YUV yuv;
+    yuv.image      = src;
+    yuv.dst        = (char*)dst;
+    yuv.dst_stride = dstStride;
+
+    skcms_PixelFormat srcLike;
+    switch (src->format) {
+        case skcms_PlaneFormat_8:
+            yuv.row.bytes = 1; yuv.row.scale = 1/255.0f;
+            srcLike = skcms_PixelFormat_RGBA_8888;
+            break;
+        case skcms_PlaneFormat_10:
+            yuv.row.bytes = 2; yuv.row.scale = 1/1023.0f;
+            srcLike = skcms_PixelFormat_RGBA_1010102;
+            break;
+        case skcms_PlaneFormat_16:
+            yuv.row.bytes = 2; yuv.row.scale = 1/65535.0f;
+            srcLike = skcms_PixelFormat_RGBA_16161616LE;
+            break;
+        default: return false;
+    }
+    yuv.row.chroma_step = src->cr ? 1 : 2;
+    yuv.row.bilinear    = filter == skcms_ChromaFilter_Bilinear;
+
+    // Like dst, each source plane's rows must hold a whole row of its samples.
+    const size_t y_row      = (size_t)src->width * yuv.row.bytes,
+                 chroma_row = (size_t)((src->width + 1) / 2) * yuv.row.bytes
+                                                             * (size_t)yuv.row.chroma_step;
+    if (src->y_stride < y_row || src->cb_stride < chroma_row ||
+            (src->cr && src->cr_stride < chroma_row)) {
+        return false;
+    }
+
+    return transform(nullptr, srcLike, skcms_AlphaFormat_Unpremul, srcProfile,
+                     dst, dstFmt, dstAlpha, dstProfile,
+                     (size_t)src->width, skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                     nullptr, &yuv, nullptr);
+}
+
+// Thresholds for ordered dithering, the classic 8x8 Bayer matrix.
+static const uint8_t kBayer8x8[64] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21,
+};
+
+// A tileable 16x16 blue noise tile, ranked by void-and-cluster (Gaussian sigma 1.5).
+static const uint8_t kBlueNoise16x16[256] = {
+    198, 37,175, 57, 18,162, 69, 34, 91,144,223,102, 59,228,109,149,
+    254, 92,219,152,225, 97,188,227,168, 52,195, 11,159, 38,179, 30,
+     54,123,  9, 82,137, 44,128,  3,113,238, 35,129,247, 93,211,140,
+    229,193,165,240, 29,174,246, 62,153, 83,177,204, 70,122,  5, 79,
+    104, 23, 66,111,206, 77,100,212,190, 15,106,147, 24,237,186,151,
+     42,178,221,145, 49,183, 19,139, 40,248, 58,224, 47,170, 60,215,
+    245,127, 85,  1,253,156,116,233, 90,164,119,182, 88,112,136, 14,
+     68,155,196,108, 36,203, 64,  7,217, 71, 21,209,  2,250,202, 98,
+    234, 26, 55,230,135, 87,176,130,187,148,231,131,158, 74, 32,167,
+    210,115,171, 76,213, 22,243, 45,107, 31, 56, 95, 39,191,143, 50,
+      6,141,189, 13,163,118,150,207, 81,255,200,173,241,121,222,105,
+     86,252, 48, 99,239, 53, 72, 12,166,138,114, 10, 84, 20, 65,180,
+     28,218,125,197, 27,220,103,232,192, 25, 67,216,146,194,236,154,
+    110, 61,160, 78,142,181,157,124, 46, 96,226,161, 51, 94,126, 43,
+    242,184,  4,235, 41, 89,  8, 63,244,172,120, 33,249,  0,169,214,
+     73,133,101,205,117,251,199,134,208, 16, 75,185,132,201, 80, 17,
+};
 
-            if (dstProfile->B2A.matrix_channels == 3) {
-                static const skcms_Matrix3x4 I = {{
-                    {1,0,0,0},
-                    {0,1,0,0},
-                    {0,0,1,0},
-                }};
-                if (0 != memcmp(&I, &dstProfile->B2A.matrix, sizeof(I))) {
-                    add_op_ctx(Op::matrix_3x4, &dstProfile->B2A.matrix);
-                }
+bool skcms_TransformImage(const void*             src,
+                          size_t                  srcRowBytes,
+                          skcms_PixelFormat       srcFmt,
+                          skcms_AlphaFormat       srcAlpha,
+                          const skcms_ICCProfile* srcProfile,
+                          void*                   dst,
+                          size_t                  dstRowBytes,
+                          skcms_PixelFormat       dstFmt,
+                          skcms_AlphaFormat       dstAlpha,
+                          const skcms_ICCProfile* dstProfile,
+                          int                     width,
+                          int                     height,
+                          skcms_Dither            dither) {
+    if (width < 0 || height < 0 || (unsigned)dither > skcms_Dither_BlueNoise ||
+            srcRowBytes < (size_t)width * bytes_per_pixel(srcFmt) ||
+            dstRowBytes < (size_t)width * bytes_per_pixel(dstFmt) ||
+            (dst == src && dstRowBytes != srcRowBytes)) {
+        return false;
+    }
 
-                add_curve_ops(dstProfile->B2A.matrix_curves, /*numChannels=*/3);
-            }
+    Image image;
+    image.src        = (const char*)src;
+    image.dst        = (char*)dst;
+    image.src_stride = srcRowBytes;
+    image.dst_stride = dstRowBytes;
+    image.width      = width;
+    image.height     = height;
+    image.dither     = DitherCtx{};
+
+    // How many levels does the store quantize r,g,b to?  Zero for formats we don't dither.
+    float levels[3] = {0,0,0};
+    switch (dstFmt >> 1) {
+        case skcms_PixelFormat_RGB_565 >> 1:
+            levels[0] = 31; levels[1] = 63; levels[2] = 31;
+            break;
+        case skcms_PixelFormat_ABGR_4444 >> 1:
+            levels[0] = levels[1] = levels[2] = 15;
+            break;
+        case skcms_PixelFormat_RGBA_8888      >> 1:
+        case skcms_PixelFormat_RGBA_8888_sRGB >> 1:
+            levels[0] = levels[1] = levels[2] = 255;
+            break;
+        case skcms_PixelFormat_RGBA_1010102 >> 1:
+            levels[0] = levels[1] = levels[2] = 1023;
+            break;
+    }
+
+    DitherCtx& d = image.dither;
+    switch (dither) {
+        case skcms_Dither_None:
+            break;
+        case skcms_Dither_Ordered:
+            d.ranks          = kBayer8x8;
+            d.size_log2      = 3;
+            d.channel_offset = 0;
+            break;
+        case skcms_Dither_BlueNoise:
+            d.ranks          = kBlueNoise16x16;
+            d.size_log2      = 4;
+            d.channel_offset = 5;
+            break;
+    }
+    if (levels[0] == 0) {
+        d.ranks = nullptr;
+    }
+    for (int c = 0; c < 3; c++) {
+        d.step[c] = levels[c] > 0 ? 1 / levels[c] : 0;
+    }
+
+    return transform(src, srcFmt, srcAlpha, srcProfile,
+                     dst, dstFmt, dstAlpha, dstProfile,
+                     (size_t)width, skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                     nullptr, nullptr, &image);
+}
+
+bool skcms_TransformChain(const void*                    src,
+                          skcms_PixelFormat              srcFmt,
+                          skcms_AlphaFormat              srcAlpha,
+                          const skcms_ICCProfile* const* profiles,
+                          int                            nprofiles,
+                          void*                          dst,
+                          skcms_PixelFormat              dstFmt,
+                          skcms_AlphaFormat              dstAlpha,
+                          size_t                         npixels) {
+    if (nprofiles < 2 || nprofiles > kMaxChainProfiles) {
+        return false;
+    }
+    for (int k = 0; k < nprofiles; k++) {
+        if (!profiles[k]) {
+            return false;
+        }
+    }
+
+    const size_t dst_bpp = bytes_per_pixel(dstFmt),
+                 src_bpp = bytes_per_pixel(srcFmt);
+    if (npixels * dst_bpp > INT_MAX || npixels * src_bpp > INT_MAX) {
+        return false;
+    }
+    if (dst == src && dst_bpp != src_bpp) {
+        return false;
+    }
+
+    // Profiles here are fully parsed, so only gray destinations need copies.
+    Program       p;
+    PreparedCurve curves[kMaxChainCurveOps];
+    ProfileCopies copies;
+    if (!build_program(srcFmt, srcAlpha, profiles[0], profiles+1, nprofiles-2,
+                       dstFmt, dstAlpha, profiles[nprofiles-1],
+                       skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                       nullptr, nullptr, nullptr, nullptr, &copies, curves, &p)) {
+        return false;
+    }
+    run_pixels(&p, skcms_Precision_Default, srcFmt, dstFmt,
+               (const char*)src, (char*)dst, (int)npixels);
+    return true;
+}
+
+bool skcms_MakeDeviceLinkCLUT(const skcms_ICCProfile* const* profiles,
+                              int                            nprofiles,
+                              uint8_t                        grid_points,
+                              uint8_t*                       grid_16) {
+    if (nprofiles < 2 || nprofiles > kMaxChainProfiles || grid_points < 2) {
+        return false;
+    }
+    for (int k = 0; k < nprofiles; k++) {
+        if (!profiles[k]) {
+            return false;
+        }
+    }
+    if (profiles[0]          ->data_color_space != skcms_Signature_RGB ||
+        profiles[nprofiles-1]->data_color_space != skcms_Signature_RGB) {
+        return false;
+    }
+
+    // RGB_161616BE pixels are just how an ICC CLUT lays out its 16-bit outputs.
+    Program       p;
+    PreparedCurve curves[kMaxChainCurveOps];
+    if (!build_program(skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Unpremul, profiles[0],
+                       profiles+1, nprofiles-2,
+                       skcms_PixelFormat_RGB_161616BE, skcms_AlphaFormat_Unpremul,
+                       profiles[nprofiles-1],
+                       skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                       nullptr, nullptr, nullptr, nullptr, nullptr, curves, &p)) {
+        return false;
+    }
 
-            if (dstProfile->B2A.output_channels) {
-                add_op(Op::clamp);
-                add_op_ctx(Op::clut_B2A, &dstProfile->B2A);
+    // Blue varies fastest, so each run of grid_points samples shares its red and green.
+    const int   n     = grid_points;
+    const float scale = 1.0f / (float)(n - 1);
+    float row[255][3];
+    for (int r = 0; r < n; r++)
+    for (int g = 0; g < n; g++) {
+        for (int b = 0; b < n; b++) {
+            row[b][0] = (float)r * scale;
+            row[b][1] = (float)g * scale;
+            row[b][2] = (float)b * scale;
+        }
+        run_pixels(&p, skcms_Precision_Default,
+                   skcms_PixelFormat_RGB_fff, skcms_PixelFormat_RGB_161616BE,
+                   (const char*)row, (char*)grid_16 + (size_t)((r*n + g)*n) * 6, n);
+    }
+    return true;
+}
 
-                add_curve_ops(dstProfile->B2A.output_curves,
-                              (int)dstProfile->B2A.output_channels);
+// Writes an 'mluc' tag holding text as its only (en-US) record, returning its unpadded size.
+// A null text writes an empty 'mluc' with no records.
+static uint32_t write_mluc(uint8_t* buf, const char* text) {
+    const uint32_t chars = text ? (uint32_t)strlen(text) : 0;
+    if (buf) {
+        write_big_u32(buf +  0, skcms_Signature_mluc);
+        write_big_u32(buf +  8, text ? 1 : 0);   // records
+        write_big_u32(buf + 12, 12);             // bytes per record
+        if (text) {
+            write_big_u16(buf + 16, 0x656E);     // 'en'
+            write_big_u16(buf + 18, 0x5553);     // 'US'
+            write_big_u32(buf + 20, 2*chars);
+            write_big_u32(buf + 24, 28);
+            for (uint32_t i = 0; i < chars; i++) {
+                write_big_u16(buf + 28 + 2*i, (uint16_t)text[i]);
             }
-        } else {
-            // This is a TRC destination.
-            // We'll concat any src->xyz matrix with our xyz->dst matrix into one src->dst matrix.
-            // (A2B sources are already in XYZD50, making that src->xyz matrix I.)
-            static const skcms_Matrix3x3 I = {{
-                { 1.0f, 0.0f, 0.0f },
-                { 0.0f, 1.0f, 0.0f },
-                { 0.0f, 0.0f, 1.0f },
-            }};
-            const skcms_Matrix3x3* to_xyz = srcProfile->has_A2B ? &I : &srcProfile->toXYZD50;
+        }
+    }
+    return text ? 28 + 2*chars : 16;
+}
 
-            // There's a chance the source and destination gamuts are identical,
-            // in which case we can skip the gamut transform.
-            if (0 != memcmp(&dstProfile->toXYZD50, to_xyz, sizeof(skcms_Matrix3x3))) {
-                // Concat the entire gamut transform into from_xyz,
-                // now slightly misnamed but it's a handy spot to stash the result.
-                from_xyz = skcms_Matrix3x3_concat(&from_xyz, to_xyz);
-                add_op_ctx(Op::matrix_3x3, &from_xyz);
+static uint32_t align4(uint32_t size) {
+    return (size + 3) & ~3u;
+}
+
+bool skcms_WriteDeviceLink(const skcms_ICCProfile* const* profiles,
+                           int                            nprofiles,
+                           uint8_t                        grid_points,
+                           int                            bytes_per_sample,
+                           void*                          buf,
+                           size_t*                        len) {
+    if (nprofiles < 2 || nprofiles > kMaxChainProfiles || grid_points < 2 || !len ||
+            (bytes_per_sample != 1 && bytes_per_sample != 2)) {
+        return false;
+    }
+    for (int k = 0; k < nprofiles; k++) {
+        if (!profiles[k]) {
+            return false;
+        }
+    }
+    const uint32_t in_space  = profiles[0]          ->data_color_space,
+                   out_space = profiles[nprofiles-1]->data_color_space;
+    if ((in_space  != skcms_Signature_RGB && in_space  != skcms_Signature_CMYK) ||
+        (out_space != skcms_Signature_RGB && out_space != skcms_Signature_CMYK)) {
+        return false;
+    }
+    const uint32_t in  = in_space  == skcms_Signature_CMYK ? 4 : 3,
+                   out = out_space == skcms_Signature_CMYK ? 4 : 3;
+
+    uint64_t grid_size = out * (uint64_t)bytes_per_sample;
+    for (uint32_t i = 0; i < in; i++) {
+        grid_size *= grid_points;
+    }
+    if (grid_size > 0x7fffffff) {
+        return false;
+    }
+
+    // Header, tag table, then each tag 4-byte aligned, with the A2B0 'mAB ' tag last.
+    // The mAB holds identity B curves, the CLUT, and identity A curves, in that order.
+    static const char kDesc[] = "skcms device link",
+                      kCprt[] = "No copyright, use freely";
+    const uint32_t kTags     = 4,
+                   desc_size = write_mluc(nullptr, kDesc),
+                   cprt_size = write_mluc(nullptr, kCprt),
+                   pseq_each = 20 + 2*write_mluc(nullptr, nullptr),
+                   pseq_size = 12 + (uint32_t)nprofiles * pseq_each,
+                   clut_size = (uint32_t)SAFE_FIXED_SIZE(CLUT_Layout) + (uint32_t)grid_size,
+                   mab_clut  = (uint32_t)SAFE_SIZEOF(mAB_or_mBA_Layout) + 12*out,
+                   mab_a     = align4(mab_clut + clut_size),
+                   mab_size  = mab_a + 12*in;
+
+    const uint32_t desc_offset = (uint32_t)SAFE_SIZEOF(header_Layout) + kTags*12,
+                   cprt_offset = desc_offset + align4(desc_size),
+                   pseq_offset = cprt_offset + align4(cprt_size),
+                   mab_offset  = pseq_offset + align4(pseq_size),
+                   size        = mab_offset  + mab_size;
+
+    if (!buf) {
+        *len = size;
+        return true;
+    }
+    if (*len < size) {
+        return false;
+    }
+
+    // RGB ends are stored as 8- or 16-bit pixels; CMYK ones fill the alpha channel too.
+    const skcms_PixelFormat srcFmt = in == 4 ? skcms_PixelFormat_RGBA_ffff
+                                             : skcms_PixelFormat_RGB_fff;
+    const skcms_PixelFormat dstFmt = bytes_per_sample == 1
+        ? (out == 4 ? skcms_PixelFormat_RGBA_8888       : skcms_PixelFormat_RGB_888)
+        : (out == 4 ? skcms_PixelFormat_RGBA_16161616BE : skcms_PixelFormat_RGB_161616BE);
+
+    Program       p;
+    PreparedCurve curves[kMaxChainCurveOps];
+    if (!build_program(srcFmt, skcms_AlphaFormat_Unpremul, profiles[0],
+                       profiles+1, nprofiles-2,
+                       dstFmt, skcms_AlphaFormat_Unpremul, profiles[nprofiles-1],
+                       skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                       nullptr, nullptr, nullptr, nullptr, nullptr, curves, &p)) {
+        return false;
+    }
+
+    uint8_t* icc = (uint8_t*)buf;
+    memset(icc, 0, size);
+
+    write_big_u32(icc +   0, size);
+    write_big_u32(icc +   8, 0x04300000);   // ICC v4.3
+    write_big_u32(icc +  12, skcms_Signature_link);
+    write_big_u32(icc +  16, in_space);
+    write_big_u32(icc +  20, out_space);
+    write_big_u32(icc +  36, skcms_Signature_acsp);
+    write_big_u32(icc +  68, 0x0000F6D6);   // D50 illuminant, s15Fixed16
+    write_big_u32(icc +  72, 0x00010000);
+    write_big_u32(icc +  76, 0x0000D32D);
+    write_big_u32(icc + 128, kTags);
+
+    const uint32_t tags[][3] = {
+        { skcms_Signature_desc, desc_offset, desc_size },
+        { skcms_Signature_cprt, cprt_offset, cprt_size },
+        { skcms_Signature_pseq, pseq_offset, pseq_size },
+        { skcms_Signature_A2B0, mab_offset,  mab_size  },
+    };
+    for (uint32_t i = 0; i < kTags; i++) {
+        write_big_u32(icc + 132 + 12*i + 0, tags[i][0]);
+        write_big_u32(icc + 132 + 12*i + 4, tags[i][1]);
+        write_big_u32(icc + 132 + 12*i + 8, tags[i][2]);
+    }
+
+    write_mluc(icc + desc_offset, kDesc);
+    write_mluc(icc + cprt_offset, kCprt);
+
+    // We don't know who made the profiles in the chain, only how many there were.
+    uint8_t* pseq = icc + pseq_offset;
+    write_big_u32(pseq + 0, skcms_Signature_pseq);
+    write_big_u32(pseq + 8, (uint32_t)nprofiles);
+    for (int k = 0; k < nprofiles; k++) {
+        uint8_t* desc = pseq + 12 + (uint32_t)k * pseq_each;
+        write_mluc(desc + 20, nullptr);                       // manufacturer
+        write_mluc(desc + 20 + (pseq_each - 20)/2, nullptr);  // model
+    }
+
+    uint8_t* mab = icc + mab_offset;
+    write_big_u32(mab +  0, skcms_Signature_mAB);
+    mab[8] = (uint8_t)in;
+    mab[9] = (uint8_t)out;
+    write_big_u32(mab + 12, (uint32_t)SAFE_SIZEOF(mAB_or_mBA_Layout));  // B curves
+    write_big_u32(mab + 24, mab_clut);
+    write_big_u32(mab + 28, mab_a);
+    for (uint32_t i = 0; i < out; i++) {
+        write_big_u32(mab + (uint32_t)SAFE_SIZEOF(mAB_or_mBA_Layout) + 12*i,
+                      skcms_Signature_curv);  // No entries makes an identity curve.
+    }
+    for (uint32_t i = 0; i < in; i++) {
+        write_big_u32(mab + mab_a + 12*i, skcms_Signature_curv);
+        mab[mab_clut + i] = grid_points;
+    }
+    mab[mab_clut + 16] = (uint8_t)bytes_per_sample;
+
+    // The last input varies fastest, so each run of grid_points samples shares all the others.
+    uint8_t*     grid      = mab + mab_clut + SAFE_FIXED_SIZE(CLUT_Layout);
+    const int    n         = grid_points;
+    const float  scale     = 1.0f / (float)(n - 1);
+    const size_t row_bytes = (size_t)n * out * (size_t)bytes_per_sample;
+    const size_t rows      = (size_t)grid_size / row_bytes;
+    float row[255*4];
+    for (size_t r = 0; r < rows; r++) {
+        size_t digits = r;
+        for (int c = (int)in - 2; c >= 0; c--) {
+            const float v = (float)(digits % (size_t)n) * scale;
+            digits /= (size_t)n;
+            for (int i = 0; i < n; i++) {
+                row[i*(int)in + c] = v;
             }
+        }
+        for (int i = 0; i < n; i++) {
+            row[i*(int)in + (int)in-1] = (float)i * scale;
+        }
 
-            // Encode back to dst RGB using its parametric transfer functions.
-            OpAndArg oa[3];
-            int numOps = select_curve_ops(dst_curves, /*numChannels=*/3, oa);
-            for (int index = 0; index < numOps; ++index) {
-                assert(oa[index].op != Op::table_r &&
-                       oa[index].op != Op::table_g &&
-                       oa[index].op != Op::table_b &&
-                       oa[index].op != Op::table_a);
-                add_op_ctx(oa[index].op, oa[index].arg);
+        // CLUTs hold CMYK as ink amounts, where skcms pixels hold its inverse.
+        if (in == 4) {
+            for (int i = 0; i < 4*n; i++) {
+                row[i] = 1.0f - row[i];
+            }
+        }
+        uint8_t* dst = grid + r * row_bytes;
+        run_pixels(&p, skcms_Precision_Default, srcFmt, dstFmt,
+                   (const char*)row, (char*)dst, n);
+        if (out == 4) {
+            for (size_t i = 0; i < row_bytes; i++) {
+                dst[i] = (uint8_t)~dst[i];
             }
         }
     }
 
-    // Clamp here before premul to make sure we're clamping to normalized values _and_ gamut,
-    // not just to values that fit in [0,1].
-    //
-    // E.g. r = 1.1, a = 0.5 would fit fine in fixed point after premul (ra=0.55,a=0.5),
-    // but would be carrying r > 1, which is really unexpected for downstream consumers.
-    if (dstFmt < skcms_PixelFormat_RGB_hhh) {
-        add_op(Op::clamp);
+    *len = size;
+    return true;
+}
+
+// skcms_TransformStream holds one of these, and the source pixels of any partial block.
+struct Stream {
+    Program       program;
+    ProfileCopies copies;
+    char*         dst;
+    size_t        src_bpp, dst_bpp;
+    int           held;
+    char          src[16*kPlanarBlock];
+};
+static_assert(sizeof(Stream)  <= sizeof(skcms_TransformStream), "");
+static_assert(alignof(Stream) <= alignof(skcms_TransformStream), "");
+
+static Stream* stream_state(skcms_TransformStream* stream) {
+    return (Stream*)(void*)stream->opaque;
+}
+
+// Runs n pixels, a multiple of kPlanarBlock, compiling the program if that's worth it.
+static void run_stream(Stream* s, const char* src, char* dst, int n) {
+    Program& p = s->program;
+    if (n >= kJITMinPixels && jit_enabled() &&
+            jit::run_program(p.ops, p.contexts, p.size, src, dst, n, s->src_bpp,s->dst_bpp,
+                             jit_avx512())) {
+        return;
     }
+    p.run(p.ops, p.contexts, p.size, src, dst, n, s->src_bpp,s->dst_bpp);
+}
 
-    if (dstProfile->data_color_space == skcms_Signature_CMYK) {
-        // Photoshop creates CMYK images as inverse CMYK.
-        // These happen to be the only ones we've _ever_ seen.
-        add_op(Op::invert);
+bool skcms_TransformStreamBegin(skcms_TransformStream*  stream,
+                                skcms_PixelFormat       srcFmt,
+                                skcms_AlphaFormat       srcAlpha,
+                                const skcms_ICCProfile* srcProfile,
+                                void*                   dst,
+                                skcms_PixelFormat       dstFmt,
+                                skcms_AlphaFormat       dstAlpha,
+                                const skcms_ICCProfile* dstProfile) {
+    Stream* s = stream_state(stream);
+    s->dst     = (char*)dst;
+    s->src_bpp = bytes_per_pixel(srcFmt);
+    s->dst_bpp = bytes_per_pixel(dstFmt);
+    s->held    = 0;
+    memset(s->src, 0, sizeof(s->src));
+    if (!build_program(srcFmt, srcAlpha, srcProfile, nullptr, 0, dstFmt, dstAlpha, dstProfile,
+                       skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                       nullptr, nullptr, nullptr, nullptr, &s->copies, nullptr,
+                       &s->program)) {
+        // A null run marks the stream failed, so Push() and End() leave it alone.
+        s->program.run = nullptr;
+        return false;
+    }
+    return true;
+}
 
-        // CMYK has no alpha channel, so make sure dstAlpha is a no-op.
-        dstAlpha = skcms_AlphaFormat_Unpremul;
+bool skcms_TransformStreamPush(skcms_TransformStream* stream,
+                               const void*            src,
+                               size_t                 npixels) {
+    Stream* s = stream_state(stream);
+    if (!s->program.run) {
+        return false;
+    }
+    if (npixels * s->dst_bpp > INT_MAX || npixels * s->src_bpp > INT_MAX) {
+        return false;
+    }
+    // As with skcms_Transform(), we can't transform in place between different sized formats.
+    if (src == s->dst && s->src_bpp != s->dst_bpp) {
+        return false;
+    }
+    const char* in = (const char*)src;
+    int n = (int)npixels;
+
+    // Top up any pixels held back last time, running them once they fill out a block.
+    if (s->held) {
+        const int take = n < kPlanarBlock - s->held ? n : kPlanarBlock - s->held;
+        memcpy(s->src + (size_t)s->held * s->src_bpp, in, (size_t)take * s->src_bpp);
+        s->held += take;
+        in      += (size_t)take * s->src_bpp;
+        n       -= take;
+        if (s->held < kPlanarBlock) {
+            return true;
+        }
+        run_stream(s, s->src, s->dst, kPlanarBlock);
+        s->dst  += (size_t)kPlanarBlock * s->dst_bpp;
+        s->held  = 0;
     }
 
-    if (dstAlpha == skcms_AlphaFormat_Opaque) {
-        add_op(Op::force_opaque);
-    } else if (dstAlpha == skcms_AlphaFormat_PremulAsEncoded) {
-        add_op(Op::premul);
+    const int blocks = n - n % kPlanarBlock;
+    if (blocks) {
+        run_stream(s, in, s->dst, blocks);
+        in     += (size_t)blocks * s->src_bpp;
+        s->dst += (size_t)blocks * s->dst_bpp;
     }
-    if (dstFmt & 1) {
-        add_op(Op::swap_rb);
+
+    // Hold back anything left until there's a full block of it, or until the end.
+    s->held = n - blocks;
+    memcpy(s->src, in, (size_t)s->held * s->src_bpp);
+    return true;
+}
+
+void skcms_TransformStreamEnd(skcms_TransformStream* stream) {
+    Stream* s = stream_state(stream);
+    if (s->program.run && s->held) {
+        char tmp_dst[16*kPlanarBlock];
+        run_stream(s, s->src, tmp_dst, kPlanarBlock);
+        memcpy(s->dst, tmp_dst, (size_t)s->held * s->dst_bpp);
+        s->dst  += (size_t)s->held * s->dst_bpp;
+        s->held  = 0;
     }
-    switch (dstFmt >> 1) {
-        default: return false;
-        case skcms_PixelFormat_A_8             >> 1: add_op(Op::store_a8);         break;
-        case skcms_PixelFormat_G_8             >> 1: add_op(Op::store_g8);         break;
-        case skcms_PixelFormat_ABGR_4444       >> 1: add_op(Op::store_4444);       break;
-        case skcms_PixelFormat_RGB_565         >> 1: add_op(Op::store_565);        break;
-        case skcms_PixelFormat_RGB_888         >> 1: add_op(Op::store_888);        break;
-        case skcms_PixelFormat_RGBA_8888       >> 1: add_op(Op::store_8888);       break;
-        case skcms_PixelFormat_RGBA_1010102    >> 1: add_op(Op::store_1010102);    break;
-        case skcms_PixelFormat_RGB_161616LE    >> 1: add_op(Op::store_161616LE);   break;
-        case skcms_PixelFormat_RGBA_16161616LE >> 1: add_op(Op::store_16161616LE); break;
-        case skcms_PixelFormat_RGB_161616BE    >> 1: add_op(Op::store_161616BE);   break;
-        case skcms_PixelFormat_RGBA_16161616BE >> 1: add_op(Op::store_16161616BE); break;
-        case skcms_PixelFormat_RGB_hhh_Norm    >> 1: add_op(Op::store_hhh);        break;
-        case skcms_PixelFormat_RGBA_hhhh_Norm  >> 1: add_op(Op::store_hhhh);       break;
-        case skcms_PixelFormat_RGB_101010x_XR  >> 1: add_op(Op::store_101010x_XR); break;
-        case skcms_PixelFormat_RGB_hhh         >> 1: add_op(Op::store_hhh);        break;
-        case skcms_PixelFormat_RGBA_hhhh       >> 1: add_op(Op::store_hhhh);       break;
-        case skcms_PixelFormat_RGB_fff         >> 1: add_op(Op::store_fff);        break;
-        case skcms_PixelFormat_RGBA_ffff       >> 1: add_op(Op::store_ffff);       break;
+}
 
-        case skcms_PixelFormat_RGBA_8888_sRGB >> 1:
-            add_op_ctx(Op::tf_rgb, skcms_sRGB_Inverse_TransferFunction());
-            add_op(Op::store_8888);
-            break;
+// skcms_TransformBuilder holds one of these.  Appended ops' contexts point into storage, or for
+// CLUTs into clut, so that callers need only keep their tables, grids, and callback args alive.
+struct Builder {
+    skcms_PixelFormat       srcFmt, dstFmt;
+    skcms_AlphaFormat       srcAlpha, dstAlpha;
+    const skcms_ICCProfile* srcProfile;
+    const skcms_ICCProfile* dstProfile;
+
+    Appended appended;
+    union {
+        skcms_Matrix3x4 matrix;
+        skcms_Curve     curve;
+        PreparedTF      tf;
+        PreparedHLG     hlg;
+        CallbackCtx     callback;
+    } storage[kMaxAppendedOps];
+    skcms_A2B clut[4];
+    int       cluts;
+
+    bool          built;  // Is program up to date with appended?
+    Program       program;
+    ProfileCopies copies;
+};
+static_assert(sizeof(Builder)  <= sizeof(skcms_TransformBuilder), "");
+static_assert(alignof(Builder) <= alignof(skcms_TransformBuilder), "");
+
+static Builder* builder_state(skcms_TransformBuilder* builder) {
+    return (Builder*)(void*)builder->opaque;
+}
+
+static void append_op(Builder* b, Op op, const void* ctx) {
+    Appended& app = b->appended;
+    assert(app.count < kMaxAppendedOps);
+    app.ops     [app.count] = op;
+    app.contexts[app.count] = ctx;
+    app.count++;
+    b->built = false;
+}
+
+void skcms_TransformBuilder_Init(skcms_TransformBuilder* builder,
+                                 skcms_PixelFormat       srcFmt,
+                                 skcms_AlphaFormat       srcAlpha,
+                                 const skcms_ICCProfile* srcProfile,
+                                 skcms_PixelFormat       dstFmt,
+                                 skcms_AlphaFormat       dstAlpha,
+                                 const skcms_ICCProfile* dstProfile) {
+    Builder* b = builder_state(builder);
+    b->srcFmt         = srcFmt;
+    b->srcAlpha       = srcAlpha;
+    b->srcProfile     = srcProfile;
+    b->dstFmt         = dstFmt;
+    b->dstAlpha       = dstAlpha;
+    b->dstProfile     = dstProfile;
+    b->appended.count = 0;
+    b->cluts          = 0;
+    b->built          = false;
+}
+
+bool skcms_TransformBuilder_AppendMatrix(skcms_TransformBuilder* builder,
+                                         const skcms_Matrix3x4*  matrix) {
+    Builder* b = builder_state(builder);
+    if (b->appended.count == kMaxAppendedOps) {
+        return false;
     }
+    skcms_Matrix3x4* m = &b->storage[b->appended.count].matrix;
+    *m = *matrix;
+    append_op(b, Op::matrix_3x4, m);
+    return true;
+}
 
-    assert(ops      <= program + ARRAY_COUNT(program));
-    assert(contexts <= context + ARRAY_COUNT(context));
+bool skcms_TransformBuilder_AppendCurves(skcms_TransformBuilder* builder,
+                                         const skcms_Curve       curves[3]) {
+    Builder* b = builder_state(builder);
+    for (int c = 0; c < 3; c++) {
+        if (curves[c].table_entries && !curves[c].table_8 && !curves[c].table_16) {
+            return false;
+        }
+    }
 
-    auto run = baseline::run_program;
-    switch (cpu_type()) {
-        case CpuType::SKX:
-            #if !defined(SKCMS_DISABLE_SKX)
-                run = skx::run_program;
+    OpAndArg oa[3];
+    const int numOps = select_curve_ops(curves, /*numChannels=*/3, oa);
+    if (b->appended.count + numOps > kMaxAppendedOps) {
+        return false;
+    }
+    for (int i = 0; i < numOps; i++) {
+        auto& slot = b->storage[b->appended.count];
+        const void* ctx = nullptr;
+        switch (curve_ctx(oa[i].op)) {
+            case CurveCtx::None:
+                slot.curve = *(const skcms_Curve*)oa[i].arg;
+                ctx = &slot.curve;
                 break;
-            #endif
-
-        case CpuType::HSW:
-            #if !defined(SKCMS_DISABLE_HSW)
-                run = hsw::run_program;
+            case CurveCtx::TF:
+                prepare_tf(*(const skcms_TransferFunction*)oa[i].arg, &slot.tf);
+                ctx = &slot.tf;
                 break;
-            #endif
+            case CurveCtx::HLG:
+                prepare_hlg(*(const skcms_TransferFunction*)oa[i].arg, &slot.hlg);
+                ctx = &slot.hlg;
+                break;
+        }
+        append_op(b, oa[i].op, ctx);
+    }
+    return true;
+}
 
-        case CpuType::Baseline:
-            break;
+bool skcms_TransformBuilder_AppendCLUT(skcms_TransformBuilder* builder,
+                                       const uint8_t           grid_points[3],
+                                       const uint8_t*          grid_8,
+                                       const uint8_t*          grid_16) {
+    Builder* b = builder_state(builder);
+    if ((grid_8 == nullptr) == (grid_16 == nullptr)) {
+        return false;
+    }
+    for (int c = 0; c < 3; c++) {
+        if (grid_points[c] < 2) {
+            return false;
+        }
+    }
+    if (b->cluts == ARRAY_COUNT(b->clut) || b->appended.count + 2 > kMaxAppendedOps) {
+        return false;
+    }
+
+    // The clut_A2B op reads only the CLUT of its skcms_A2B.
+    skcms_A2B* a2b = &b->clut[b->cluts++];
+    memset(a2b, 0, sizeof(*a2b));
+    a2b->input_channels  = 3;
+    a2b->output_channels = 3;
+    memcpy(a2b->grid_points, grid_points, 3);
+    a2b->grid_8  = grid_8;
+    a2b->grid_16 = grid_16;
+
+    append_op(b, Op::clamp, nullptr);
+    append_op(b, Op::clut_A2B, a2b);
+    return true;
+}
+
+bool skcms_TransformBuilder_AppendStage(skcms_TransformBuilder* builder,
+                                        skcms_StageFn           fn,
+                                        void*                   ctx) {
+    Builder* b = builder_state(builder);
+    if (!fn || b->appended.count == kMaxAppendedOps) {
+        return false;
+    }
+    CallbackCtx* cb = &b->storage[b->appended.count].callback;
+    cb->fn  = fn;
+    cb->arg = ctx;
+    append_op(b, Op::callback, cb);
+    return true;
+}
+
+bool skcms_TransformBuilder_Run(skcms_TransformBuilder* builder,
+                                const void*             src,
+                                void*                   dst,
+                                size_t                  npixels) {
+    Builder* b = builder_state(builder);
+    const size_t dst_bpp = bytes_per_pixel(b->dstFmt),
+                 src_bpp = bytes_per_pixel(b->srcFmt);
+    if (npixels * dst_bpp > INT_MAX || npixels * src_bpp > INT_MAX) {
+        return false;
+    }
+    if (dst == src && dst_bpp != src_bpp) {
+        return false;
     }
 
-    run(program, context, ops - program, (const char*)src, (char*)dst, n, src_bpp,dst_bpp);
+    if (!b->built) {
+        if (!build_program(b->srcFmt, b->srcAlpha, b->srcProfile, nullptr, 0,
+                           b->dstFmt, b->dstAlpha, b->dstProfile,
+                           skcms_Precision_Default, nullptr, skcms_GamutMapping_Clip,
+                           &b->appended, nullptr, nullptr, nullptr, &b->copies, nullptr,
+                           &b->program)) {
+            return false;
+        }
+        b->built = true;
+    }
+    run_pixels(&b->program, skcms_Precision_Default, b->srcFmt, b->dstFmt,
+               (const char*)src, (char*)dst, (int)npixels);
     return true;
 }
 
@@ -2818,7 +5440,93 @@ static void assert_usable_as_destination(const skcms_ICCProfile* profile) {
 #endif
 }
 
+// A curve's place in skcms_CurveFitCache: two independent 64-bit hashes of its contents,
+// taken in one pass, and the length of its table.  Together they identify it by content alone,
+// so the same curve parsed into another buffer still hits.
+struct CurveId {
+    uint64_t key, check;
+    uint32_t table_entries;
+};
+
+static CurveId curve_id(const skcms_Curve* curve) {
+    const uint8_t* bytes = (const uint8_t*)&curve->parametric;
+    size_t         len   = sizeof(curve->parametric);
+    uint64_t       width = 0;
+    if (curve->table_entries) {
+        // Keep an 8-bit table from colliding with a 16-bit table of the same bytes.
+        width = curve->table_8 ? 1 : 2;
+        bytes = curve->table_8 ? curve->table_8 : curve->table_16;
+        len   = curve->table_entries * width;
+    }
+
+    uint64_t h1 = len ^ width,
+             h2 = ~h1;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        h1 = (h1 ^ word) * 0x9E3779B97F4A7C15ull;
+        h1 = (h1 << 31) | (h1 >> 33);
+        h2 = (h2 + word) * 0xC2B2AE3D27D4EB4Full;
+        h2 = (h2 << 27) | (h2 >> 37);
+        bytes += 8;
+        len   -= 8;
+    }
+    while (len --> 0) {
+        h1 = (h1 ^ *bytes  ) * 0x9E3779B97F4A7C15ull;
+        h2 = (h2 + *bytes++) * 0xC2B2AE3D27D4EB4Full;
+    }
+    h1 ^= h1 >> 29;
+    h2 ^= h2 >> 32;
+    return { h1 ? h1 : 1, h2, curve->table_entries };  // A key of 0 marks unused entries.
+}
+
+static bool approximate_curve_cached(const skcms_Curve* curve,
+                                     skcms_TransferFunction* tf,
+                                     skcms_CurveFitCache* cache) {
+    float max_error;
+    if (!cache) {
+        return skcms_ApproximateCurve(curve, tf, &max_error);
+    }
+
+    const CurveId id = curve_id(curve);
+    for (int i = 0; i < ARRAY_COUNT(cache->fit); i++) {
+        if (cache->fit[i].key           == id.key   &&
+            cache->fit[i].check         == id.check &&
+            cache->fit[i].table_entries == id.table_entries) {
+            *tf = cache->fit[i].tf;
+            return true;
+        }
+    }
+
+    // Failures aren't remembered; they're rare and leave the profile unusable anyway.
+    if (!skcms_ApproximateCurve(curve, tf, &max_error)) {
+        return false;
+    }
+    uint32_t slot = cache->next_fit++ % (uint32_t)ARRAY_COUNT(cache->fit);
+    cache->fit[slot].key           = id.key;
+    cache->fit[slot].check         = id.check;
+    cache->fit[slot].table_entries = id.table_entries;
+    cache->fit[slot].tf            = *tf;
+    return true;
+}
+
 bool skcms_MakeUsableAsDestination(skcms_ICCProfile* profile) {
+    return skcms_MakeUsableAsDestinationCached(profile, nullptr);
+}
+
+bool skcms_MakeUsableAsDestinationCached(skcms_ICCProfile* profile, skcms_CurveFitCache* cache) {
+    // Work on a resolved copy of a lazily parsed profile, so failing leaves it unchanged.
+    // Past this, we fail before we write anything.
+    if (has_deferred_tags(profile)) {
+        skcms_ICCProfile resolved = *profile;
+        if (!skcms_ResolveProfile(&resolved) ||
+            !skcms_MakeUsableAsDestinationCached(&resolved, cache)) {
+            return false;
+        }
+        *profile = resolved;
+        return true;
+    }
+
     if (!profile->has_B2A) {
         skcms_Matrix3x3 fromXYZD50;
         if (!profile->has_trc || !profile->has_toXYZD50
@@ -2835,9 +5543,8 @@ bool skcms_MakeUsableAsDestination(skcms_ICCProfile* profile) {
                 continue;
             }
 
-            float max_error;
             // Parametric curves from skcms_ApproximateCurve() are guaranteed to be invertible.
-            if (!skcms_ApproximateCurve(&profile->trc[i], &tf[i], &max_error)) {
+            if (!approximate_curve_cached(&profile->trc[i], &tf[i], cache)) {
                 return false;
             }
         }
@@ -2852,30 +5559,71 @@ bool skcms_MakeUsableAsDestination(skcms_ICCProfile* profile) {
 }
 
 bool skcms_MakeUsableAsDestinationWithSingleCurve(skcms_ICCProfile* profile) {
+    return skcms_MakeUsableAsDestinationWithSingleCurveCached(profile, nullptr);
+}
+
+bool skcms_MakeUsableAsDestinationWithSingleCurveCached(skcms_ICCProfile* profile,
+                                                        skcms_CurveFitCache* cache) {
+    // The best curve depends only on the three original TRCs, so key on those.
+    CurveId id[3];
+    if (cache) {
+        for (int i = 0; i < 3; i++) {
+            id[i] = curve_id(&profile->trc[i]);
+        }
+    }
+
     // Call skcms_MakeUsableAsDestination() with B2A disabled;
     // on success that'll return a TRC/XYZ profile with three skcms_TransferFunctions.
     skcms_ICCProfile result = *profile;
     result.has_B2A = false;
-    if (!skcms_MakeUsableAsDestination(&result)) {
+    result.deferred_B2A = 0;
+    if (!skcms_MakeUsableAsDestinationCached(&result, cache)) {
         return false;
     }
 
-    // Of the three, pick the transfer function that best fits the other two.
-    int best_tf = 0;
-    float min_max_error = INFINITY_;
-    for (int i = 0; i < 3; i++) {
-        skcms_TransferFunction inv;
-        if (!skcms_TransferFunction_invert(&result.trc[i].parametric, &inv)) {
-            return false;
+    int best_tf = -1;
+    if (cache) {
+        for (int i = 0; i < ARRAY_COUNT(cache->single) && best_tf < 0; i++) {
+            bool same = true;
+            for (int j = 0; j < 3; j++) {
+                same = same && cache->single[i].key          [j] == id[j].key
+                            && cache->single[i].check        [j] == id[j].check
+                            && cache->single[i].table_entries[j] == id[j].table_entries;
+            }
+            if (same) {
+                best_tf = cache->single[i].best;
+            }
         }
+    }
+
+    if (best_tf < 0) {
+        // Of the three, pick the transfer function that best fits the other two.
+        best_tf = 0;
+        float min_max_error = INFINITY_;
+        for (int i = 0; i < 3; i++) {
+            skcms_TransferFunction inv;
+            if (!skcms_TransferFunction_invert(&result.trc[i].parametric, &inv)) {
+                return false;
+            }
 
-        float err = 0;
-        for (int j = 0; j < 3; ++j) {
-            err = fmaxf_(err, skcms_MaxRoundtripError(&profile->trc[j], &inv));
+            float err = 0;
+            for (int j = 0; j < 3; ++j) {
+                err = fmaxf_(err, skcms_MaxRoundtripError(&profile->trc[j], &inv));
+            }
+            if (min_max_error > err) {
+                min_max_error = err;
+                best_tf = i;
+            }
         }
-        if (min_max_error > err) {
-            min_max_error = err;
-            best_tf = i;
+
+        if (cache) {
+            uint32_t slot = cache->next_single++ % (uint32_t)ARRAY_COUNT(cache->single);
+            cache->single[slot].best = best_tf;
+            for (int i = 0; i < 3; i++) {
+                cache->single[slot].key          [i] = id[i].key;
+                cache->single[slot].check        [i] = id[i].check;
+                cache->single[slot].table_entries[i] = id[i].table_entries;
+            }
         }
     }
 
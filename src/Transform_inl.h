@@ -72,6 +72,11 @@ using U8  = V<uint8_t>;
     #pragma clang diagnostic ignored "-Wvector-conversion"
 #endif
 
+// Threaded dispatch needs labels-as-values, a GNU extension.
+#if SKCMS_HAS_COMPUTED_GOTO && defined(__clang__)
+    #pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#endif
+
 // GCC & Clang (but not clang-cl) warn returning U64 on x86 is larger than a register.
 // You'd see warnings like, "using AVX even though AVX is not enabled".
 // We stifle these warnings; our helpers that return U64 are always inlined.
@@ -111,7 +116,7 @@ template <typename D, typename S>
 SI D cast(const S& v) {
 #if N == 1
     return (D)v;
-#elif defined(__clang__)
+#elif defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)
     return __builtin_convertvector(v, D);
 #else
     D d;
@@ -277,9 +282,44 @@ SI F approx_pow(F x, float y) {
                                              , approx_exp2(approx_log2(x) * y));
 }
 
-SI F approx_exp(F x) {
-    const float log2_e = 1.4426950408889634074f;
-    return approx_exp2(log2_e * x);
+// More accurate alternatives to approx_log2() and approx_exp2(), for skcms_Precision_Precise.
+// They're exact at powers of two, so neighboring octaves join up without a seam.
+
+SI F precise_log2(F x) {
+    // Split x into 2^e * m with m in [sqrt(1/2), sqrt(2)), centering m around 1.
+    I32 bits = bit_pun<I32>(x) - 0x3f3504f3,
+        e    = bits >> 23;
+    F   m    = bit_pun<F>((bits & 0x007fffff) + 0x3f3504f3);
+
+    // log2(m) == 2/ln(2) * atanh(s) with s = (m-1)/(m+1), and |s| < 0.172 converges quickly.
+    F s  = (m - 1.0f) / (m + 1.0f),
+      s2 = s*s;
+    return cast<F>(e) + s*(2.885390082f + s2*(0.961796694f + s2*(0.577078016f
+                                        + s2*(0.412198583f + s2* 0.320598898f))));
+}
+
+SI F precise_exp2(F x) {
+    x = min_(max_(x, F() - 127.0f), F() + 128.0f);
+    F n = floor_(x),
+      f = x - n;
+
+    // 2^f ~= 1 + f + f(f-1)p(f), with p a minimax fit.
+    F p = 1.0f + f + f*(f - 1.0f)*(0.306852968f + f*(0.0666234543f + f*(0.0111393018f
+                                                + f*(0.00146123796f + f*0.000217150253f))));
+    return p * bit_pun<F>((cast<I32>(n) + 127) << 23);
+}
+
+SI F approx_log2(F x, Precision p) {
+    return p == Precision::Precise ? precise_log2(x) : approx_log2(x);
+}
+
+SI F approx_exp2(F x, Precision p) {
+    return p == Precision::Precise ? precise_exp2(x) : approx_exp2(x);
+}
+
+SI F approx_pow(F x, float y, Precision p) {
+    return if_then_else((x == F0) | (x == F1), x
+                                             , approx_exp2(approx_log2(x, p) * y, p));
 }
 
 SI F strip_sign(F x, U32* sign) {
@@ -293,67 +333,87 @@ SI F apply_sign(F x, U32 sign) {
 }
 
 // Return tf(x).
-SI F apply_tf(const skcms_TransferFunction* tf, F x) {
+template <Precision P>
+SI F apply_tf(const PreparedTF* tf, F x) {
     // Peel off the sign bit and set x = |x|.
     U32 sign;
     x = strip_sign(x, &sign);
 
     // The transfer function has a linear part up to d, exponential at d and after.
     F v = if_then_else(x < tf->d,            tf->c*x + tf->f
-                                , approx_pow(tf->a*x + tf->b, tf->g) + tf->e);
+                                , approx_pow(tf->a*x + tf->b, tf->g, P) + tf->e);
 
     // Tack the sign bit back on.
     return apply_sign(v, sign);
 }
 
 // Return the gamma function (|x|^G with the original sign re-applied to x).
-SI F apply_gamma(const skcms_TransferFunction* tf, F x) {
+template <Precision P>
+SI F apply_gamma(const PreparedTF* tf, F x) {
     U32 sign;
     x = strip_sign(x, &sign);
-    return apply_sign(approx_pow(x, tf->g), sign);
+    return apply_sign(approx_pow(x, tf->g, P), sign);
 }
 
-SI F apply_pq(const skcms_TransferFunction* tf, F x) {
+template <Precision P>
+SI F apply_pq(const PreparedTF* tf, F x) {
     U32 bits = bit_pun<U32>(x),
         sign = bits & 0x80000000;
     x = bit_pun<F>(bits ^ sign);
 
-    F v = approx_pow(max_(tf->a + tf->b * approx_pow(x, tf->c), F0)
-                       / (tf->d + tf->e * approx_pow(x, tf->c)),
-                     tf->f);
+    F x_c = approx_pow(x, tf->c, P);
+    F v = approx_pow(max_(tf->a + tf->b * x_c, F0)
+                       / (tf->d + tf->e * x_c),
+                     tf->f, P);
 
     return bit_pun<F>(sign | bit_pun<U32>(v));
 }
 
-SI F apply_hlg(const skcms_TransferFunction* tf, F x) {
-    const float R = tf->a, G = tf->b,
-                a = tf->c, b = tf->d, c = tf->e,
-                K = tf->f + 1;
+template <Precision P>
+SI F apply_hlg(const PreparedHLG* hlg, F x) {
     U32 bits = bit_pun<U32>(x),
         sign = bits & 0x80000000;
     x = bit_pun<F>(bits ^ sign);
 
-    F v = if_then_else(x*R <= 1, approx_pow(x*R, G)
-                               , approx_exp((x-c)*a) + b);
+    F v = if_then_else(x*hlg->R <= 1, approx_pow(x*hlg->R, hlg->G, P)
+                                    , approx_exp2(x*hlg->a_log2e - hlg->ac_log2e,
+                                                  P) + hlg->b);
 
-    return K*bit_pun<F>(sign | bit_pun<U32>(v));
+    return hlg->K*bit_pun<F>(sign | bit_pun<U32>(v));
 }
 
-SI F apply_hlginv(const skcms_TransferFunction* tf, F x) {
-    const float R = tf->a, G = tf->b,
-                a = tf->c, b = tf->d, c = tf->e,
-                K = tf->f + 1;
+template <Precision P>
+SI F apply_hlginv(const PreparedHLG* hlg, F x) {
     U32 bits = bit_pun<U32>(x),
         sign = bits & 0x80000000;
     x = bit_pun<F>(bits ^ sign);
-    x /= K;
+    x *= hlg->inv_K;
 
-    F v = if_then_else(x <= 1, R * approx_pow(x, G)
-                             , a * approx_log(x - b) + c);
+    F v = if_then_else(x <= 1, hlg->R * approx_pow(x, hlg->G, P)
+                             , hlg->a_ln2 * approx_log2(x - hlg->b, P) + hlg->c);
 
     return bit_pun<F>(sign | bit_pun<U32>(v));
 }
 
+// SMPTE ST 2084 PQ, between linear [0,1] (0-10000 nits) and encoded [0,1].
+SI F pq_encode(F Y) {
+    F Ym = approx_pow(max_(Y, F0), 1305/8192.0f, Precision::Default);
+    return approx_pow((107/128.0f + (2413/128.0f)*Ym) / (F1 + (2392/128.0f)*Ym),
+                      2523/32.0f, Precision::Default);
+}
+SI F pq_decode(F E) {
+    F Em = approx_pow(max_(E, F0), 32/2523.0f, Precision::Default);
+    return approx_pow(max_(Em - 107/128.0f, F0) / (2413/128.0f - (2392/128.0f)*Em),
+                      8192/1305.0f, Precision::Default);
+}
+
+// Scale r,g,b by mapped/peak, where peak = max(r,g,b) was tone mapped to mapped.
+SI void apply_tone_map(F peak, F mapped, F* r, F* g, F* b) {
+    F scale = if_then_else(peak > F0, mapped / peak, F1);
+    *r *= scale;
+    *g *= scale;
+    *b *= scale;
+}
 
 // Strided loads and stores of N values, starting from p.
 template <typename T, typename P>
@@ -1065,6 +1125,95 @@ STAGE(load_ffff, NoCtx) {
 #endif
 }
 
+// Planar loads need no deinterleaving, just one plain vector load per plane.
+STAGE(load_planar_8, const LoadPlanesCtx* ctx) {
+    const char* const* p = ctx->plane;
+    r = F_from_U8(load<U8>(p[0] + 1*i));
+    g = F_from_U8(load<U8>(p[1] + 1*i));
+    b = F_from_U8(load<U8>(p[2] + 1*i));
+    if (p[3]) {
+        a = F_from_U8(load<U8>(p[3] + 1*i));
+    }
+}
+
+STAGE(load_planar_10, const LoadPlanesCtx* ctx) {
+    const char* const* p = ctx->plane;
+    r = cast<F>(load<U16>(p[0] + 2*i)) * (1/1023.0f);
+    g = cast<F>(load<U16>(p[1] + 2*i)) * (1/1023.0f);
+    b = cast<F>(load<U16>(p[2] + 2*i)) * (1/1023.0f);
+    if (p[3]) {
+        a = cast<F>(load<U16>(p[3] + 2*i)) * (1/1023.0f);
+    }
+}
+
+STAGE(load_planar_16, const LoadPlanesCtx* ctx) {
+    const char* const* p = ctx->plane;
+    r = cast<F>(load<U16>(p[0] + 2*i)) * (1/65535.0f);
+    g = cast<F>(load<U16>(p[1] + 2*i)) * (1/65535.0f);
+    b = cast<F>(load<U16>(p[2] + 2*i)) * (1/65535.0f);
+    if (p[3]) {
+        a = cast<F>(load<U16>(p[3] + 2*i)) * (1/65535.0f);
+    }
+}
+
+STAGE(load_planar_h, const LoadPlanesCtx* ctx) {
+    const char* const* p = ctx->plane;
+    r = F_from_Half(load<U16>(p[0] + 2*i));
+    g = F_from_Half(load<U16>(p[1] + 2*i));
+    b = F_from_Half(load<U16>(p[2] + 2*i));
+    if (p[3]) {
+        a = F_from_Half(load<U16>(p[3] + 2*i));
+    }
+}
+
+STAGE(load_planar_f, const LoadPlanesCtx* ctx) {
+    const char* const* p = ctx->plane;
+    r = load<F>(p[0] + 4*i);
+    g = load<F>(p[1] + 4*i);
+    b = load<F>(p[2] + 4*i);
+    if (p[3]) {
+        a = load<F>(p[3] + 4*i);
+    }
+}
+
+SI I32 lane_index() {
+    int32_t ix[N];
+    for (int k = 0; k < N; k++) {
+        ix[k] = k;
+    }
+    return load<I32>(ix);
+}
+
+SI F gather_sample(const YUVRowCtx* ctx, const char* p, I32 ix) {
+    const uint8_t* bytes = (const uint8_t*)p;
+    return ctx->bytes == 1 ? cast<F>(gather_8 (bytes, ix)) * ctx->scale
+                           : cast<F>(gather_16(bytes, ix)) * ctx->scale;
+}
+
+// Chroma is sited with even pixels (as in H.264 and HEVC), so bilinear filtering averages
+// neighboring chroma samples for odd pixels, and blends the two rows the caller picked.
+SI F load_chroma(const YUVRowCtx* ctx, const char* const rows[2], I32 x) {
+    I32 cx = x >> 1;
+    if (!ctx->bilinear) {
+        return gather_sample(ctx, rows[0], cx * ctx->chroma_step);
+    }
+    I32 cx1 = cast<I32>(min_(cast<F>(cx + (x & 1)), F() + (float)(ctx->chroma_width - 1)));
+
+    F c0 = gather_sample(ctx, rows[0], cx  * ctx->chroma_step)
+         + gather_sample(ctx, rows[0], cx1 * ctx->chroma_step),
+      c1 = gather_sample(ctx, rows[1], cx  * ctx->chroma_step)
+         + gather_sample(ctx, rows[1], cx1 * ctx->chroma_step);
+    return (c0 + (c1 - c0) * ctx->t) * 0.5f;
+}
+
+STAGE(load_yuv, const YUVRowCtx* ctx) {
+    I32 x = cast<I32>(min_(cast<F>(lane_index() + i), F() + (float)(ctx->width - 1)));
+
+    r = gather_sample(ctx, ctx->y, x);
+    g = load_chroma(ctx, ctx->cb, x);
+    b = load_chroma(ctx, ctx->cr, x);
+}
+
 STAGE(swap_rb, NoCtx) {
     F t = r;
     r = b;
@@ -1166,59 +1315,131 @@ STAGE(xyz_to_lab, NoCtx) {
     b = (B + 128.0f) * (1/255.0f);
 }
 
-STAGE(gamma_r, const skcms_TransferFunction* tf) { r = apply_gamma(tf, r); }
-STAGE(gamma_g, const skcms_TransferFunction* tf) { g = apply_gamma(tf, g); }
-STAGE(gamma_b, const skcms_TransferFunction* tf) { b = apply_gamma(tf, b); }
-STAGE(gamma_a, const skcms_TransferFunction* tf) { a = apply_gamma(tf, a); }
+// Each parametric curve stage comes in one variant per Precision, so the choice of log2() and
+// exp2() is made once when the program is built, not for every batch of pixels.
+#define CURVE_STAGES(P, S)                                                           \
+    STAGE(gamma_r##S, const PreparedTF* tf) { r = apply_gamma<P>(tf, r); }           \
+    STAGE(gamma_g##S, const PreparedTF* tf) { g = apply_gamma<P>(tf, g); }           \
+    STAGE(gamma_b##S, const PreparedTF* tf) { b = apply_gamma<P>(tf, b); }           \
+    STAGE(gamma_a##S, const PreparedTF* tf) { a = apply_gamma<P>(tf, a); }           \
+    STAGE(gamma_rgb##S, const PreparedTF* tf) {                                      \
+        r = apply_gamma<P>(tf, r);                                                   \
+        g = apply_gamma<P>(tf, g);                                                   \
+        b = apply_gamma<P>(tf, b);                                                   \
+    }                                                                                \
+                                                                                     \
+    STAGE(tf_r##S, const PreparedTF* tf) { r = apply_tf<P>(tf, r); }                 \
+    STAGE(tf_g##S, const PreparedTF* tf) { g = apply_tf<P>(tf, g); }                 \
+    STAGE(tf_b##S, const PreparedTF* tf) { b = apply_tf<P>(tf, b); }                 \
+    STAGE(tf_a##S, const PreparedTF* tf) { a = apply_tf<P>(tf, a); }                 \
+    STAGE(tf_rgb##S, const PreparedTF* tf) {                                         \
+        r = apply_tf<P>(tf, r);                                                      \
+        g = apply_tf<P>(tf, g);                                                      \
+        b = apply_tf<P>(tf, b);                                                      \
+    }                                                                                \
+                                                                                     \
+    STAGE(pq_r##S, const PreparedTF* tf) { r = apply_pq<P>(tf, r); }                 \
+    STAGE(pq_g##S, const PreparedTF* tf) { g = apply_pq<P>(tf, g); }                 \
+    STAGE(pq_b##S, const PreparedTF* tf) { b = apply_pq<P>(tf, b); }                 \
+    STAGE(pq_a##S, const PreparedTF* tf) { a = apply_pq<P>(tf, a); }                 \
+    STAGE(pq_rgb##S, const PreparedTF* tf) {                                         \
+        r = apply_pq<P>(tf, r);                                                      \
+        g = apply_pq<P>(tf, g);                                                      \
+        b = apply_pq<P>(tf, b);                                                      \
+    }                                                                                \
+                                                                                     \
+    STAGE(hlg_r##S, const PreparedHLG* hlg) { r = apply_hlg<P>(hlg, r); }            \
+    STAGE(hlg_g##S, const PreparedHLG* hlg) { g = apply_hlg<P>(hlg, g); }            \
+    STAGE(hlg_b##S, const PreparedHLG* hlg) { b = apply_hlg<P>(hlg, b); }            \
+    STAGE(hlg_a##S, const PreparedHLG* hlg) { a = apply_hlg<P>(hlg, a); }            \
+    STAGE(hlg_rgb##S, const PreparedHLG* hlg) {                                      \
+        r = apply_hlg<P>(hlg, r);                                                    \
+        g = apply_hlg<P>(hlg, g);                                                    \
+        b = apply_hlg<P>(hlg, b);                                                    \
+    }                                                                                \
+                                                                                     \
+    STAGE(hlginv_r##S, const PreparedHLG* hlg) { r = apply_hlginv<P>(hlg, r); }      \
+    STAGE(hlginv_g##S, const PreparedHLG* hlg) { g = apply_hlginv<P>(hlg, g); }      \
+    STAGE(hlginv_b##S, const PreparedHLG* hlg) { b = apply_hlginv<P>(hlg, b); }      \
+    STAGE(hlginv_a##S, const PreparedHLG* hlg) { a = apply_hlginv<P>(hlg, a); }      \
+    STAGE(hlginv_rgb##S, const PreparedHLG* hlg) {                                   \
+        r = apply_hlginv<P>(hlg, r);                                                 \
+        g = apply_hlginv<P>(hlg, g);                                                 \
+        b = apply_hlginv<P>(hlg, b);                                                 \
+    }
 
-STAGE(gamma_rgb, const skcms_TransferFunction* tf) {
-    r = apply_gamma(tf, r);
-    g = apply_gamma(tf, g);
-    b = apply_gamma(tf, b);
-}
+CURVE_STAGES(Precision::Default, )
+CURVE_STAGES(Precision::Precise, _precise)
+#undef CURVE_STAGES
 
-STAGE(tf_r, const skcms_TransferFunction* tf) { r = apply_tf(tf, r); }
-STAGE(tf_g, const skcms_TransferFunction* tf) { g = apply_tf(tf, g); }
-STAGE(tf_b, const skcms_TransferFunction* tf) { b = apply_tf(tf, b); }
-STAGE(tf_a, const skcms_TransferFunction* tf) { a = apply_tf(tf, a); }
+// ITU-R BT.2390's EETF: a Hermite spline from the knee ks to the target peak, in PQ space.
+STAGE(tonemap_bt2390, const ToneMapCtx* tm) {
+    F x  = max_(r, max_(g, b)),
+      E1 = min_(pq_encode(x * tm->in_scale) * tm->inv_pq_peak, F1);
 
-STAGE(tf_rgb, const skcms_TransferFunction* tf) {
-    r = apply_tf(tf, r);
-    g = apply_tf(tf, g);
-    b = apply_tf(tf, b);
-}
+    F T  = (E1 - tm->ks) * tm->inv_1_ks,
+      T2 = T*T,
+      T3 = T2*T;
+    F E2 = if_then_else(E1 <= tm->ks, E1, (2.0f*T3 - 3.0f*T2 + 1.0f) * tm->ks
+                                        + (T3 - 2.0f*T2 + T)      * (1.0f - tm->ks)
+                                        + (3.0f*T2 - 2.0f*T3)     * tm->max_lum);
 
-STAGE(pq_r, const skcms_TransferFunction* tf) { r = apply_pq(tf, r); }
-STAGE(pq_g, const skcms_TransferFunction* tf) { g = apply_pq(tf, g); }
-STAGE(pq_b, const skcms_TransferFunction* tf) { b = apply_pq(tf, b); }
-STAGE(pq_a, const skcms_TransferFunction* tf) { a = apply_pq(tf, a); }
+    apply_tone_map(x, pq_decode(E2 * tm->pq_peak) * tm->out_scale, &r, &g, &b);
+}
 
-STAGE(pq_rgb, const skcms_TransferFunction* tf) {
-    r = apply_pq(tf, r);
-    g = apply_pq(tf, g);
-    b = apply_pq(tf, b);
+// Extended Reinhard, v(1 + v/peak^2) / (1 + v), taking the source peak to SDR white.
+STAGE(tonemap_reinhard, const ToneMapCtx* tm) {
+    F x = max_(r, max_(g, b)),
+      v = x * tm->in_scale;
+    apply_tone_map(x, v * (F1 + v*tm->inv_peak2) / (F1 + v) * tm->out_scale, &r, &g, &b);
 }
 
-STAGE(hlg_r, const skcms_TransferFunction* tf) { r = apply_hlg(tf, r); }
-STAGE(hlg_g, const skcms_TransferFunction* tf) { g = apply_hlg(tf, g); }
-STAGE(hlg_b, const skcms_TransferFunction* tf) { b = apply_hlg(tf, b); }
-STAGE(hlg_a, const skcms_TransferFunction* tf) { a = apply_hlg(tf, a); }
+STAGE(gamut_map, const GamutMapCtx* gm) {
+    F Y = max_(F0, min_(gm->wr*r + gm->wg*g + gm->wb*b, F1));
 
-STAGE(hlg_rgb, const skcms_TransferFunction* tf) {
-    r = apply_hlg(tf, r);
-    g = apply_hlg(tf, g);
-    b = apply_hlg(tf, b);
+    // How far out toward the gamut boundary is each channel, with 1 right on it?
+    auto dist = [&](F c) {
+        return if_then_else(c > Y, (c - Y) / (F1 - Y),
+               if_then_else(c < Y, (Y - c) / Y, F0));
+    };
+    F d = min_(max_(dist(r), max_(dist(g), dist(b))), F() + 1e6f);
+
+    // Past the knee, ease d toward 1 with a slope of 1 at the knee, and scale chroma to match.
+    F x     = d - gm->knee,
+      eased = gm->knee + (1.0f - gm->knee) * x / ((1.0f - gm->knee) + x),
+      scale = if_then_else(d > gm->knee, eased / d, F1);
+    r = Y + scale * (r - Y);
+    g = Y + scale * (g - Y);
+    b = Y + scale * (b - Y);
+}
+
+STAGE(dither, const DitherCtx* ctx) {
+    const int   mask  = (1 << ctx->size_log2) - 1;
+    const float scale = 1.0f / (float)(1 << (2*ctx->size_log2));
+    I32 x = lane_index() + (ctx->x0 + i);
+
+    auto threshold = [&](int c) {
+        const int shift = c * ctx->channel_offset;
+        I32 ix = (((ctx->y + shift) & mask) << ctx->size_log2) + ((x + shift) & mask);
+        return ((cast<F>(gather_8(ctx->ranks, ix)) + 0.5f) * scale - 0.5f) * ctx->step[c];
+    };
+    F hi = ctx->premul ? a : F1;
+    r = max_(F0, min_(r + threshold(0), hi));
+    g = max_(F0, min_(g + threshold(1), hi));
+    b = max_(F0, min_(b + threshold(2), hi));
 }
 
-STAGE(hlginv_r, const skcms_TransferFunction* tf) { r = apply_hlginv(tf, r); }
-STAGE(hlginv_g, const skcms_TransferFunction* tf) { g = apply_hlginv(tf, g); }
-STAGE(hlginv_b, const skcms_TransferFunction* tf) { b = apply_hlginv(tf, b); }
-STAGE(hlginv_a, const skcms_TransferFunction* tf) { a = apply_hlginv(tf, a); }
-
-STAGE(hlginv_rgb, const skcms_TransferFunction* tf) {
-    r = apply_hlginv(tf, r);
-    g = apply_hlginv(tf, g);
-    b = apply_hlginv(tf, b);
+STAGE(callback, const CallbackCtx* ctx) {
+    float R[N], G[N], B[N], A[N];
+    memcpy(R, &r, sizeof(R));
+    memcpy(G, &g, sizeof(G));
+    memcpy(B, &b, sizeof(B));
+    memcpy(A, &a, sizeof(A));
+    ctx->fn(R,G,B,A, N, ctx->arg);
+    memcpy(&r, R, sizeof(R));
+    memcpy(&g, G, sizeof(G));
+    memcpy(&b, B, sizeof(B));
+    memcpy(&a, A, sizeof(A));
 }
 
 STAGE(table_r, const skcms_Curve* curve) { r = table(curve, r); }
@@ -1476,12 +1697,101 @@ FINAL_STAGE(store_ffff, NoCtx) {
 #endif
 }
 
+FINAL_STAGE(store_planar_8, const StorePlanesCtx* ctx) {
+    char* const* p = ctx->plane;
+    store(p[0] + 1*i, cast<U8>(to_fixed(r * 255)));
+    store(p[1] + 1*i, cast<U8>(to_fixed(g * 255)));
+    store(p[2] + 1*i, cast<U8>(to_fixed(b * 255)));
+    if (p[3]) {
+        store(p[3] + 1*i, cast<U8>(to_fixed(a * 255)));
+    }
+}
+
+FINAL_STAGE(store_planar_10, const StorePlanesCtx* ctx) {
+    char* const* p = ctx->plane;
+    store(p[0] + 2*i, cast<U16>(to_fixed(r * 1023)));
+    store(p[1] + 2*i, cast<U16>(to_fixed(g * 1023)));
+    store(p[2] + 2*i, cast<U16>(to_fixed(b * 1023)));
+    if (p[3]) {
+        store(p[3] + 2*i, cast<U16>(to_fixed(a * 1023)));
+    }
+}
+
+FINAL_STAGE(store_planar_16, const StorePlanesCtx* ctx) {
+    char* const* p = ctx->plane;
+    store(p[0] + 2*i, U16_from_F(r));
+    store(p[1] + 2*i, U16_from_F(g));
+    store(p[2] + 2*i, U16_from_F(b));
+    if (p[3]) {
+        store(p[3] + 2*i, U16_from_F(a));
+    }
+}
+
+FINAL_STAGE(store_planar_h, const StorePlanesCtx* ctx) {
+    char* const* p = ctx->plane;
+    store(p[0] + 2*i, Half_from_F(r));
+    store(p[1] + 2*i, Half_from_F(g));
+    store(p[2] + 2*i, Half_from_F(b));
+    if (p[3]) {
+        store(p[3] + 2*i, Half_from_F(a));
+    }
+}
+
+FINAL_STAGE(store_planar_f, const StorePlanesCtx* ctx) {
+    char* const* p = ctx->plane;
+    store(p[0] + 4*i, r);
+    store(p[1] + 4*i, g);
+    store(p[2] + 4*i, b);
+    if (p[3]) {
+        store(p[3] + 4*i, a);
+    }
+}
+
 #if SKCMS_HAS_MUSTTAIL
 
     SI void exec_stages(StageFn* stages, const void** contexts, const char* src, char* dst, int i) {
         (*stages)({stages}, contexts, src, dst, F0, F0, F0, F1, i);
     }
 
+#elif SKCMS_HAS_COMPUTED_GOTO
+
+    // Runs the program over `blocks` blocks of N pixels starting at pixel i.  Each stage jumps
+    // straight to the next one's label, with r,g,b,a held in locals across the whole program.
+    static void exec_stages(const Op* program, const void** contexts, ptrdiff_t programSize,
+                            const char* src, char* dst, int i, int blocks) {
+        static const void* const kLabels[] = {
+#define M(name) &&label_##name,
+            SKCMS_WORK_OPS(M)
+            SKCMS_STORE_OPS(M)
+#undef M
+        };
+
+        // Convert the program into an array of labels.
+        const void* stages[kMaxOps];
+        assert(programSize <= ARRAY_COUNT(stages));
+        for (ptrdiff_t index = 0; index < programSize; ++index) {
+            stages[index] = kLabels[(int)program[index]];
+        }
+
+        const void* const* next;
+        const void**       ctx;
+        F r, g, b, a;
+        for (; blocks > 0; --blocks, i += N) {
+            next = stages;
+            ctx  = contexts;
+            r = g = b = F0;
+            a = F1;
+            goto **next++;
+
+#define M(name) label_##name: Exec_##name(*ctx++, src, dst, r, g, b, a, i); goto **next++;
+            SKCMS_WORK_OPS(M)
+#undef M
+#define M(name) label_##name: Exec_##name(*ctx++, src, dst, r, g, b, a, i); continue;
+            SKCMS_STORE_OPS(M)
+#undef M
+        }
+    }
+
 #else
 
     static void exec_stages(const Op* ops, const void** contexts,
@@ -1501,13 +1811,86 @@ FINAL_STAGE(store_ffff, NoCtx) {
 
 #endif
 
+// Block execution runs each stage over kBlockVectors vectors before moving on to the next one,
+// holding r,g,b,a for the whole block in SoA scratch.  Each stage is dispatched once per block
+// rather than once per vector, and a gather-heavy stage like clut_A2B has many independent
+// lookups in flight at once.
+static constexpr int kBlockVectors = 256 / N;
+
+static void exec_blocks(const Op* program, const void** contexts, ptrdiff_t programSize,
+                        const char* src, char* dst, int i, int vectors) {
+    F r[kBlockVectors], g[kBlockVectors], b[kBlockVectors], a[kBlockVectors];
+
+    while (vectors > 0) {
+        const int K = vectors < kBlockVectors ? vectors : kBlockVectors;
+        for (int v = 0; v < K; ++v) {
+            r[v] = g[v] = b[v] = F0;
+            a[v] = F1;
+        }
+
+        for (ptrdiff_t index = 0; index < programSize; ++index) {
+            const void* ctx = contexts[index];
+
+            // Callbacks see the whole block at once, each channel as K*N contiguous floats.
+            if (program[index] == Op::callback) {
+                const CallbackCtx* cb = (const CallbackCtx*)ctx;
+                cb->fn((float*)(void*)r, (float*)(void*)g,
+                       (float*)(void*)b, (float*)(void*)a, K*N, cb->arg);
+                continue;
+            }
+
+            switch (program[index]) {
+#define M(name) case Op::name:                                                       \
+                    for (int v = 0; v < K; ++v) {                                    \
+                        Exec_##name##_k(Ctx{ctx}, src, dst, r[v], g[v], b[v], a[v],  \
+                                        i + v*N);                                    \
+                    } break;
+                SKCMS_WORK_OPS(M)
+                SKCMS_STORE_OPS(M)
+#undef M
+            }
+        }
+        i       += K*N;
+        vectors -= K;
+    }
+}
+
+// Which programs run in blocks?  Those with a CLUT, whose gathers gain the most from overlapping,
+// and those with a callback, which would rather see more than N pixels at a time.  Without tail
+// calls, so do programs of kBlockMinOps or more: computed goto and the switch loop dispatch each
+// stage once per vector, and blocks cut that to once per block.  (Tail-calling stages keep
+// r,g,b,a in registers from one stage to the next, which blocks would lose.)  Shorter programs,
+// like the usual matrix-and-curves transform, stay in exec_stages().
+// SKCMS_FORCE_BLOCKS and SKCMS_DISABLE_BLOCKS override this, mostly to compare the two.
+SI bool use_blocks(SKCMS_MAYBE_UNUSED const Op* program, SKCMS_MAYBE_UNUSED ptrdiff_t programSize) {
+#if defined(SKCMS_FORCE_BLOCKS)
+    return true;
+#elif defined(SKCMS_DISABLE_BLOCKS)
+    return false;
+#else
+#if !SKCMS_HAS_MUSTTAIL
+    constexpr ptrdiff_t kBlockMinOps = 8;
+    if (programSize >= kBlockMinOps) {
+        return true;
+    }
+#endif
+    for (ptrdiff_t index = 0; index < programSize; ++index) {
+        if (program[index] == Op::clut_A2B || program[index] == Op::clut_B2A ||
+                program[index] == Op::callback) {
+            return true;
+        }
+    }
+    return false;
+#endif
+}
+
 // NOLINTNEXTLINE(misc-definitions-in-headers)
 void run_program(const Op* program, const void** contexts, SKCMS_MAYBE_UNUSED ptrdiff_t programSize,
                  const char* src, char* dst, int n,
                  const size_t src_bpp, const size_t dst_bpp) {
 #if SKCMS_HAS_MUSTTAIL
     // Convert the program into an array of tailcall stages.
-    StageFn stages[32];
+    StageFn stages[kMaxOps];
     assert(programSize <= ARRAY_COUNT(stages));
 
     static constexpr StageFn kStageFns[] = {
@@ -1520,22 +1903,152 @@ void run_program(const Op* program, const void** contexts, SKCMS_MAYBE_UNUSED pt
     for (ptrdiff_t index = 0; index < programSize; ++index) {
         stages[index] = kStageFns[(int)program[index]];
     }
-#else
+#elif !SKCMS_HAS_COMPUTED_GOTO
     // Use the op array as-is.
     const Op* stages = program;
 #endif
 
     int i = 0;
+    if (n >= N && use_blocks(program, programSize)) {
+        exec_blocks(program, contexts, programSize, src, dst, i, n / N);
+        i += n / N * N;
+        n %= N;
+    }
+#if SKCMS_HAS_COMPUTED_GOTO
+    // exec_stages() loops over the blocks itself, so it converts the program only once.
+    exec_stages(program, contexts, programSize, src, dst, i, n / N);
+    i += n / N * N;
+    n %= N;
+#else
     while (n >= N) {
         exec_stages(stages, contexts, src, dst, i);
         i += N;
         n -= N;
     }
+#endif
     if (n > 0) {
         char tmp[4*4*N] = {0};
 
         memcpy(tmp, (const char*)src + (size_t)i*src_bpp, (size_t)n*src_bpp);
+#if SKCMS_HAS_COMPUTED_GOTO
+        exec_stages(program, contexts, programSize, tmp, tmp, 0, 1);
+#else
         exec_stages(stages, contexts, tmp, tmp, 0);
+#endif
         memcpy((char*)dst + (size_t)i*dst_bpp, tmp, (size_t)n*dst_bpp);
     }
 }
+
+// ~~~~ Curve fitting ~~~~
+//
+// skcms_ApproximateCurve() spends nearly all its time evaluating the same few expressions at
+// every entry of a table.  These kernels mirror log2f_(), exp2f_(), powf_(), eval_curve() and
+// skcms_TransferFunction_eval() from skcms.cc operation for operation, so each lane gets exactly
+// the scalar result.  (That's why they don't use approx_pow() and friends, which differ at the
+// edges.)  The callers do any reductions, in the scalar order.
+
+SI F fit_exp2f(F x) {
+    // Clamp x to keep floor_() in range; lanes this changes are overwritten below anyway.
+    F xc = min_(max_(x, F() - 127.0f), F() + 128.0f);
+    F fract = xc - floor_(xc);
+
+    F fbits = (1.0f * (1<<23)) * (xc + 121.274057500f
+                                     -   1.490129070f*fract
+                                     +  27.728023300f/(4.84252568f - fract));
+
+    // 2147483520 is the largest float less than INT_MAX.
+    F v = bit_pun<F>(cast<I32>(min_(max_(fbits, F0), F() + 2147483520.0f)));
+    v = if_then_else(fbits < 0                , F0             , v);
+    v = if_then_else(fbits >= (float)INT_MAX  , F() + INFINITY_, v);
+    v = if_then_else(x < -127.0f              , F0             , v);
+    v = if_then_else(x > 128.0f               , F() + INFINITY_, v);
+    return v;
+}
+
+// powf_(x,y), given log2_x = approx_log2(x).
+SI F fit_powf(F x, F log2_x, float y) {
+    return if_then_else(x <= 0, F0
+                              , if_then_else(x == 1, F1, fit_exp2f(log2_x * y)));
+}
+SI F fit_powf(F x, float y) {
+    return fit_powf(x, approx_log2(x), y);
+}
+
+SI F fit_eval_srgbish(const skcms_TransferFunction* tf, F x) {
+    F sign = if_then_else(x < 0, F() - 1.0f, F1);
+    x = x * sign;
+    return sign * if_then_else(x < tf->d,         tf->c * x + tf->f
+                                        , fit_powf(tf->a * x + tf->b, tf->g) + tf->e);
+}
+
+// Call fn(i, vals) for each block of N indices i (as floats) starting at i0,
+// copying the first n of all the values it writes to vals[k] to out[k] + i - i0.
+template <int kOuts, typename Fn>
+SI void fit_blocks(int i0, int n, float* out[kOuts], Fn&& fn) {
+    for (int i = i0; i < i0 + n; i += N) {
+        float ix[N];
+        for (int k = 0; k < N; k++) {
+            ix[k] = (float)(i + k);
+        }
+
+        F vals[kOuts];
+        fn(load<F>(ix), vals);
+
+        const int lanes = i0 + n - i < N ? i0 + n - i : N;
+        for (int o = 0; o < kOuts; o++) {
+            memcpy(out[o] + (i - i0), &vals[o], sizeof(float) * (size_t)lanes);
+        }
+    }
+}
+
+// NOLINTNEXTLINE(misc-definitions-in-headers)
+void roundtrip_errors(const skcms_Curve* curve, const skcms_TransferFunction* tf_inv,
+                      float dx, int i0, int n, float* err) {
+    float* out[] = { err };
+    fit_blocks<1>(i0, n, out, [&](F i, F* vals) {
+        F x = i * dx,
+          y = table(curve, x),
+          d = x - fit_eval_srgbish(tf_inv, y);
+        vals[0] = if_then_else(d < 0, -d, d);
+    });
+}
+
+// NOLINTNEXTLINE(misc-definitions-in-headers)
+void rg_nonlinear(const skcms_Curve* curve, const skcms_TransferFunction* tf,
+                  float x0, float dx, int i0, int n,
+                  float* resid, float* dfdg, float* dfda, float* dfdb) {
+    const float g = tf->g, a = tf->a, b = tf->b,
+                c = tf->c, d = tf->d, f = tf->f;
+
+    // These are the same for every x, but we keep them as vectors to use the same math.
+    const F D = F() + (a*d + b),
+            log_D      = approx_log(D),
+            pow_D_g    = fit_powf(D, g),
+            pow_D_g_m1 = fit_powf(D, g-1);
+
+    float* out[] = { resid, dfdg, dfda, dfdb };
+    fit_blocks<4>(i0, n, out, [&](F i, F* vals) {
+        F x = x0 + i*dx,
+          y = table(curve, x),
+          v = a*y + b,
+          Y = if_then_else(v > 0, v, F0);
+
+        const F log2_Y = approx_log2(Y),
+                pow_Y_g    = fit_powf(Y, log2_Y, g),
+                pow_Y_g_m1 = fit_powf(Y, log2_Y, g-1);
+
+        // The residual.
+        F f_inv = pow_Y_g
+                - pow_D_g
+                + c*d + f;
+        vals[0] = x - f_inv;
+
+        // The gradient.
+        vals[1] = (0.69314718f * log2_Y)*pow_Y_g  // i.e. approx_log(Y)*pow_Y_g
+                - log_D*pow_D_g;
+        vals[2] = y*g*pow_Y_g_m1
+                - d*g*pow_D_g_m1;
+        vals[3] =   g*pow_Y_g_m1
+                -   g*pow_D_g_m1;
+    });
+}
@@ -10,6 +10,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+union  skcms_Curve;
+struct skcms_TransferFunction;
+
 // skcms_Transform.h contains skcms implementation details.
 // Please don't use this header from outside the skcms repo.
 
@@ -17,6 +20,40 @@ namespace skcms_private {
 
 /** All transform ops */
 
+// The parametric curve ops come in one set per Precision, chosen when the program is built:
+// gamma_r at the default precision and gamma_r_precise.  Both sets are laid out alike, so an
+// op's variants are a fixed distance apart.
+#define SKCMS_CURVE_OPS(M, P) \
+    M(gamma_r##P)         \
+    M(gamma_g##P)         \
+    M(gamma_b##P)         \
+    M(gamma_a##P)         \
+    M(gamma_rgb##P)       \
+                          \
+    M(tf_r##P)            \
+    M(tf_g##P)            \
+    M(tf_b##P)            \
+    M(tf_a##P)            \
+    M(tf_rgb##P)          \
+                          \
+    M(pq_r##P)            \
+    M(pq_g##P)            \
+    M(pq_b##P)            \
+    M(pq_a##P)            \
+    M(pq_rgb##P)          \
+                          \
+    M(hlg_r##P)           \
+    M(hlg_g##P)           \
+    M(hlg_b##P)           \
+    M(hlg_a##P)           \
+    M(hlg_rgb##P)         \
+                          \
+    M(hlginv_r##P)        \
+    M(hlginv_g##P)        \
+    M(hlginv_b##P)        \
+    M(hlginv_a##P)        \
+    M(hlginv_rgb##P)
+
 #define SKCMS_WORK_OPS(M) \
     M(load_a8)            \
     M(load_g8)            \
@@ -35,6 +72,12 @@ namespace skcms_private {
     M(load_hhhh)          \
     M(load_fff)           \
     M(load_ffff)          \
+    M(load_planar_8)      \
+    M(load_planar_10)     \
+    M(load_planar_16)     \
+    M(load_planar_h)      \
+    M(load_planar_f)      \
+    M(load_yuv)           \
                           \
     M(swap_rb)            \
     M(clamp)              \
@@ -48,35 +91,14 @@ namespace skcms_private {
     M(lab_to_xyz)         \
     M(xyz_to_lab)         \
                           \
-    M(gamma_r)            \
-    M(gamma_g)            \
-    M(gamma_b)            \
-    M(gamma_a)            \
-    M(gamma_rgb)          \
-                          \
-    M(tf_r)               \
-    M(tf_g)               \
-    M(tf_b)               \
-    M(tf_a)               \
-    M(tf_rgb)             \
-                          \
-    M(pq_r)               \
-    M(pq_g)               \
-    M(pq_b)               \
-    M(pq_a)               \
-    M(pq_rgb)             \
+    SKCMS_CURVE_OPS(M, )          \
+    SKCMS_CURVE_OPS(M, _precise)  \
                           \
-    M(hlg_r)              \
-    M(hlg_g)              \
-    M(hlg_b)              \
-    M(hlg_a)              \
-    M(hlg_rgb)            \
-                          \
-    M(hlginv_r)           \
-    M(hlginv_g)           \
-    M(hlginv_b)           \
-    M(hlginv_a)           \
-    M(hlginv_rgb)         \
+    M(tonemap_bt2390)     \
+    M(tonemap_reinhard)   \
+    M(gamut_map)          \
+    M(dither)             \
+    M(callback)           \
                           \
     M(table_r)            \
     M(table_g)            \
@@ -102,7 +124,12 @@ namespace skcms_private {
     M(store_hhh)           \
     M(store_hhhh)          \
     M(store_fff)           \
-    M(store_ffff)
+    M(store_ffff)          \
+    M(store_planar_8)      \
+    M(store_planar_10)     \
+    M(store_planar_16)     \
+    M(store_planar_h)      \
+    M(store_planar_f)
 
 enum class Op : int {
 #define M(op) op,
@@ -111,6 +138,88 @@ enum class Op : int {
 #undef M
 };
 
+// The most ops a program may hold, counting any appended with skcms_TransformBuilder.
+static constexpr int kMaxOps = 64;
+
+/** Stage contexts */
+
+// How accurately curve stages evaluate log2() and exp2().  skcms_Precision_Fast uses the
+// default math; it differs only in which backends may run the program.
+enum class Precision : int { Default, Precise };
+
+// The gamma, tf, and pq ops take a copy of their skcms_TransferFunction.
+struct PreparedTF {
+    float g, a, b, c, d, e, f;
+};
+
+// The hlg and hlginv ops take an HLGish or HLGinvish transfer function with the
+// constants their stages need derived once by prepare_hlg(), not for every batch of pixels.
+struct PreparedHLG {
+    float R, G, b, c;
+    float K, inv_K;
+    float a_log2e,   // For hlg,    exp((x-c)*a) == exp2(x*a_log2e - ac_log2e).
+          ac_log2e;
+    float a_ln2;     // For hlginv, a*ln(y)      == a_ln2*log2(y).
+};
+
+// The tonemap ops compress max(r,g,b) of linear HDR source RGB into SDR range, scaling r,g,b
+// alike.  prepare_tone_map() derives these once from the skcms_ToneMap and the source profile.
+struct ToneMapCtx {
+    float in_scale,      // Source linear to the curve's input: PQ's [0,1] or units of SDR white.
+          out_scale;     // The curve's output to destination linear, 1 being SDR white.
+    float inv_peak2;     // Reinhard: 1 / (source peak in units of SDR white)^2.
+    float pq_peak,       // BT.2390: the source peak, PQ encoded,
+          inv_pq_peak,   //          its reciprocal,
+          max_lum,       //          the target peak relative to it,
+          ks,            //          where the knee starts,
+          inv_1_ks;      //          and 1/(1-ks), or 0 when there's no knee.
+};
+
+// gamut_map desaturates linear destination RGB toward gray of the same luminance, w.r + w.g + w.b,
+// leaving colors less than knee of the way out to the gamut boundary alone, easing the rest in,
+// and landing those at or past it on the boundary.  A knee of 1 just desaturates what's outside.
+struct GamutMapCtx {
+    float wr, wg, wb;
+    float knee;
+};
+
+// dither offsets r,g,b by a threshold from a tile of ranks, at most half a step of the store's
+// quantization either way, and clamps them back to [0,1], or to [0,a] for premultiplied stores.
+// Pixel i of each run is at x0+i in row y.
+struct DitherCtx {
+    const uint8_t* ranks;           // A size x size tile, holding 0 through size*size-1.
+    int            size_log2;
+    int            channel_offset;  // Channel c's tile is shifted by c*channel_offset both ways.
+    int            x0, y;
+    float          step[3];         // 1 / (the store's levels - 1), for r,g,b.
+    bool           premul;          // Are r,g,b premultiplied by a?
+};
+
+// callback hands n pixels of r,g,b,a, each as n separate floats, to a function to modify.
+struct CallbackCtx {
+    void (*fn)(float* r, float* g, float* b, float* a, int n, void* arg);
+    void* arg;
+};
+
+// The planar load and store ops take their planes, R,G,B,A (or C,M,Y,K), indexed by pixel.
+// A null alpha plane loads as opaque and is not stored.
+struct LoadPlanesCtx  { const char* plane[4]; };
+struct StorePlanesCtx {       char* plane[4]; };
+
+// load_yuv takes one row of a subsampled YCbCr image at a time, loading Y,Cb,Cr into r,g,b.
+// Lanes past width repeat the row's last pixel.
+struct YUVRowCtx {
+    const char* y;
+    const char* cb[2];      // Two rows of chroma, blended as row[0]*(1-t) + row[1]*t.
+    const char* cr[2];
+    float       t;
+    int         width, chroma_width;
+    int         chroma_step;  // In samples: 1 for separate Cb and Cr planes, 2 for interleaved.
+    int         bytes;        // Per sample, 1 or 2.
+    float       scale;        // From samples to [0,1].
+    bool        bilinear;     // Average neighboring chroma columns for odd pixels?
+};
+
 /** Constants */
 
 #if defined(__clang__) || defined(__GNUC__)
@@ -144,6 +253,14 @@ void run_program(const Op* program, const void** contexts, ptrdiff_t programSize
                  const char* src, char* dst, int n,
                  const size_t src_bpp, const size_t dst_bpp);
 
+// skcms_ApproximateCurve()'s curve-fitting kernels, described in Transform_inl.h.
+// Each writes n values, for indices i0 through i0+n-1.
+void roundtrip_errors(const skcms_Curve* curve, const skcms_TransferFunction* tf_inv,
+                      float dx, int i0, int n, float* err);
+void rg_nonlinear(const skcms_Curve* curve, const skcms_TransferFunction* tf,
+                  float x0, float dx, int i0, int n,
+                  float* resid, float* dfdg, float* dfda, float* dfdb);
+
 }
 namespace hsw {
 
@@ -151,6 +268,12 @@ void run_program(const Op* program, const void** contexts, ptrdiff_t programSize
                  const char* src, char* dst, int n,
                  const size_t src_bpp, const size_t dst_bpp);
 
+void roundtrip_errors(const skcms_Curve* curve, const skcms_TransferFunction* tf_inv,
+                      float dx, int i0, int n, float* err);
+void rg_nonlinear(const skcms_Curve* curve, const skcms_TransferFunction* tf,
+                  float x0, float dx, int i0, int n,
+                  float* resid, float* dfdg, float* dfda, float* dfdb);
+
 }
 namespace skx {
 
@@ -158,5 +281,32 @@ void run_program(const Op* program, const void** contexts, ptrdiff_t programSize
                  const char* src, char* dst, int n,
                  const size_t src_bpp, const size_t dst_bpp);
 
+void roundtrip_errors(const skcms_Curve* curve, const skcms_TransferFunction* tf_inv,
+                      float dx, int i0, int n, float* err);
+void rg_nonlinear(const skcms_Curve* curve, const skcms_TransferFunction* tf,
+                  float x0, float dx, int i0, int n,
+                  float* resid, float* dfdg, float* dfda, float* dfdb);
+
+}
+namespace f16 {
+
+// The half-float pipeline, for a subset of ops.  Returns false, having done nothing,
+// if the program uses any other op or this pipeline was not compiled in.
+bool run_program(const Op* program, const void** contexts, ptrdiff_t programSize,
+                 const char* src, char* dst, int n,
+                 const size_t src_bpp, const size_t dst_bpp);
+
+}
+namespace jit {
+
+// The program compiled to straight-line AVX2 or AVX-512 code, for a subset of ops on x86-64
+// Linux.  Returns false, having done nothing, if the program uses any other op, its code can't
+// be made executable, or the JIT was not compiled in.  The caller checks the CPU has AVX2,
+// and AVX-512 if it asks for that.
+bool run_program(const Op* program, const void** contexts, ptrdiff_t programSize,
+                 const char* src, char* dst, int n,
+                 const size_t src_bpp, const size_t dst_bpp,
+                 bool avx512);
+
 }
 }  // namespace skcms_private
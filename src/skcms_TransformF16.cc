@@ -0,0 +1,339 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "skcms_public.h"     // NO_G3_REWRITE
+#include "skcms_internals.h"  // NO_G3_REWRITE
+#include "skcms_Transform.h"  // NO_G3_REWRITE
+#include <string.h>
+
+// This is a half-float flavor of the transform pipeline in Transform_inl.h, for the ops common
+// to 8- and 10-bit transforms.  Each vector holds twice as many lanes as it would with float.
+//
+// It's built with -mavx512fp16 where the host has it, and otherwise with plain x86-64 flags,
+// where the compiler emulates _Float16 math in software.  (That's far too slow to be worth it,
+// but lets us test this pipeline on any x86 machine; see ninja/gcc.f16emu.)
+//
+// skcms_TransformWithPrecision() decides whether to use it, comparing its results to the
+// float pipeline's first.
+
+namespace skcms_private {
+namespace f16 {
+
+#if defined(SKCMS_DISABLE_F16) || !defined(__FLT16_MAX__) || \
+    !(defined(__clang__) || defined(__GNUC__))
+
+bool run_program(const Op*, const void**, ptrdiff_t, const char*, char*, int, size_t, size_t) {
+    return false;
+}
+
+#else
+
+// Our helpers pass around vectors wider than the registers of any build without AVX-512,
+// so we stifle warnings about that, and always inline them, as in Transform_inl.h.
+#if defined(__SSE__) && defined(__GNUC__)
+    #if !defined(__has_warning)
+        #pragma GCC diagnostic ignored "-Wpsabi"
+    #elif __has_warning("-Wpsabi")
+        #pragma GCC diagnostic ignored "-Wpsabi"
+    #endif
+#endif
+#define SI static inline __attribute__((always_inline))
+
+#define N 32
+
+using H   = Vec<N,_Float16>;
+using I16 = Vec<N,int16_t>;
+using U16 = Vec<N,uint16_t>;
+using U32 = Vec<N,uint32_t>;
+
+template <typename D, typename S>
+SI D cast(const S& v) { return __builtin_convertvector(v, D); }
+
+template <typename D, typename S>
+SI D bit_pun(const S& v) {
+    static_assert(sizeof(D) == sizeof(S), "");
+    D d;
+    memcpy(&d, &v, sizeof(D));
+    return d;
+}
+
+SI H splat(float v) { return H() + (_Float16)v; }
+
+SI H if_then_else(I16 cond, H t, H e) {
+    return bit_pun<H>( ( cond & bit_pun<I16>(t)) |
+                       (~cond & bit_pun<I16>(e)) );
+}
+
+SI H min_(H x, H y) { return if_then_else(y < x, y, x); }
+SI H max_(H x, H y) { return if_then_else(x < y, y, x); }
+
+// Like the float pipeline's approx_log2(), but splitting the exponent off as an integer,
+// because half floats can't hold the raw bits as a value precisely enough.  x must be > 0.
+SI H log2_(H x) {
+    // Lift subnormals into the normal range; they turn up on the linear side of curves.
+    I16 sub = x < splat(1.0f/16384);
+    x = if_then_else(sub, x * splat(1024), x);
+
+    U16 bits = bit_pun<U16>(x);
+    H e = cast<H>(cast<I16>(bits >> 10) - 15) - if_then_else(sub, splat(10), H()),
+      t = bit_pun<H>((U16)((bits & 0x03ff) | 0x3c00)) - splat(1);
+
+    // log2(1+t) for t in [0,1), with p(0) == 0 and p(1) == 1 exactly.
+    return e + t*(splat(+1.43872255f) + t*(splat(-0.67776985f) +
+                  t*(splat(+0.32117040f) + t*splat(-0.08212310f))));
+}
+
+SI H exp2_(H x) {
+    // Below 2^-24 there are no more half floats, and above 2^15 only infinity.
+    x = max_(splat(-24), min_(x, splat(15)));
+
+    H fl = cast<H>(cast<I16>(x));  // Truncates toward zero...
+    fl = if_then_else(x < fl, fl - splat(1), fl);  // ...so step down for negative x.
+    H t = x - fl;
+
+    // 2^t for t in [0,1), with p(0) == 1 and p(1) == 2 exactly.
+    H p = splat(1) + t*(splat(0.69589073f) + t*(splat(0.22486406f) + t*splat(0.07924521f)));
+
+    // Scale by 2^fl, a normal half float down to 2^-14 and subnormal below that.
+    I16 n = cast<I16>(fl);
+    U16 normal    = (U16)((n + 15) << 10),
+        subnormal = (U16)((I16() + 1) << ((n + 24) & 15));
+    return p * if_then_else(n < -14, bit_pun<H>(subnormal), bit_pun<H>(normal));
+}
+
+SI H pow_(H x, _Float16 y) {
+    return if_then_else(x > H(), exp2_(log2_(x) * y), H());
+}
+
+// A PreparedTF, converted to half floats once per run_program() call.
+struct HalfTF { _Float16 g, a, b, c, d, e, f; };
+
+// Peel off the sign bit as in the float pipeline's apply_tf() and apply_gamma().
+SI H apply_tf(const HalfTF& tf, H x) {
+    U16 sign = bit_pun<U16>(x) & 0x8000;
+    x = bit_pun<H>(bit_pun<U16>(x) ^ sign);
+
+    H v = if_then_else(x < tf.d, tf.c*x + tf.f
+                               , pow_(tf.a*x + tf.b, tf.g) + tf.e);
+    return bit_pun<H>(bit_pun<U16>(v) | sign);
+}
+
+SI H apply_gamma(const HalfTF& tf, H x) {
+    U16 sign = bit_pun<U16>(x) & 0x8000;
+    x = bit_pun<H>(bit_pun<U16>(x) ^ sign);
+    return bit_pun<H>(bit_pun<U16>(pow_(x, tf.g)) | sign);
+}
+
+// Round to the nearest integer in [0,scale], sending NaN to 0.
+SI U32 to_fixed(H v, float scale) {
+    v = if_then_else(v > H(), v, H());
+    v = min_(v, splat(1));
+    return cast<U32>(cast<U16>(v * splat(scale) + splat(0.5f)));
+}
+
+// The constants each op needs, converted from the float pipeline's contexts.
+union Consts {
+    HalfTF   tf;
+    _Float16 m[9];
+};
+
+static bool supported(Op op) {
+    switch (op) {
+        case Op::load_888:
+        case Op::load_8888:
+        case Op::load_1010102:
+        case Op::swap_rb:
+        case Op::clamp:
+        case Op::force_opaque:
+        case Op::premul:
+        case Op::unpremul:
+        case Op::matrix_3x3:
+        case Op::gamma_r: case Op::gamma_g: case Op::gamma_b: case Op::gamma_a:
+        case Op::gamma_rgb:
+        case Op::tf_r: case Op::tf_g: case Op::tf_b: case Op::tf_a:
+        case Op::tf_rgb:
+        case Op::store_888:
+        case Op::store_8888:
+        case Op::store_1010102:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Runs N pixels from src to dst.
+static void exec_ops(const Op* ops, const Consts* consts, const char* src, char* dst) {
+    H r = H(), g = H(), b = H(), a = splat(1);
+    while (true) {
+        const Consts& k = *consts++;
+        switch (*ops++) {
+            case Op::load_888: {
+                U16 R, G, B;
+                for (int j = 0; j < N; j++) {
+                    R[j] = (uint8_t)src[3*j+0];
+                    G[j] = (uint8_t)src[3*j+1];
+                    B[j] = (uint8_t)src[3*j+2];
+                }
+                r = cast<H>(R) * splat(1/255.0f);
+                g = cast<H>(G) * splat(1/255.0f);
+                b = cast<H>(B) * splat(1/255.0f);
+            } break;
+
+            // Narrowing to U16 first lets the conversions to half floats stay vectorized.
+            case Op::load_8888: {
+                U32 rgba;
+                memcpy(&rgba, src, sizeof(rgba));
+                r = cast<H>(cast<U16>((rgba >>  0) & 0xff)) * splat(1/255.0f);
+                g = cast<H>(cast<U16>((rgba >>  8) & 0xff)) * splat(1/255.0f);
+                b = cast<H>(cast<U16>((rgba >> 16) & 0xff)) * splat(1/255.0f);
+                a = cast<H>(cast<U16>((rgba >> 24) & 0xff)) * splat(1/255.0f);
+            } break;
+
+            case Op::load_1010102: {
+                U32 rgba;
+                memcpy(&rgba, src, sizeof(rgba));
+                r = cast<H>(cast<U16>((rgba >>  0) & 0x3ff)) * splat(1/1023.0f);
+                g = cast<H>(cast<U16>((rgba >> 10) & 0x3ff)) * splat(1/1023.0f);
+                b = cast<H>(cast<U16>((rgba >> 20) & 0x3ff)) * splat(1/1023.0f);
+                a = cast<H>(cast<U16>((rgba >> 30) & 0x3  )) * splat(1/   3.0f);
+            } break;
+
+            case Op::swap_rb: { H t = r; r = b; b = t; } break;
+
+            case Op::clamp:
+                r = max_(H(), min_(r, splat(1)));
+                g = max_(H(), min_(g, splat(1)));
+                b = max_(H(), min_(b, splat(1)));
+                a = max_(H(), min_(a, splat(1)));
+                break;
+
+            case Op::force_opaque: a = splat(1); break;
+
+            case Op::premul:
+                r *= a;
+                g *= a;
+                b *= a;
+                break;
+
+            case Op::unpremul: {
+                H inv = splat(1) / a,
+                  scale = if_then_else(inv < splat(65504), inv, H());
+                r *= scale;
+                g *= scale;
+                b *= scale;
+            } break;
+
+            case Op::matrix_3x3: {
+                const _Float16* m = k.m;
+                H R = m[0]*r + m[1]*g + m[2]*b,
+                  G = m[3]*r + m[4]*g + m[5]*b,
+                  B = m[6]*r + m[7]*g + m[8]*b;
+                r = R;
+                g = G;
+                b = B;
+            } break;
+
+            case Op::gamma_r: r = apply_gamma(k.tf, r); break;
+            case Op::gamma_g: g = apply_gamma(k.tf, g); break;
+            case Op::gamma_b: b = apply_gamma(k.tf, b); break;
+            case Op::gamma_a: a = apply_gamma(k.tf, a); break;
+            case Op::gamma_rgb:
+                r = apply_gamma(k.tf, r);
+                g = apply_gamma(k.tf, g);
+                b = apply_gamma(k.tf, b);
+                break;
+
+            case Op::tf_r: r = apply_tf(k.tf, r); break;
+            case Op::tf_g: g = apply_tf(k.tf, g); break;
+            case Op::tf_b: b = apply_tf(k.tf, b); break;
+            case Op::tf_a: a = apply_tf(k.tf, a); break;
+            case Op::tf_rgb:
+                r = apply_tf(k.tf, r);
+                g = apply_tf(k.tf, g);
+                b = apply_tf(k.tf, b);
+                break;
+
+            case Op::store_888: {
+                U32 R = to_fixed(r, 255),
+                    G = to_fixed(g, 255),
+                    B = to_fixed(b, 255);
+                for (int j = 0; j < N; j++) {
+                    dst[3*j+0] = (char)R[j];
+                    dst[3*j+1] = (char)G[j];
+                    dst[3*j+2] = (char)B[j];
+                }
+            } return;
+
+            case Op::store_8888: {
+                U32 rgba = to_fixed(r, 255) <<  0
+                         | to_fixed(g, 255) <<  8
+                         | to_fixed(b, 255) << 16
+                         | to_fixed(a, 255) << 24;
+                memcpy(dst, &rgba, sizeof(rgba));
+            } return;
+
+            case Op::store_1010102: {
+                U32 rgba = to_fixed(r, 1023) <<  0
+                         | to_fixed(g, 1023) << 10
+                         | to_fixed(b, 1023) << 20
+                         | to_fixed(a,    3) << 30;
+                memcpy(dst, &rgba, sizeof(rgba));
+            } return;
+
+            default: return;  // Unreachable; run_program() checks supported().
+        }
+    }
+}
+
+bool run_program(const Op* program, const void** contexts, ptrdiff_t programSize,
+                 const char* src, char* dst, int n,
+                 const size_t src_bpp, const size_t dst_bpp) {
+    Consts consts[32];
+    if (programSize > ARRAY_COUNT(consts)) {
+        return false;
+    }
+    for (ptrdiff_t i = 0; i < programSize; i++) {
+        const Op op = program[i];
+        if (!supported(op)) {
+            return false;
+        }
+        if (op == Op::matrix_3x3) {
+            const float* m = &((const skcms_Matrix3x3*)*contexts++)->vals[0][0];
+            for (int j = 0; j < 9; j++) {
+                consts[i].m[j] = (_Float16)m[j];
+            }
+        } else if ((op >= Op::gamma_r && op <= Op::gamma_rgb) ||
+                   (op >= Op::tf_r    && op <= Op::tf_rgb)) {
+            const PreparedTF* tf = (const PreparedTF*)*contexts++;
+            consts[i].tf = { (_Float16)tf->g, (_Float16)tf->a, (_Float16)tf->b,
+                             (_Float16)tf->c, (_Float16)tf->d, (_Float16)tf->e,
+                             (_Float16)tf->f };
+        } else {
+            contexts++;
+        }
+    }
+
+    int i = 0;
+    while (n >= N) {
+        exec_ops(program, consts, src + (size_t)i*src_bpp, dst + (size_t)i*dst_bpp);
+        i += N;
+        n -= N;
+    }
+    if (n > 0) {
+        char tmp[4*N] = {0};
+
+        memcpy(tmp, src + (size_t)i*src_bpp, (size_t)n*src_bpp);
+        exec_ops(program, consts, tmp, tmp);
+        memcpy(dst + (size_t)i*dst_bpp, tmp, (size_t)n*dst_bpp);
+    }
+    return true;
+}
+
+#endif
+
+}  // namespace f16
+}  // namespace skcms_private
@@ -0,0 +1,801 @@
+/*
+ * Copyright 2018 Google LLC
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "skcms_public.h"     // NO_G3_REWRITE
+#include "skcms_internals.h"  // NO_G3_REWRITE
+#include "skcms_Transform.h"  // NO_G3_REWRITE
+#include <string.h>
+
+// This compiles transform programs made of the ops common to 8- and 10-bit transforms into
+// one loop over 8 (AVX2) or 16 (AVX-512) pixels at a time.  r,g,b,a stay in registers from
+// load to store, and each op's context (matrices, transfer functions) is baked into the code
+// as constants.  The math follows Transform_inl.h instruction for instruction, so results
+// match the interpreter's exactly.
+//
+// Code is written while its pages are read+write, and only made executable (and no longer
+// writable) before it first runs.  Each distinct program gets its own pages, cached for the
+// life of the process, and so are failures: programs that don't fit, and a system that won't
+// let us make pages executable at all.
+
+// Like HSW and SKX, we leave the JIT out of Android.
+#if defined(SKCMS_DISABLE_JIT) || defined(SKCMS_PORTABLE) || !defined(__x86_64__) || \
+    !defined(__linux__) || defined(ANDROID) || defined(__ANDROID__) ||              \
+    !(defined(__clang__) || defined(__GNUC__))
+    #define SKCMS_JIT 0
+#else
+    #define SKCMS_JIT 1
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+namespace skcms_private {
+namespace jit {
+
+#if !SKCMS_JIT
+
+bool run_program(const Op*, const void**, ptrdiff_t, const char*, char*, int, size_t, size_t,
+                 bool) {
+    return false;
+}
+
+#else
+
+static const int kMaxLanes  = 16,
+                 kMaxCode   = 16384,
+                 kMaxConsts = 128,
+                 kMaxFixups = 1024,
+                 kMaxKey    = 32 * 13 + 1,  // Each op, its context's floats, and avx512.
+                 kCacheSize = 32;
+
+// The compiled loop runs blocks of 8 or 16 pixels, advancing src and dst as it goes.
+typedef void (*Fn)(const char* src, char* dst, size_t blocks);
+
+// The r/m operand of an instruction: a register, the pixels at src or dst, or a constant.
+struct RM {
+    enum Kind { Reg, Src, Dst, Const } kind;
+    int val;  // The register, or the constant's index in the pool.
+};
+
+// AVX, AVX2, and AVX-512 instructions, by prefix, opcode map, and opcode.
+// Those with AVX-512 forms share their opcodes, encoded with EVEX instead of VEX.
+struct Inst { int pp, map, op; };
+
+static const Inst MOVUPS_LOAD  = {0, 1, 0x10},
+                  MOVUPS_STORE = {0, 1, 0x11},
+                  MOVAPS       = {0, 1, 0x28},
+                  KORW         = {0, 1, 0x45},  // VEX only.
+                  ANDPS        = {0, 1, 0x54},
+                  ORPS         = {0, 1, 0x56},
+                  XORPS        = {0, 1, 0x57},
+                  ADDPS        = {0, 1, 0x58},
+                  MULPS        = {0, 1, 0x59},
+                  CVTDQ2PS     = {0, 1, 0x5b},
+                  CVTTPS2DQ    = {2, 1, 0x5b},
+                  SUBPS        = {0, 1, 0x5c},
+                  MINPS        = {0, 1, 0x5d},
+                  DIVPS        = {0, 1, 0x5e},
+                  MAXPS        = {0, 1, 0x5f},
+                  PSHIFTD_IMM  = {1, 1, 0x72},  // ModRM.reg picks the shift: 2 right, 6 left.
+                  CMPPS        = {0, 1, 0xc2},
+                  PAND         = {1, 1, 0xdb},
+                  POR          = {1, 1, 0xeb},
+                  BLENDMPS     = {1, 2, 0x65},  // EVEX only.
+                  ROUNDPS      = {1, 3, 0x08},  // vrndscaleps with EVEX.
+                  BLENDVPS     = {1, 3, 0x4a};  // VEX only.
+
+static const int CMP_EQ = 0,
+                 CMP_LT = 1;
+
+static bool is_curve_op(Op op) {
+    switch (op) {
+        case Op::gamma_r: case Op::gamma_g: case Op::gamma_b: case Op::gamma_a:
+        case Op::gamma_rgb:
+        case Op::tf_r:    case Op::tf_g:    case Op::tf_b:    case Op::tf_a:
+        case Op::tf_rgb:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Can we compile this program?  It must load and store 8888 or 1010102 pixels, with only
+// the ops Compiler knows in between, and curves at the default precision.
+static bool supported(const Op* program, ptrdiff_t programSize) {
+    if (programSize < 2 || 1 + programSize * 13 > kMaxKey) {
+        return false;
+    }
+    if (program[0] != Op::load_8888 && program[0] != Op::load_1010102) {
+        return false;
+    }
+    const Op last = program[programSize-1];
+    if (last != Op::store_8888 && last != Op::store_1010102) {
+        return false;
+    }
+    for (ptrdiff_t i = 1; i < programSize-1; i++) {
+        switch (program[i]) {
+            case Op::swap_rb:
+            case Op::clamp:
+            case Op::invert:
+            case Op::force_opaque:
+            case Op::premul:
+            case Op::unpremul:
+            case Op::matrix_3x3:
+            case Op::matrix_3x4:
+                break;
+
+            default:
+                if (!is_curve_op(program[i])) {
+                    return false;
+                }
+        }
+    }
+    return true;
+}
+
+// Everything the compiled code depends on: the ops, the values in their contexts,
+// and which instruction set it's compiled for.  Returns its length.
+static int make_key(const Op* program, const void** contexts, ptrdiff_t programSize,
+                    bool avx512, uint32_t key[kMaxKey]) {
+    int len = 0;
+    key[len++] = avx512;
+    for (ptrdiff_t i = 0; i < programSize; i++) {
+        int floats = 0;
+        switch (program[i]) {
+            case Op::matrix_3x3: floats =  9; break;
+            case Op::matrix_3x4: floats = 12; break;
+            default: floats = is_curve_op(program[i]) ? 7 : 0;  // PreparedTF g,a,b,c,d,e,f
+        }
+        key[len++] = (uint32_t)program[i];
+        if (floats) {
+            memcpy(key + len, contexts[i], 4 * (size_t)floats);
+            len += floats;
+        }
+    }
+    return len;
+}
+
+// Fixups remember where each reference to the constant pool needs its displacement filled in.
+struct Fixup { uint16_t disp, end, konst; };
+static_assert(kMaxCode <= 0xffff && kMaxConsts <= 0xffff, "");
+
+class Compiler {
+public:
+    // Code goes to buf, which holds kMaxCode bytes followed by kMaxFixups Fixups for scratch.
+    Compiler(uint8_t* buf, bool avx512)
+        : fCode(buf)
+        , fFixups((Fixup*)(void*)(buf + kMaxCode))
+        , fWide(avx512) {}
+
+    // Compile a supported() program, returning the size of its code, or 0 if it didn't fit.
+    size_t compile(const Op* program, const void** contexts, ptrdiff_t programSize);
+
+private:
+    uint8_t*   fCode;
+    Fixup*     fFixups;
+    const bool fWide;             // AVX-512 zmm registers and k masks, or AVX2 ymm registers?
+    size_t     fLen   = 0;
+    bool       fOK    = true;
+    int        fFree  = 0xffff,   // Unused vector registers,
+               fFreeK = 0x00fe;   // and with AVX-512, mask registers.  (k0 masks nothing.)
+    int        fCh[4];            // Where r,g,b,a live.
+
+    uint32_t fConsts[kMaxConsts];
+    int      fNumConsts = 0;
+
+    int      fNumFixups = 0;
+
+    int lanes() const { return fWide ? 16 : 8; }
+
+    void byte(int b) {
+        if (fLen < (size_t)kMaxCode) {
+            fCode[fLen++] = (uint8_t)b;
+        } else {
+            fOK = false;
+        }
+    }
+    void u32(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            byte((int)(v >> (8*i) & 0xff));
+        }
+    }
+
+    // Emit the ModRM byte, displacement, and immediate for reg and rm.
+    void operands(int reg, RM rm, int imm) {
+        size_t disp = 0;
+        switch (rm.kind) {
+            case RM::Reg:   byte(0xc0 | (reg & 7) << 3 | (rm.val & 7)); break;
+            case RM::Src:   byte(0x00 | (reg & 7) << 3 | 7);            break;  // [rdi]
+            case RM::Dst:   byte(0x00 | (reg & 7) << 3 | 6);            break;  // [rsi]
+            case RM::Const: byte(0x05 | (reg & 7) << 3);                        // [rip+disp32]
+                            disp = fLen;
+                            u32(0);
+                            break;
+        }
+        if (imm >= 0) {
+            byte(imm);
+        }
+        if (rm.kind == RM::Const) {
+            if (fNumFixups == kMaxFixups) {
+                fOK = false;
+                return;
+            }
+            fFixups[fNumFixups++] = { (uint16_t)disp, (uint16_t)fLen, (uint16_t)rm.val };
+        }
+    }
+
+    // A 256-bit VEX instruction: reg, vvvv (0 when unused), and rm.
+    void vex(Inst inst, int reg, int vvvv, RM rm, int imm = -1) {
+        const int B = rm.kind == RM::Reg ? rm.val >> 3 : 0;
+        byte(0xc4);
+        byte((~reg >> 3 & 1) << 7 | 1 << 6 | (~B & 1) << 5 | inst.map);
+        byte((~vvvv & 15) << 3 | 1 << 2 | inst.pp);
+        byte(inst.op);
+        operands(reg, rm, imm);
+    }
+
+    // A 512-bit EVEX instruction, optionally under mask k, zeroing masked-off lanes or not.
+    void evex(Inst inst, int reg, int vvvv, RM rm, int imm = -1, int k = 0, bool zero = false) {
+        const int B = rm.kind == RM::Reg ? rm.val >> 3 : 0;
+        byte(0x62);
+        byte((~reg >> 3 & 1) << 7 | 1 << 6 | (~B & 1) << 5 | 1 << 4 | inst.map);
+        byte((~vvvv & 15) << 3 | 1 << 2 | inst.pp);
+        byte((zero ? 1 : 0) << 7 | 2 << 5 | 1 << 3 | k);
+        byte(inst.op);
+        operands(reg, rm, imm);
+    }
+
+    // Most instructions are encoded the same way for either register width.
+    void inst(Inst inst, int reg, int vvvv, RM rm, int imm = -1) {
+        if (fWide) {
+            this->evex(inst, reg, vvvv, rm, imm);
+        } else {
+            this->vex (inst, reg, vvvv, rm, imm);
+        }
+    }
+
+    static RM reg(int r) { return { RM::Reg, r }; }
+
+    RM k_bits(uint32_t bits) {
+        for (int i = 0; i < fNumConsts; i++) {
+            if (fConsts[i] == bits) {
+                return { RM::Const, i };
+            }
+        }
+        if (fNumConsts == kMaxConsts) {
+            fOK = false;
+            return { RM::Const, 0 };
+        }
+        fConsts[fNumConsts] = bits;
+        return { RM::Const, fNumConsts++ };
+    }
+    RM k(float f) {
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+        return k_bits(bits);
+    }
+
+    static int alloc_from(int* free, bool* ok) {
+        for (int r = 0; r < 16; r++) {
+            if (*free & (1 << r)) {
+                *free &= ~(1 << r);
+                return r;
+            }
+        }
+        *ok = false;
+        return 0;
+    }
+    int  alloc()          { return alloc_from(&fFree, &fOK); }
+    void release(int r)   { fFree |= 1 << r; }
+
+    // Comparison results live in mask registers with AVX-512, and vector registers without.
+    int  alloc_mask()        { return fWide ? alloc_from(&fFreeK, &fOK) : alloc(); }
+    void release_mask(int m) { if (fWide) { fFreeK |= 1 << m; } else { release(m); } }
+
+    int splat(float f) {
+        int r = alloc();
+        inst(MOVUPS_LOAD, r, 0, k(f));
+        return r;
+    }
+
+    void cmp(int mask, int x, RM y, int pred) {
+        inst(CMPPS, mask, x, y, pred);
+    }
+    void or_masks(int m, int m1) {
+        if (fWide) {
+            this->vex(KORW, m, m, reg(m1));
+        } else {
+            inst(ORPS, m, m, reg(m1));
+        }
+    }
+    // e = if_then_else(mask, t, e)
+    void select(int mask, RM t, int e) {
+        if (fWide) {
+            this->evex(BLENDMPS, e, e, t, -1, mask);
+        } else {
+            this->vex(BLENDVPS, e, e, t, mask << 4);
+        }
+    }
+    // x = if_then_else(mask, x, F0)
+    void zero_unless(int mask, int x) {
+        if (fWide) {
+            this->evex(MOVAPS, x, 0, reg(x), -1, mask, true);
+        } else {
+            inst(ANDPS, x, x, reg(mask));
+        }
+    }
+
+    void log2_(int x);
+    void exp2_(int x);
+    void pow_(int x, float y);
+    void tf_(int x, const PreparedTF* tf);
+    void gamma_(int x, const PreparedTF* tf);
+
+    void load_packed (const int shift[4], const uint32_t mask[4], const float scale[4]);
+    void store_packed(const int shift[4],                         const float scale[4]);
+    void emit(Op op, const void* ctx);
+};
+
+// approx_log2(), in place.
+void Compiler::log2_(int x) {
+    int m = alloc(),
+        t = alloc();
+    inst(ANDPS,    m, x, k_bits(0x007fffff));
+    inst(ORPS,     m, m, k_bits(0x3f000000));
+    inst(CVTDQ2PS, x, 0, reg(x));
+    inst(MULPS,    x, x, k(1.0f / (1<<23)));
+    inst(SUBPS,    x, x, k(124.225514990f));
+    inst(MULPS,    t, m, k(1.498030302f));
+    inst(SUBPS,    x, x, reg(t));
+    inst(ADDPS,    m, m, k(0.3520887068f));
+    inst(MOVUPS_LOAD, t, 0, k(1.725879990f));
+    inst(DIVPS,    t, t, reg(m));
+    inst(SUBPS,    x, x, reg(t));
+    release(t);
+    release(m);
+}
+
+// approx_exp2(), in place.
+void Compiler::exp2_(int x) {
+    int f = alloc(),
+        t = alloc();
+    inst(ROUNDPS, f, 0, reg(x), 0x01/*floor*/);
+    inst(SUBPS,   f, x, reg(f));
+    inst(ADDPS,   x, x, k(121.274057500f));
+    inst(MULPS,   t, f, k(1.490129070f));
+    inst(SUBPS,   x, x, reg(t));
+    inst(MOVUPS_LOAD, t, 0, k(4.84252568f));
+    inst(SUBPS,   t, t, reg(f));
+    inst(MOVUPS_LOAD, f, 0, k(27.728023300f));
+    inst(DIVPS,   f, f, reg(t));
+    inst(ADDPS,   x, x, reg(f));
+    inst(MULPS,   x, x, k(1.0f * (1<<23)));
+
+    // min_(max_(x, F0), FInfBits), with operands in the order min_() and max_() compare them.
+    inst(XORPS,   t, t, reg(t));
+    inst(MAXPS,   x, t, reg(x));
+    inst(MOVUPS_LOAD, t, 0, k(2139095040.0f));
+    inst(MINPS,   x, t, reg(x));
+    inst(CVTTPS2DQ, x, 0, reg(x));
+    release(t);
+    release(f);
+}
+
+// approx_pow(), in place.
+void Compiler::pow_(int x, float y) {
+    int v  = alloc(),
+        m  = alloc_mask(),
+        m1 = alloc_mask();
+    inst(MOVAPS, v, 0, reg(x));
+    log2_(v);
+    inst(MULPS,  v, v, k(y));
+    exp2_(v);
+
+    cmp(m,  x, k(0.0f), CMP_EQ);
+    cmp(m1, x, k(1.0f), CMP_EQ);
+    or_masks(m, m1);
+    select(m, reg(x), v);
+    inst(MOVAPS, x, 0, reg(v));
+    release_mask(m1);
+    release_mask(m);
+    release(v);
+}
+
+// apply_tf(), in place.
+void Compiler::tf_(int x, const PreparedTF* tf) {
+    int sign = alloc(),
+        lin  = alloc(),
+        m    = alloc_mask();
+    inst(ANDPS, sign, x, k_bits(0x80000000));
+    inst(XORPS, x, x, reg(sign));
+
+    inst(MULPS, lin, x, k(tf->c));
+    inst(ADDPS, lin, lin, k(tf->f));
+    cmp(m, x, k(tf->d), CMP_LT);
+
+    inst(MULPS, x, x, k(tf->a));
+    inst(ADDPS, x, x, k(tf->b));
+    pow_(x, tf->g);
+    inst(ADDPS, x, x, k(tf->e));
+
+    select(m, reg(lin), x);
+    inst(ORPS, x, x, reg(sign));
+    release_mask(m);
+    release(lin);
+    release(sign);
+}
+
+// apply_gamma(), in place.
+void Compiler::gamma_(int x, const PreparedTF* tf) {
+    int sign = alloc();
+    inst(ANDPS, sign, x, k_bits(0x80000000));
+    inst(XORPS, x, x, reg(sign));
+    pow_(x, tf->g);
+    inst(ORPS, x, x, reg(sign));
+    release(sign);
+}
+
+void Compiler::load_packed(const int shift[4], const uint32_t mask[4], const float scale[4]) {
+    int px = alloc();
+    inst(MOVUPS_LOAD, px, 0, RM{RM::Src, 0});
+    for (int c = 0; c < 4; c++) {
+        int v = fCh[c] = alloc();
+        inst(PSHIFTD_IMM, 2/*right*/, v, reg(px), shift[c]);
+        inst(PAND,     v, v, k_bits(mask[c]));
+        inst(CVTDQ2PS, v, 0, reg(v));
+        inst(MULPS,    v, v, k(scale[c]));
+    }
+    release(px);
+}
+
+void Compiler::store_packed(const int shift[4], const float scale[4]) {
+    int px = -1;
+    for (int c = 0; c < 4; c++) {
+        int v = alloc();
+        inst(MULPS,     v, fCh[c], k(scale[c]));
+        inst(ADDPS,     v, v, k(0.5f));
+        inst(CVTTPS2DQ, v, 0, reg(v));
+        inst(PSHIFTD_IMM, 6/*left*/, v, reg(v), shift[c]);
+        if (px < 0) {
+            px = v;
+        } else {
+            inst(POR, px, px, reg(v));
+            release(v);
+        }
+    }
+    inst(MOVUPS_STORE, px, 0, RM{RM::Dst, 0});
+    release(px);
+}
+
+void Compiler::emit(Op op, const void* ctx) {
+    static const int      shift_8888[]    = { 0,  8, 16, 24 },
+                          shift_1010102[] = { 0, 10, 20, 30 };
+    static const uint32_t mask_8888[]     = { 0xff,  0xff,  0xff,  0xff },
+                          mask_1010102[]  = { 0x3ff, 0x3ff, 0x3ff, 0x3  };
+    static const float    from_8888[]     = { 1/255.0f,  1/255.0f,  1/255.0f,  1/255.0f },
+                          from_1010102[]  = { 1/1023.0f, 1/1023.0f, 1/1023.0f, 1/3.0f   },
+                          to_8888[]       = { 255,  255,  255,  255 },
+                          to_1010102[]    = { 1023, 1023, 1023, 3   };
+
+    const PreparedTF* tf = (const PreparedTF*)ctx;
+    const float*      m  = (const float*)ctx;
+
+    switch (op) {
+        case Op::load_8888:     load_packed(shift_8888,    mask_8888,    from_8888);    break;
+        case Op::load_1010102:  load_packed(shift_1010102, mask_1010102, from_1010102); break;
+        case Op::store_8888:    store_packed(shift_8888,    to_8888);                   break;
+        case Op::store_1010102: store_packed(shift_1010102, to_1010102);                break;
+
+        case Op::swap_rb: {
+            int t = fCh[0];
+            fCh[0] = fCh[2];
+            fCh[2] = t;
+        } break;
+
+        case Op::clamp: {
+            int one = splat(1.0f);
+            for (int c = 0; c < 4; c++) {
+                inst(MINPS, fCh[c], one, reg(fCh[c]));
+                inst(MAXPS, fCh[c], fCh[c], k(0.0f));
+            }
+            release(one);
+        } break;
+
+        case Op::invert: {
+            int one = splat(1.0f);
+            for (int c = 0; c < 4; c++) {
+                inst(SUBPS, fCh[c], one, reg(fCh[c]));
+            }
+            release(one);
+        } break;
+
+        case Op::force_opaque:
+            inst(MOVUPS_LOAD, fCh[3], 0, k(1.0f));
+            break;
+
+        case Op::premul:
+            for (int c = 0; c < 3; c++) {
+                inst(MULPS, fCh[c], fCh[c], reg(fCh[3]));
+            }
+            break;
+
+        case Op::unpremul: {
+            int scale = splat(1.0f),
+                mask  = alloc_mask();
+            inst(DIVPS, scale, scale, reg(fCh[3]));
+            cmp(mask, scale, k(INFINITY_), CMP_LT);
+            zero_unless(mask, scale);
+            for (int c = 0; c < 3; c++) {
+                inst(MULPS, fCh[c], fCh[c], reg(scale));
+            }
+            release_mask(mask);
+            release(scale);
+        } break;
+
+        case Op::matrix_3x3:
+        case Op::matrix_3x4: {
+            const int cols = op == Op::matrix_3x4 ? 4 : 3;
+            int out[3],
+                t = alloc();
+            for (int row = 0; row < 3; row++) {
+                const float* mr = m + cols*row;
+                out[row] = alloc();
+                inst(MULPS, out[row], fCh[0],   k(mr[0]));
+                inst(MULPS, t,        fCh[1],   k(mr[1]));
+                inst(ADDPS, out[row], out[row], reg(t));
+                inst(MULPS, t,        fCh[2],   k(mr[2]));
+                inst(ADDPS, out[row], out[row], reg(t));
+                if (cols == 4) {
+                    inst(ADDPS, out[row], out[row], k(mr[3]));
+                }
+            }
+            release(t);
+            for (int c = 0; c < 3; c++) {
+                release(fCh[c]);
+                fCh[c] = out[c];
+            }
+        } break;
+
+        case Op::gamma_r:   gamma_(fCh[0], tf); break;
+        case Op::gamma_g:   gamma_(fCh[1], tf); break;
+        case Op::gamma_b:   gamma_(fCh[2], tf); break;
+        case Op::gamma_a:   gamma_(fCh[3], tf); break;
+        case Op::gamma_rgb: gamma_(fCh[0], tf);
+                            gamma_(fCh[1], tf);
+                            gamma_(fCh[2], tf); break;
+
+        case Op::tf_r:   tf_(fCh[0], tf); break;
+        case Op::tf_g:   tf_(fCh[1], tf); break;
+        case Op::tf_b:   tf_(fCh[2], tf); break;
+        case Op::tf_a:   tf_(fCh[3], tf); break;
+        case Op::tf_rgb: tf_(fCh[0], tf);
+                         tf_(fCh[1], tf);
+                         tf_(fCh[2], tf); break;
+
+        default:
+            fOK = false;  // supported() should have caught this.
+            break;
+    }
+}
+
+size_t Compiler::compile(const Op* program, const void** contexts, ptrdiff_t programSize) {
+    // The loop body, run with rdi = src, rsi = dst, and rdx = blocks left.
+    for (ptrdiff_t i = 0; i < programSize; i++) {
+        this->emit(program[i], contexts[i]);
+    }
+
+    const uint32_t stride = (uint32_t)(4 * lanes());
+    byte(0x48); byte(0x81); byte(0xc7); u32(stride);  // add  rdi, stride
+    byte(0x48); byte(0x81); byte(0xc6); u32(stride);  // add  rsi, stride
+    byte(0x48); byte(0xff); byte(0xca);               // dec  rdx
+    byte(0x0f); byte(0x85);                           // jnz  back to the top
+    u32((uint32_t)-(int32_t)(fLen + 4));
+    byte(0xc5); byte(0xf8); byte(0x77);               // vzeroupper
+    byte(0xc3);                                       // ret
+
+    // Then the constant pool, each constant splatted across a full vector.
+    // Each reference to it is relative to the end of its instruction.
+    while (fLen % 64) {
+        byte(0xcc);  // int3
+    }
+    const size_t pool = fLen;
+    for (int i = 0; i < fNumConsts; i++)
+    for (int j = 0; j < lanes(); j++) {
+        u32(fConsts[i]);
+    }
+    if (!fOK) {
+        return 0;
+    }
+    for (int i = 0; i < fNumFixups; i++) {
+        const Fixup& f = fFixups[i];
+        const uint32_t disp = (uint32_t)(pool + (size_t)(4 * lanes() * f.konst) - f.end);
+        memcpy(fCode + f.disp, &disp, 4);
+    }
+    return fLen;
+}
+
+// Each cached program's code is followed in its pages by its key.
+static struct {
+    const uint8_t*  code;
+    const uint32_t* key;
+    int             key_len;
+} gCache[kCacheSize];
+static int  gCached = 0;
+static bool gLock   = false;
+
+static void lock_cache() {
+    while (__atomic_test_and_set(&gLock, __ATOMIC_ACQUIRE)) {}
+}
+static void unlock_cache() {
+    __atomic_clear(&gLock, __ATOMIC_RELEASE);
+}
+
+// Programs too big for the Compiler are remembered by a hash of their key, so we don't compile
+// them again on every call.  A collision only sends some other program to the interpreter.
+static uint64_t gFailed[kCacheSize];
+static int      gNumFailed = 0;
+
+// Once the system refuses to make our pages executable (SELinux execmem, seccomp, sandboxed
+// renderers), it won't start allowing it, so we stop trying for good.
+static bool gNoExec = false;
+
+static uint64_t hash_key(const uint32_t* key, int key_len) {
+    uint64_t h = (uint64_t)key_len;
+    for (int i = 0; i < key_len; i++) {
+        h = (h ^ key[i]) * 0x9E3779B97F4A7C15ull;
+        h = (h << 31) | (h >> 33);
+    }
+    return h;
+}
+
+// Has this program failed to compile before?  Call with gLock held.
+static bool failed_before(uint64_t hash) {
+    for (int i = 0; i < gNumFailed; i++) {
+        if (gFailed[i] == hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the cached code for key, or null.  Call with gLock held.
+static const uint8_t* find_cached(const uint32_t* key, int key_len) {
+    for (int i = 0; i < gCached; i++) {
+        if (gCache[i].key_len == key_len &&
+                0 == memcmp(gCache[i].key, key, sizeof(*key) * (size_t)key_len)) {
+            return gCache[i].code;
+        }
+    }
+    return nullptr;
+}
+
+// Compiles the program straight into fresh read+write pages, with the Compiler's fixups in
+// pages past the code, then trims those off, appends the key, and makes the rest executable.
+// Returns the size of the mapping left at *mem, with the key's copy at *key_copy, or 0,
+// setting *too_big if the program will never fit.
+static size_t compile(const Op* program, const void** contexts, ptrdiff_t programSize,
+                      bool avx512, const uint32_t* key, int key_len,
+                      uint8_t** mem, const uint32_t** key_copy, bool* too_big) {
+    const size_t page     = (size_t)sysconf(_SC_PAGESIZE),
+                 scratch  = (size_t)kMaxCode + sizeof(Fixup) * kMaxFixups,
+                 map_size = (scratch + page - 1) / page * page;
+    void* map = mmap(nullptr, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1,0);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    uint8_t* code = (uint8_t*)map;
+
+    Compiler compiler(code, avx512);
+    const size_t len  = compiler.compile(program, contexts, programSize),
+                 used = (len + 3) / 4 * 4 + sizeof(*key) * (size_t)key_len,
+                 size = (used + page - 1) / page * page;
+    if (len == 0 || size > map_size) {
+        munmap(map, map_size);
+        *too_big = true;
+        return 0;
+    }
+    if (size < map_size) {
+        munmap(code + size, map_size - size);
+    }
+
+    uint32_t* copy = (uint32_t*)(void*)(code + (len + 3) / 4 * 4);
+    memcpy(copy, key, sizeof(*key) * (size_t)key_len);
+    if (0 != mprotect(map, size, PROT_READ|PROT_EXEC)) {
+        munmap(map, size);
+        __atomic_store_n(&gNoExec, true, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *mem      = code;
+    *key_copy = copy;
+    return size;
+}
+
+static Fn compile_cached(const Op* program, const void** contexts, ptrdiff_t programSize,
+                         bool avx512) {
+    if (__atomic_load_n(&gNoExec, __ATOMIC_RELAXED)) {
+        return nullptr;
+    }
+    uint32_t key[kMaxKey];
+    const int      key_len = make_key(program, contexts, programSize, avx512, key);
+    const uint64_t hash    = hash_key(key, key_len);
+
+    lock_cache();
+    const uint8_t* found  = find_cached(key, key_len);
+    const bool     full   = gCached == kCacheSize,
+                   failed = !found && failed_before(hash);
+    unlock_cache();
+
+    // Compile without holding the lock.  If another thread compiled the same program in the
+    // meantime (or filled the cache), we use theirs and throw ours away.
+    if (!found && !full && !failed) {
+        uint8_t*        code     = nullptr;
+        const uint32_t* key_copy = nullptr;
+        bool            too_big  = false;
+        const size_t    size     = compile(program, contexts, programSize, avx512, key, key_len,
+                                           &code, &key_copy, &too_big);
+        if (too_big) {
+            lock_cache();
+            if (!failed_before(hash) && gNumFailed < kCacheSize) {
+                gFailed[gNumFailed++] = hash;
+            }
+            unlock_cache();
+        }
+        if (size) {
+            lock_cache();
+            found = find_cached(key, key_len);
+            if (!found && gCached < kCacheSize) {
+                found = code;
+                gCache[gCached++] = { code, key_copy, key_len };
+            }
+            unlock_cache();
+
+            if (found != code) {
+                munmap(code, size);
+            }
+        }
+    }
+
+    Fn fn = nullptr;
+    static_assert(sizeof(fn) == sizeof(found), "");
+    if (found) {
+        memcpy(&fn, &found, sizeof(fn));
+    }
+    return fn;
+}
+
+bool run_program(const Op* program, const void** contexts, ptrdiff_t programSize,
+                 const char* src, char* dst, int n,
+                 const size_t src_bpp, const size_t dst_bpp,
+                 bool avx512) {
+    if (!supported(program, programSize) || src_bpp != 4 || dst_bpp != 4) {
+        return false;
+    }
+    Fn fn = compile_cached(program, contexts, programSize, avx512);
+    if (!fn) {
+        return false;
+    }
+
+    const size_t lanes    = avx512 ? 16 : 8,
+                 blocks   = (size_t)n / lanes,
+                 leftover = (size_t)n % lanes;
+    if (blocks) {
+        fn(src, dst, blocks);
+    }
+    // Run any leftover pixels through one more block of our own.
+    if (leftover) {
+        uint32_t tmp_src[kMaxLanes] = {0},
+                 tmp_dst[kMaxLanes];
+        memcpy(tmp_src, src + blocks*lanes*src_bpp, leftover*src_bpp);
+        fn((const char*)tmp_src, (char*)tmp_dst, 1);
+        memcpy(dst + blocks*lanes*dst_bpp, tmp_dst, leftover*dst_bpp);
+    }
+    return true;
+}
+
+#endif
+
+}  // namespace jit
+}  // namespace skcms_private
@@ -45,6 +45,17 @@ void run_program(const Op* program, const void** contexts, ptrdiff_t programSize
                                          src, dst, n, src_bpp, dst_bpp);
 }
 
+void roundtrip_errors(const skcms_Curve* curve, const skcms_TransferFunction* tf_inv,
+                      float dx, int i0, int n, float* err) {
+    skcms_private::baseline::roundtrip_errors(curve, tf_inv, dx, i0, n, err);
+}
+
+void rg_nonlinear(const skcms_Curve* curve, const skcms_TransferFunction* tf,
+                  float x0, float dx, int i0, int n,
+                  float* resid, float* dfdg, float* dfda, float* dfdb) {
+    skcms_private::baseline::rg_nonlinear(curve, tf, x0, dx, i0, n, resid, dfdg, dfda, dfdb);
+}
+
 #else
 
 #define USING_AVX512F
@@ -61,6 +61,17 @@ extern "C" {
     #define SKCMS_HAS_MUSTTAIL 0
 #endif
 
+#ifndef SKCMS_HAS_COMPUTED_GOTO
+    // Without tail calls, GCC and Clang can still thread stages together using labels-as-values
+    // (computed goto), jumping straight from each stage to the next rather than back through a
+    // switch.  Build with -DSKCMS_HAS_COMPUTED_GOTO=0 to use the switch anyway.
+    #if defined(__GNUC__) && !SKCMS_HAS_MUSTTAIL
+        #define SKCMS_HAS_COMPUTED_GOTO 1
+    #else
+        #define SKCMS_HAS_COMPUTED_GOTO 0
+    #endif
+#endif
+
 #if defined(__clang__)
     #define SKCMS_MAYBE_UNUSED __attribute__((unused))
     #pragma clang diagnostic ignored "-Wused-but-marked-unused"
@@ -72,6 +83,14 @@ extern "C" {
     #define SKCMS_MAYBE_UNUSED
 #endif
 
+#if defined(__clang__) || defined(__GNUC__)
+    #define SKCMS_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+    #define SKCMS_NOINLINE __declspec(noinline)
+#else
+    #define SKCMS_NOINLINE
+#endif
+
 // sizeof(x) will return size_t, which is 32-bit on some machines and 64-bit on others.
 // We have better testing on 64-bit machines, so force 32-bit machines to behave like 64-bit.
 //
@@ -120,6 +139,10 @@ bool skcms_GetTagBySignature(const skcms_ICCProfile*, uint32_t sig, skcms_ICCTag
 
 float skcms_MaxRoundtripError(const skcms_Curve* curve, const skcms_TransferFunction* inv_tf);
 
+// For testing: lets the JIT emit AVX-512 code on machines that support it (the default), or
+// limits it to AVX2, so tests can reach both emitters on AVX-512 machines.
+void skcms_AllowJITAVX512(bool allow);
+
 // 252 of a random shuffle of all possible bytes.
 // 252 is evenly divisible by 3 and 4.  Only 192, 10, 241, and 43 are missing.
 // Used for ICC profile equivalence testing.
@@ -163,6 +163,11 @@ typedef struct skcms_B2A {
     skcms_Curve     output_curves[4];
 } skcms_B2A;
 
+// Coding-independent code points (ITU-T H.273).  A matrix_coefficients other than 0 (RGB) marks
+// the pixels as YCbCr, with Y,Cb,Cr in the R,G,B channels: skcms_Transform() converts them from
+// or to R'G'B' with the BT.709 (1), BT.601 (5, 6), or BT.2020 non-constant luminance (9) matrix,
+// in limited range unless video_full_range_flag is set.  Integer formats hold the usual code
+// values for their bit depth; float formats hold Cb and Cr centered on 0, and ignore the range.
 typedef struct skcms_CICP {
     uint8_t color_primaries;
     uint8_t transfer_characteristics;
@@ -206,6 +211,18 @@ typedef struct skcms_ICCProfile {
     // and has_CICP to true.
     bool                   has_CICP;
     skcms_CICP             CICP;
+
+    // skcms_ParseLazy() notes here the A2B and B2A tag signatures it would have decoded (or 0),
+    // and whether there's a CICP tag, for skcms_ResolveProfile() to decode later.
+    uint32_t               deferred_A2B;
+    uint32_t               deferred_B2A;
+    bool                   deferred_CICP;
+
+    // skcms_Parse() builds this hash index of the tag table so skcms_GetTagBySignature()
+    // need not search it.  It's skipped for profiles with more than 255 tags.
+    // Each non-zero tag_index entry is 1 + the index of a tag; treat all this as private.
+    bool                   has_tag_index;
+    uint8_t                tag_index[512];
 } skcms_ICCProfile;
 
 // The sRGB color profile is so commonly used that we offer a canonical skcms_ICCProfile for it.
@@ -223,6 +240,46 @@ SKCMS_API const skcms_TransferFunction* skcms_Identity_TransferFunction(void);
 SKCMS_API bool skcms_ApproximatelyEqualProfiles(const skcms_ICCProfile* A,
                                                 const skcms_ICCProfile* B);
 
+// A summary of a profile's colorimetric behavior: its XYZD50 response to a fixed set of
+// samples, which is what skcms_ApproximatelyEqualProfiles() compares.  Fingerprint each
+// profile once and keep it around to compare against many others.
+typedef struct skcms_Fingerprint {
+    uint8_t  xyz[252];  // XYZD50 response, as RGB_888.  Unused bytes are zero.
+    bool     cmyk;      // CMYK profiles are never approximately equal to RGB or gray ones.
+    uint64_t hash;      // Hash of cmyk and xyz.
+} skcms_Fingerprint;
+
+// Returns false if the profile can't be used as a source for skcms_Transform().
+SKCMS_API bool skcms_ProfileFingerprint(const skcms_ICCProfile*, skcms_Fingerprint*);
+
+// Same answer as skcms_ApproximatelyEqualProfiles() on the fingerprinted profiles.
+//
+// The hash is of the exact response, so equal hashes find profiles that behave identically,
+// e.g. one profile embedded with different metadata, in linear time after a sort or with a
+// hash table.  Approximately equal profiles may still hash differently.
+SKCMS_API bool skcms_ApproximatelyEqualFingerprints(const skcms_Fingerprint* A,
+                                                    const skcms_Fingerprint* B);
+
+// Commonly used color spaces, all with D65 white points except XYZD50.
+typedef enum skcms_KnownProfile {
+    skcms_KnownProfile_Unknown,
+    skcms_KnownProfile_sRGB,
+    skcms_KnownProfile_DisplayP3,    // sRGB transfer function.
+    skcms_KnownProfile_AdobeRGB,     // Gamma 563/256.
+    skcms_KnownProfile_Rec2020_PQ,
+    skcms_KnownProfile_Rec2020_HLG,  // HLG scaled to [0,1], as profiles carry it.
+    skcms_KnownProfile_XYZD50,
+} skcms_KnownProfile;
+
+// Which known profile is this approximately equal to (in the sense of
+// skcms_ApproximatelyEqualProfiles())?  The fingerprints of known profiles are built in,
+// so this costs one skcms_Transform() for a profile, and none for a fingerprint.
+SKCMS_API skcms_KnownProfile skcms_IdentifyProfile    (const skcms_ICCProfile*);
+SKCMS_API skcms_KnownProfile skcms_IdentifyFingerprint(const skcms_Fingerprint*);
+
+// The built-in fingerprint of a known profile, or null for skcms_KnownProfile_Unknown.
+SKCMS_API const skcms_Fingerprint* skcms_KnownProfileFingerprint(skcms_KnownProfile);
+
 // Practical test that answers: Is curve roughly the inverse of inv_tf? Typically used by passing
 // the inverse of a known parametric transfer function (like sRGB), to determine if a particular
 // curve is very close to sRGB.
@@ -251,6 +308,48 @@ static inline bool skcms_Parse(const void* buf, size_t len, skcms_ICCProfile* pr
                                       profile);
 }
 
+// Like skcms_ParseWithA2BPriority() and skcms_Parse(), but leaves the A2B, B2A, and CICP tags
+// undecoded until skcms_ResolveProfile(), which is much cheaper if you only need the header,
+// TRC curves, or XYZD50 matrix (e.g. to classify or dedupe profiles).  Until then has_A2B,
+// has_B2A, and has_CICP are false, and malformed A2B, B2A, or CICP tags go unnoticed.
+// skcms_Transform() and skcms_MakeUsableAsDestination() resolve profiles as needed.
+SKCMS_API bool skcms_ParseLazyWithA2BPriority(const void*, size_t,
+                                              const int priority[], int priorities,
+                                              skcms_ICCProfile*);
+
+static inline bool skcms_ParseLazy(const void* buf, size_t len, skcms_ICCProfile* profile) {
+    const int priority[] = {0,1};
+    return skcms_ParseLazyWithA2BPriority(buf, len,
+                                          priority, sizeof(priority)/sizeof(*priority),
+                                          profile);
+}
+
+typedef struct skcms_ProfileData {
+    const void* buf;
+    size_t      len;
+} skcms_ProfileData;
+
+// Call fn(arg, i) once for each i in [0,n), on any threads you like, returning when all are done.
+typedef void (skcms_ParallelFor)(void* ctx, int n, void (*fn)(void* arg, int i), void* arg);
+
+// How many uint32_t of scratch space skcms_ParseBatch() needs for n profiles,
+// or 0 if it can't take n: more than 2^30, or none.
+SKCMS_API size_t skcms_ParseBatchScratchCount(int n);
+
+// skcms_Parse() n profiles at once, setting profiles[i] and ok[i] for each data[i].
+// Byte-identical buffers are parsed only once, with copies pointed at their own buffers.
+// Where ok[i] is false, profiles[i] is unspecified.
+// If parallel_for is not null, skcms_ParseBatch() uses it to parse unique profiles in parallel.
+// Returns the number of profiles that were copies of an earlier one.
+SKCMS_API int skcms_ParseBatch(const skcms_ProfileData data[], int n,
+                               skcms_ICCProfile profiles[], bool ok[],
+                               uint32_t scratch[],
+                               skcms_ParallelFor* parallel_for, void* parallel_ctx);
+
+// Decode any tags skcms_ParseLazy() deferred.  Returns false, leaving the profile unchanged,
+// if any of them are malformed.  This is a no-op returning true for profiles from skcms_Parse().
+SKCMS_API bool skcms_ResolveProfile(skcms_ICCProfile*);
+
 SKCMS_API bool skcms_ApproximateCurve(const skcms_Curve* curve,
                                       skcms_TransferFunction* approx,
                                       float* max_error);
@@ -354,6 +453,291 @@ SKCMS_API bool skcms_Transform(const void*             src,
                                const skcms_ICCProfile* dstProfile,
                                size_t                  npixels);
 
+// How accurately skcms_TransformWithPrecision() evaluates parametric transfer functions.
+// Worst errors, as a fraction of full range, decoding and encoding each kind of curve:
+//
+//                sRGB & gamma   PQ decode   PQ encode   HLG
+//     Default    2^-12          2^-5.9      2^-10       2^-14.5
+//     Precise    2^-22          2^-13.8     2^-16.3     2^-21
+//
+// Precise's curves cost roughly 1.5-2x Default's.  (bench -e measures these.)
+typedef enum skcms_Precision {
+    skcms_Precision_Default,  // What skcms_Transform() uses.
+    skcms_Precision_Fast,     // Default's curves, allowing the half-float pipeline described below.
+    skcms_Precision_Precise,  // Slower and more accurate, for 16-bit or float output.
+} skcms_Precision;
+
+// skcms_Transform(), evaluating transfer functions with the given precision.
+// Table-based curves and everything else are unaffected.
+//
+// On CPUs with AVX-512 FP16, skcms_Precision_Fast may run large 8- and 10-bit transforms
+// entirely in half floats, if a check of that program finds it within 1 LSB of the float math.
+// That rules out most gamut conversions into steep encodings like sRGB: rounding a gamut matrix
+// in half floats errs by several LSB where its output nears 0.  Elsewhere skcms_Precision_Fast
+// matches skcms_Precision_Default exactly.
+SKCMS_API bool skcms_TransformWithPrecision(const void*             src,
+                                            skcms_PixelFormat       srcFmt,
+                                            skcms_AlphaFormat       srcAlpha,
+                                            const skcms_ICCProfile* srcProfile,
+                                            void*                   dst,
+                                            skcms_PixelFormat       dstFmt,
+                                            skcms_AlphaFormat       dstAlpha,
+                                            const skcms_ICCProfile* dstProfile,
+                                            size_t                  npixels,
+                                            skcms_Precision         precision);
+
+// How skcms_TransformWithToneMap() compresses HDR highlights into SDR range.
+typedef enum skcms_ToneMapCurve {
+    skcms_ToneMapCurve_BT2390,    // ITU-R BT.2390's EETF, a knee and spline in PQ space.
+    skcms_ToneMapCurve_Reinhard,  // Extended Reinhard, v(1 + v/peak^2) / (1 + v).
+} skcms_ToneMapCurve;
+
+typedef struct skcms_ToneMap {
+    skcms_ToneMapCurve curve;
+    float              source_peak;   // Nits.  The brightest the source gets, e.g. 1000.
+    float              target_white;  // Nits.  What destination 1.0 stands for, e.g. 203.
+} skcms_ToneMap;
+
+// skcms_Transform() from a PQ or HLG source to another profile, tone mapping in the same pass.
+// The source is PQ or HLG by its CICP tag, or else by the form of its parametric transfer
+// functions; other sources, and those with an A2B transform, return false.  The curve maps
+// max(r,g,b) in linear source RGB, and all three channels are scaled alike to keep their hue.
+// HLG is treated as display light, its signal peak shown at source_peak.
+SKCMS_API bool skcms_TransformWithToneMap(const void*             src,
+                                          skcms_PixelFormat       srcFmt,
+                                          skcms_AlphaFormat       srcAlpha,
+                                          const skcms_ICCProfile* srcProfile,
+                                          void*                   dst,
+                                          skcms_PixelFormat       dstFmt,
+                                          skcms_AlphaFormat       dstAlpha,
+                                          const skcms_ICCProfile* dstProfile,
+                                          size_t                  npixels,
+                                          const skcms_ToneMap*    toneMap);
+
+// How skcms_TransformWithGamutMapping() brings colors outside the destination gamut inside.
+typedef enum skcms_GamutMapping {
+    skcms_GamutMapping_Clip,        // Clamp each channel, as skcms_Transform() does.
+    skcms_GamutMapping_Desaturate,  // Desaturate toward gray of the same luminance, just enough.
+    skcms_GamutMapping_SoftClip,    // Desaturate, easing in from 80% of the way to the boundary.
+} skcms_GamutMapping;
+
+// skcms_Transform(), mapping colors into the destination gamut in linear light, between the
+// gamut conversion and encoding.  Unlike clamping each channel, the desaturating mappings keep
+// hue and luminance.  toneMap may be null, or tone map as skcms_TransformWithToneMap() does.
+// Destinations with a B2A transform support only skcms_GamutMapping_Clip.
+SKCMS_API bool skcms_TransformWithGamutMapping(const void*             src,
+                                               skcms_PixelFormat       srcFmt,
+                                               skcms_AlphaFormat       srcAlpha,
+                                               const skcms_ICCProfile* srcProfile,
+                                               void*                   dst,
+                                               skcms_PixelFormat       dstFmt,
+                                               skcms_AlphaFormat       dstAlpha,
+                                               const skcms_ICCProfile* dstProfile,
+                                               size_t                  npixels,
+                                               skcms_GamutMapping      mapping,
+                                               const skcms_ToneMap*    toneMap);
+
+// How skcms_TransformImage() dithers as it quantizes.
+typedef enum skcms_Dither {
+    skcms_Dither_None,
+    skcms_Dither_Ordered,    // An 8x8 Bayer matrix.
+    skcms_Dither_BlueNoise,  // A 16x16 blue noise tile, shifted differently for r, g, and b.
+} skcms_Dither;
+
+// skcms_Transform() for a width x height image with rows srcRowBytes and dstRowBytes apart.
+// Pixels stored as RGB_565, ABGR_4444, RGBA_8888, or RGBA_1010102 (or their BGR and sRGB
+// variants) are dithered by their position in the image; other formats are not dithered.
+// It is safe to alias dst == src if dstFmt == srcFmt and dstRowBytes == srcRowBytes.
+SKCMS_API bool skcms_TransformImage(const void*             src,
+                                    size_t                  srcRowBytes,
+                                    skcms_PixelFormat       srcFmt,
+                                    skcms_AlphaFormat       srcAlpha,
+                                    const skcms_ICCProfile* srcProfile,
+                                    void*                   dst,
+                                    size_t                  dstRowBytes,
+                                    skcms_PixelFormat       dstFmt,
+                                    skcms_AlphaFormat       dstAlpha,
+                                    const skcms_ICCProfile* dstProfile,
+                                    int                     width,
+                                    int                     height,
+                                    skcms_Dither            dither);
+
+// skcms_Transform() through a chain of 2 to 8 profiles in one pass, src pixels described by
+// profiles[0] converting to each profile in turn until dst pixels described by the last.
+// Between the ends, values are as each profile would encode them (CMYK in r,g,b,a, leaving
+// the result opaque), and profiles must be usable as destinations and fully parsed.  Chains of
+// matrix/TRC profiles always fit in one pass; long chains through A2B/B2A profiles may not,
+// and fail.
+SKCMS_API bool skcms_TransformChain(const void*                    src,
+                                    skcms_PixelFormat              srcFmt,
+                                    skcms_AlphaFormat              srcAlpha,
+                                    const skcms_ICCProfile* const* profiles,
+                                    int                            nprofiles,
+                                    void*                          dst,
+                                    skcms_PixelFormat              dstFmt,
+                                    skcms_AlphaFormat              dstAlpha,
+                                    size_t                         npixels);
+
+// Sample the chain skcms_TransformChain() would run between RGB profiles into a device-link
+// CLUT of grid_points^3 r,g,b 16-bit samples (grid_points^3 * 6 bytes), laid out as
+// skcms_TransformBuilder_AppendCLUT() expects.
+SKCMS_API bool skcms_MakeDeviceLinkCLUT(const skcms_ICCProfile* const* profiles,
+                                        int                            nprofiles,
+                                        uint8_t                        grid_points,
+                                        uint8_t*                       grid_16);
+
+// Sample the chain skcms_TransformChain() would run into an ICC v4 device-link profile, whose
+// A2B0 'mAB ' tag holds one CLUT of grid_points per input with 1- or 2-byte samples.  Either end
+// may be RGB or CMYK.  With a null buf, sets *len to the size needed; otherwise *len is the size
+// of buf going in and of the profile written coming out.  skcms_Parse() reads the result back as
+// a profile that skcms_Transform() can use as the src, with a null (or the same) dst.
+SKCMS_API bool skcms_WriteDeviceLink(const skcms_ICCProfile* const* profiles,
+                                     int                            nprofiles,
+                                     uint8_t                        grid_points,
+                                     int                            bytes_per_sample,
+                                     void*                          buf,
+                                     size_t*                        len);
+
+// skcms_Transform() for pixels that arrive a few at a time, e.g. as rows of an image decode,
+// building the transform once rather than on every call.  Opaque; please don't look inside,
+// and don't copy a stream once it's begun.
+typedef struct skcms_TransformStream {
+    uint64_t opaque[1024];
+} skcms_TransformStream;
+
+// Begin a stream writing its pixels one after another to dst.  The profiles must outlive it.
+// If this fails, pushes to the stream fail too, and ending it does nothing.
+SKCMS_API bool skcms_TransformStreamBegin(skcms_TransformStream*  stream,
+                                          skcms_PixelFormat       srcFmt,
+                                          skcms_AlphaFormat       srcAlpha,
+                                          const skcms_ICCProfile* srcProfile,
+                                          void*                   dst,
+                                          skcms_PixelFormat       dstFmt,
+                                          skcms_AlphaFormat       dstAlpha,
+                                          const skcms_ICCProfile* dstProfile);
+
+// Transform the next npixels src pixels.  Any that don't fill out a block of 16 are copied and
+// held back until a later push or skcms_TransformStreamEnd(), so the last few pixels pushed may
+// not be in dst yet.  src may alias the stream's next dst pixels if the formats are the same size.
+SKCMS_API bool skcms_TransformStreamPush(skcms_TransformStream* stream,
+                                         const void*            src,
+                                         size_t                 npixels);
+
+// Write out any pixels still held back.
+SKCMS_API void skcms_TransformStreamEnd(skcms_TransformStream* stream);
+
+// Custom per-pixel work for skcms_TransformBuilder: modify n pixels in place, held as separate
+// arrays of n red, green, blue, and alpha floats.  n varies from call to call, and the arrays may
+// include a few pixels padding out the end of a run, so treat each pixel independently.
+typedef void (*skcms_StageFn)(float* r, float* g, float* b, float* a, int n, void* ctx);
+
+// skcms_Transform() with extra stages spliced into the same pass over the pixels.  Appended
+// stages run in order on the destination's encoded, unpremultiplied values, just before they're
+// clamped and stored.  At most 32 ops may be appended: matrices and stages take one each, CLUTs
+// two, and curves one to three.  Opaque; please don't look inside, and don't copy a builder.
+typedef struct skcms_TransformBuilder {
+    uint64_t opaque[1536];
+} skcms_TransformBuilder;
+
+// Start building a transform.  The profiles must outlive the builder.
+SKCMS_API void skcms_TransformBuilder_Init(skcms_TransformBuilder* builder,
+                                           skcms_PixelFormat       srcFmt,
+                                           skcms_AlphaFormat       srcAlpha,
+                                           const skcms_ICCProfile* srcProfile,
+                                           skcms_PixelFormat       dstFmt,
+                                           skcms_AlphaFormat       dstAlpha,
+                                           const skcms_ICCProfile* dstProfile);
+
+// Append r,g,b = matrix * (r,g,b,1).
+SKCMS_API bool skcms_TransformBuilder_AppendMatrix(skcms_TransformBuilder* builder,
+                                                   const skcms_Matrix3x4*  matrix);
+
+// Append a curve for each of r,g,b.  Any tables must outlive the builder.
+SKCMS_API bool skcms_TransformBuilder_AppendCurves(skcms_TransformBuilder* builder,
+                                                   const skcms_Curve       curves[3]);
+
+// Append a 3D lookup table, laid out as in an ICC profile: r,g,b output triples, with the red
+// input varying slowest, and 16-bit samples big-endian.  Pass exactly one of grid_8 or grid_16,
+// which must outlive the builder.  Inputs are clamped to [0,1] first.
+SKCMS_API bool skcms_TransformBuilder_AppendCLUT(skcms_TransformBuilder* builder,
+                                                 const uint8_t           grid_points[3],
+                                                 const uint8_t*          grid_8,
+                                                 const uint8_t*          grid_16);
+
+// Append a call to fn, passing it ctx.
+SKCMS_API bool skcms_TransformBuilder_AppendStage(skcms_TransformBuilder* builder,
+                                                  skcms_StageFn           fn,
+                                                  void*                   ctx);
+
+// Transform npixels src pixels to dst as built so far.  Aliasing is as for skcms_Transform().
+SKCMS_API bool skcms_TransformBuilder_Run(skcms_TransformBuilder* builder,
+                                          const void*             src,
+                                          void*                   dst,
+                                          size_t                  npixels);
+
+// The samples of planar pixel buffers, one per pixel in each plane.
+typedef enum skcms_PlaneFormat {
+    skcms_PlaneFormat_8,   // uint8_t,  0-255
+    skcms_PlaneFormat_10,  // uint16_t, 0-1023,  in native byte order
+    skcms_PlaneFormat_16,  // uint16_t, 0-65535, in native byte order
+    skcms_PlaneFormat_h,   // half float,  not clamped, like skcms_PixelFormat_RGBA_hhhh
+    skcms_PlaneFormat_f,   // float,       not clamped, like skcms_PixelFormat_RGBA_ffff
+} skcms_PlaneFormat;
+
+// skcms_Transform() for planar pixels, with src[] and dst[] holding the R,G,B,A planes,
+// or C,M,Y,K for CMYK profiles.  Alpha planes may be null: a missing src alpha is opaque, and
+// a missing dst alpha is not written.  It is safe to alias dst[i] == src[i] if dstFmt == srcFmt.
+SKCMS_API bool skcms_TransformPlanar(const void* const       src[4],
+                                     skcms_PlaneFormat       srcFmt,
+                                     skcms_AlphaFormat       srcAlpha,
+                                     const skcms_ICCProfile* srcProfile,
+                                     void* const             dst[4],
+                                     skcms_PlaneFormat       dstFmt,
+                                     skcms_AlphaFormat       dstAlpha,
+                                     const skcms_ICCProfile* dstProfile,
+                                     size_t                  npixels);
+
+typedef enum skcms_ChromaSubsampling {
+    skcms_ChromaSubsampling_420,  // Chroma at half width and half height, e.g. I420, NV12, P010.
+    skcms_ChromaSubsampling_422,  // Chroma at half width and full height.
+} skcms_ChromaSubsampling;
+
+typedef enum skcms_ChromaFilter {
+    skcms_ChromaFilter_Nearest,   // Each chroma sample covers its 2x2 (or 2x1) block of pixels.
+    skcms_ChromaFilter_Bilinear,  // Interpolate between chroma samples.
+} skcms_ChromaFilter;
+
+// A subsampled YCbCr image.  Cb and Cr are either each in their own plane (I420), or
+// interleaved Cb,Cr in one plane at cb with cr null (NV12, P010).  The chroma planes hold
+// (width+1)/2 samples (or Cb,Cr pairs) per row.  Strides are in bytes, at least a row of
+// samples.  P010 is skcms_PlaneFormat_16, with its 10-bit values in the high bits of each
+// sample; _h and _f are not supported.
+typedef struct skcms_YUVImage {
+    const void*             y;
+    const void*             cb;
+    const void*             cr;
+    size_t                  y_stride;
+    size_t                  cb_stride;
+    size_t                  cr_stride;
+    int                     width;
+    int                     height;
+    skcms_PlaneFormat       format;
+    skcms_ChromaSubsampling subsampling;
+} skcms_YUVImage;
+
+// Transform a subsampled YCbCr image to width x height interleaved dst pixels, dstStride bytes
+// apart, reconstructing chroma with filter as each row loads.  srcProfile's CICP says how to
+// convert the YCbCr, as for skcms_Transform().  Chroma is sited as in H.264 and HEVC:
+// horizontally with even pixels, and for 4:2:0 vertically between pairs of rows.
+SKCMS_API bool skcms_TransformYUV(const skcms_YUVImage*   src,
+                                  skcms_ChromaFilter      filter,
+                                  const skcms_ICCProfile* srcProfile,
+                                  void*                   dst,
+                                  size_t                  dstStride,
+                                  skcms_PixelFormat       dstFmt,
+                                  skcms_AlphaFormat       dstAlpha,
+                                  const skcms_ICCProfile* dstProfile);
+
 // If profile can be used as a destination in skcms_Transform, return true. Otherwise, attempt to
 // rewrite it with approximations where reasonable. If successful, return true. If no reasonable
 // approximation exists, leave the profile unchanged and return false.
@@ -365,6 +749,35 @@ SKCMS_API bool skcms_MakeUsableAsDestination(skcms_ICCProfile* profile);
 // profile unchanged and return false.
 SKCMS_API bool skcms_MakeUsableAsDestinationWithSingleCurve(skcms_ICCProfile* profile);
 
+// Remembers the work done by skcms_MakeUsableAsDestination*Cached(), so that preparing the
+// same destination profile again costs a few hash lookups instead of fresh curve fits.
+// Curves are identified by content, with two independent 64-bit hashes of each curve's table
+// (or parametric) values and its table length, wherever the profile's buffer lives.
+//
+// Zero-initialize before first use.  A cache may be shared by any number of profiles,
+// but not by multiple threads at once.
+typedef struct skcms_CurveFitCache {
+    struct {
+        uint64_t               key;            // 0 marks an unused entry.
+        uint64_t               check;          // The second hash, checked on each hit.
+        uint32_t               table_entries;
+        skcms_TransferFunction tf;             // skcms_ApproximateCurve() of that curve.
+    } fit[16];
+
+    struct {
+        uint64_t key[3], check[3];            // Each of the original TRCs, as above.
+        uint32_t table_entries[3];
+        int      best;                        // Which of the three TRC fits to use for all.
+    } single[8];
+
+    uint32_t next_fit, next_single;   // Round-robin replacement.
+} skcms_CurveFitCache;
+
+// Like the functions above, reusing fits remembered in cache, which may be null.
+SKCMS_API bool skcms_MakeUsableAsDestinationCached(skcms_ICCProfile*, skcms_CurveFitCache*);
+SKCMS_API bool skcms_MakeUsableAsDestinationWithSingleCurveCached(skcms_ICCProfile*,
+                                                                   skcms_CurveFitCache*);
+
 // Returns a matrix to adapt XYZ color from given the whitepoint to D50.
 SKCMS_API bool skcms_AdaptToXYZD50(float wx, float wy,
                                    skcms_Matrix3x3* toXYZD50);
@@ -380,6 +793,11 @@ SKCMS_API bool skcms_PrimariesToXYZD50(float rx, float ry,
 // Call before your first call to skcms_Transform() to skip runtime CPU detection.
 SKCMS_API void skcms_DisableRuntimeCPUDetection(void);
 
+// Lets long 8888 and 1010102 transforms on x86-64 Linux run through code compiled at runtime.
+// This maps executable memory, so it's off by default; where it's off, or the system refuses
+// to map executable memory, transforms run through the interpreter as usual.
+SKCMS_API void skcms_EnableJIT(bool enable);
+
 // Utilities for programmatically constructing profiles
 static inline void skcms_Init(skcms_ICCProfile* p) {
     memset(p, 0, sizeof(*p));
@@ -661,7 +661,6 @@ static const char* profile_test_cases[] = {
 
     // Bad profiles found inn the wild
     "profiles/misc/ColorGATE_Sihl_PhotoPaper.icc",  // Broken tag table, and A2B0 fails to parse
-    "profiles/misc/bad_pcs.icc",                    // PCS is 'RGB '
 
     // Unsure what the bug here is, chromium:875650.
     "profiles/misc/ThinkpadX1YogaV2.icc",
@@ -676,6 +675,9 @@ static const char* profile_test_cases[] = {
     "profiles/misc/Rec2020_HLG_cicp.icc",
     "profiles/misc/Rec2020_PQ_cicp.icc",
 
+    // V2 device links, with their output color space where the PCS would be
+    "profiles/misc/bad_pcs.icc",  // RGB -> RGB, once rejected for its 'RGB ' PCS
+
     // fuzzer generated profiles that found parsing bugs
 
     // Bad tag table data - these should not parse
@@ -1355,6 +1357,123 @@ static void test_GrayscaleAndRGBCanBeEqual(void) {
     expect(skcms_ApproximatelyEqualProfiles(&gray, srgb));
 }
 
+static void test_Fingerprint(void) {
+    const char* filenames[] = {
+        "profiles/mobile/sRGB_parametric.icc",
+        "profiles/mobile/sRGB_LUT.icc",
+        "profiles/color.org/sRGB2014.icc",
+        "profiles/mobile/Display_P3_parametric.icc",
+        "profiles/misc/AdobeRGB.icc",
+        "profiles/misc/US_Web_Coated_SWOP_CMYK.icc",
+    };
+    enum { N = ARRAY_COUNT(filenames) + 1 };
+
+    void*             bufs[N] = {0};
+    skcms_ICCProfile  profiles[N];
+    skcms_Fingerprint fps[N];
+
+    profiles[0] = *skcms_sRGB_profile();
+    for (int i = 1; i < N; i++) {
+        size_t len;
+        expect(load_file(filenames[i-1], &bufs[i], &len));
+        expect(skcms_Parse(bufs[i], len, &profiles[i]));
+    }
+    for (int i = 0; i < N; i++) {
+        expect(skcms_ProfileFingerprint(&profiles[i], &fps[i]));
+    }
+
+    // Comparing fingerprints should always agree with comparing profiles.
+    for (int i = 0; i < N; i++)
+    for (int j = 0; j < N; j++) {
+        expect(skcms_ApproximatelyEqualFingerprints(&fps[i], &fps[j])
+            == skcms_ApproximatelyEqualProfiles(&profiles[i], &profiles[j]));
+    }
+    expect( skcms_ApproximatelyEqualFingerprints(&fps[0], &fps[1]));
+    expect(!skcms_ApproximatelyEqualFingerprints(&fps[0], &fps[4]));
+    expect(!skcms_ApproximatelyEqualFingerprints(&fps[0], &fps[N-1]));
+
+    // Profiles that behave identically should hash the same, even if tagged differently.
+    skcms_ICCProfile renamed = profiles[1];
+    renamed.data_color_space = skcms_Signature_Gray;
+    skcms_Fingerprint fp;
+    expect(skcms_ProfileFingerprint(&renamed, &fp));
+    expect(fp.hash == fps[1].hash);
+
+    for (int i = 0; i < N; i++) {
+        free(bufs[i]);
+    }
+}
+
+static void test_IdentifyProfile(void) {
+    // Build each known profile the long way and make sure the built-in fingerprints agree.
+    skcms_Matrix3x3 p3, adobe, rec2020;
+    expect(skcms_PrimariesToXYZD50(0.680f, 0.320f, 0.265f, 0.690f, 0.150f, 0.060f,
+                                   0.3127f, 0.3290f, &p3));
+    expect(skcms_PrimariesToXYZD50(0.64f, 0.33f, 0.21f, 0.71f, 0.15f, 0.06f,
+                                   0.3127f, 0.3290f, &adobe));
+    expect(skcms_PrimariesToXYZD50(0.708f, 0.292f, 0.170f, 0.797f, 0.131f, 0.046f,
+                                   0.3127f, 0.3290f, &rec2020));
+    skcms_TransferFunction gamma = {563/256.0f, 1,0,0,0,0,0}, pq, hlg;
+    expect(skcms_TransferFunction_makePQ (&pq));
+    // HLG profiles carry the curve scaled to [0,1], not makeHLG()'s [0,12].
+    expect(skcms_TransferFunction_makeScaledHLGish(&hlg, 1/12.0f, 2.0f, 2.0f,
+                                                   1/0.17883277f, 0.28466892f, 0.55991073f));
+
+    skcms_ICCProfile known[6];
+    known[0] = *skcms_sRGB_profile();
+    for (int i = 1; i < 5; i++) {
+        skcms_Init(&known[i]);
+    }
+    skcms_SetTransferFunction(&known[1], skcms_sRGB_TransferFunction());
+    skcms_SetTransferFunction(&known[2], &gamma);
+    skcms_SetTransferFunction(&known[3], &pq);
+    skcms_SetTransferFunction(&known[4], &hlg);
+    skcms_SetXYZD50(&known[1], &p3);
+    skcms_SetXYZD50(&known[2], &adobe);
+    skcms_SetXYZD50(&known[3], &rec2020);
+    skcms_SetXYZD50(&known[4], &rec2020);
+    known[5] = *skcms_XYZD50_profile();
+
+    for (int i = 0; i < 6; i++) {
+        const skcms_KnownProfile k = (skcms_KnownProfile)(i+1);
+        skcms_Fingerprint fp;
+        expect(skcms_ProfileFingerprint(&known[i], &fp));
+        expect(skcms_ApproximatelyEqualFingerprints(&fp, skcms_KnownProfileFingerprint(k)));
+        expect(skcms_IdentifyProfile(&known[i]) == k);
+    }
+    expect(!skcms_KnownProfileFingerprint(skcms_KnownProfile_Unknown));
+
+    // Embedded profiles should be identified too.
+    const struct {
+        const char*        filename;
+        skcms_KnownProfile want;
+    } cases[] = {
+        {"profiles/mobile/sRGB_parametric.icc",         skcms_KnownProfile_sRGB},
+        {"profiles/mobile/Display_P3_parametric.icc",   skcms_KnownProfile_DisplayP3},
+        {"profiles/misc/AdobeRGB.icc",                  skcms_KnownProfile_AdobeRGB},
+        {"profiles/misc/Rec2020_PQ_cicp.icc",           skcms_KnownProfile_Rec2020_PQ},
+        {"profiles/misc/Rec2020_HLG_cicp.icc",          skcms_KnownProfile_Rec2020_HLG},
+        {"profiles/misc/US_Web_Coated_SWOP_CMYK.icc",   skcms_KnownProfile_Unknown},
+    };
+    for (int i = 0; i < ARRAY_COUNT(cases); i++) {
+        void*  ptr;
+        size_t len;
+        expect(load_file(cases[i].filename, &ptr, &len));
+
+        skcms_ICCProfile profile;
+        expect(skcms_Parse(ptr, len, &profile));
+        expect(skcms_IdentifyProfile(&profile) == cases[i].want);
+
+        // skcms_ApproximatelyEqualProfiles() uses the built-in fingerprints for our
+        // static profiles, which should give the same answer as computing them.
+        skcms_ICCProfile srgb = *skcms_sRGB_profile();
+        expect(skcms_ApproximatelyEqualProfiles(&profile, skcms_sRGB_profile())
+            == skcms_ApproximatelyEqualProfiles(&profile, &srgb));
+
+        free(ptr);
+    }
+}
+
 static void test_Clamp(void) {
     // Test that we clamp out-of-gamut values when converting to fixed point,
     // not just to byte value range but also to gamut (for compatibility with
@@ -1717,6 +1836,1248 @@ static void test_HLG_invert(void) {
     expect(skcms_AreApproximateInverses(&inv_curve, &hlg));
 }
 
+static void test_ToneMap(void) {
+    // A PQ source and a linear destination with the same gamut, so each output pixel is what
+    // tone mapping made of it, in units of SDR white.
+    skcms_TransferFunction pq, pq_inv;
+    expect(skcms_TransferFunction_makePQ(&pq));
+    expect(skcms_TransferFunction_invert(&pq, &pq_inv));
+
+    skcms_ICCProfile src = *skcms_sRGB_profile(),
+                     dst = *skcms_sRGB_profile();
+    skcms_SetTransferFunction(&src, &pq);
+    skcms_SetTransferFunction(&dst, skcms_Identity_TransferFunction());
+
+    // 50, 1000, and 4000 nit grays, then 1000 nit red with 100 nits of green.
+    const float nits[][3] = {
+        {  50,   50,   50},
+        {1000, 1000, 1000},
+        {4000, 4000, 4000},
+        {1000,  100,    0},
+    };
+    float px[4*3], out[4*3];
+    for (int i = 0; i < 4*3; i++) {
+        px[i] = skcms_TransferFunction_eval(&pq_inv, nits[i/3][i%3] * (1/10000.0f));
+    }
+
+    skcms_ToneMap tm = { skcms_ToneMapCurve_BT2390, 1000, 203 };
+    expect(skcms_TransformWithToneMap(px,  skcms_PixelFormat_RGB_fff,
+                                           skcms_AlphaFormat_Unpremul, &src,
+                                      out, skcms_PixelFormat_RGB_fff,
+                                           skcms_AlphaFormat_Unpremul, &dst, 4, &tm));
+    // BT.2390 leaves the shadows alone, takes the source peak to SDR white, and clips past it.
+    expect(fabsf_(out[0] - 50/203.0f) < 0.01f);
+    expect(fabsf_(out[3] - 1) < 0.01f);
+    expect(fabsf_(out[6] - 1) < 0.01f);
+    // Channels scale together, keeping their ratios.
+    expect(fabsf_(out[ 9] - 1) < 0.01f);
+    expect(fabsf_(out[10] - 0.1f) < 0.01f);
+    expect(fabsf_(out[11]) < 0.001f);
+
+    tm.curve = skcms_ToneMapCurve_Reinhard;
+    expect(skcms_TransformWithToneMap(px,  skcms_PixelFormat_RGB_fff,
+                                           skcms_AlphaFormat_Unpremul, &src,
+                                      out, skcms_PixelFormat_RGB_fff,
+                                           skcms_AlphaFormat_Unpremul, &dst, 4, &tm));
+    // Reinhard compresses everything, and doesn't clip.
+    const float v = 50/203.0f, peak = 1000/203.0f;
+    expect(fabsf_(out[0] - v*(1 + v/(peak*peak))/(1 + v)) < 0.01f);
+    expect(fabsf_(out[3] - 1) < 0.01f);
+    expect(out[6] > 1.5f);
+
+    // An HLG source's peak signal lands at source_peak.
+    skcms_TransferFunction hlg;
+    expect(skcms_TransferFunction_makeHLG(&hlg));
+    skcms_SetTransferFunction(&src, &hlg);
+    const float white[3] = {1,1,1};
+    tm.curve = skcms_ToneMapCurve_BT2390;
+    expect(skcms_TransformWithToneMap(white, skcms_PixelFormat_RGB_fff,
+                                             skcms_AlphaFormat_Unpremul, &src,
+                                      out,   skcms_PixelFormat_RGB_fff,
+                                             skcms_AlphaFormat_Unpremul, &dst, 1, &tm));
+    expect(fabsf_(out[0] - 1) < 0.01f);
+
+    // There's nothing to tone map from an SDR source, or to the source profile itself,
+    // and the parameters need to make sense.
+    expect(!skcms_TransformWithToneMap(px,  skcms_PixelFormat_RGB_fff,
+                                            skcms_AlphaFormat_Unpremul, skcms_sRGB_profile(),
+                                       out, skcms_PixelFormat_RGB_fff,
+                                            skcms_AlphaFormat_Unpremul, &dst, 4, &tm));
+    expect(!skcms_TransformWithToneMap(px,  skcms_PixelFormat_RGB_fff,
+                                            skcms_AlphaFormat_Unpremul, &src,
+                                       out, skcms_PixelFormat_RGB_fff,
+                                            skcms_AlphaFormat_Unpremul, &src, 4, &tm));
+    tm.source_peak = 0;
+    expect(!skcms_TransformWithToneMap(px,  skcms_PixelFormat_RGB_fff,
+                                            skcms_AlphaFormat_Unpremul, &src,
+                                       out, skcms_PixelFormat_RGB_fff,
+                                            skcms_AlphaFormat_Unpremul, &dst, 4, &tm));
+}
+
+static void test_GamutMapping(void) {
+    // Linear Display P3 to linear sRGB, in floats so nothing else clamps.
+    skcms_ICCProfile p3   = *skcms_sRGB_profile(),
+                     srgb = *skcms_sRGB_profile();
+    p3.toXYZD50 = (skcms_Matrix3x3){{
+        { 0.51512146f  , 0.29197692f , 0.15710449f},
+        { 0.24119567f  , 0.6922454f  , 0.0665741f },
+        {-0.0010375976f, 0.041885376f, 0.7840728f },
+    }};
+    skcms_SetTransferFunction(&p3,   skcms_Identity_TransferFunction());
+    skcms_SetTransferFunction(&srgb, skcms_Identity_TransferFunction());
+
+    // P3's red, green, and a bright yellow are outside sRGB; gray and a muted orange are not.
+    const float px[][3] = {
+        {1.0f, 0.0f, 0.0f},
+        {0.0f, 1.0f, 0.0f},
+        {1.0f, 1.0f, 0.2f},
+        {0.5f, 0.5f, 0.5f},
+        {0.4f, 0.3f, 0.2f},
+    };
+    const int n = (int)(sizeof(px) / sizeof(*px));
+
+    float clipped[5][3], mapped[5][3];
+    expect(skcms_Transform(px,      skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Unpremul, &p3,
+                           clipped, skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Unpremul, &srgb,
+                           (size_t)n));
+
+    const float* w = srgb.toXYZD50.vals[1];
+    for (int m = skcms_GamutMapping_Desaturate; m <= skcms_GamutMapping_SoftClip; m++) {
+        expect(skcms_TransformWithGamutMapping(
+                    px,     skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Unpremul, &p3,
+                    mapped, skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Unpremul, &srgb,
+                    (size_t)n, (skcms_GamutMapping)m, NULL));
+
+        for (int i = 0; i < n; i++) {
+            // Everything lands in gamut, with its luminance intact.
+            float Y_want = 0, Y_got = 0;
+            for (int c = 0; c < 3; c++) {
+                expect(-0.0001f <= mapped[i][c] && mapped[i][c] <= 1.0001f);
+                Y_want += w[c] * clipped[i][c];
+                Y_got  += w[c] * mapped [i][c];
+            }
+            expect(fabsf_(Y_want - Y_got) < 0.001f);
+        }
+
+        // Gray and the muted orange are left alone.
+        for (int c = 0; c < 3; c++) {
+            expect(fabsf_(mapped[3][c] - clipped[3][c]) < 0.0001f);
+            expect(fabsf_(mapped[4][c] - clipped[4][c]) < 0.0001f);
+        }
+    }
+
+    // B2A destinations can only clip.
+    skcms_ICCProfile b2a = srgb;
+    b2a.has_B2A = true;
+    expect(!skcms_TransformWithGamutMapping(
+                px,     skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Unpremul, &p3,
+                mapped, skcms_PixelFormat_RGB_fff, skcms_AlphaFormat_Unpremul, &b2a,
+                (size_t)n, skcms_GamutMapping_Desaturate, NULL));
+}
+
+static void test_TransformImage(void) {
+    // A 37x5 float image in rows of 40 pixels, to 8888 rows of 38.
+    enum { W = 37, H = 5, SRC_ROW = 40, DST_ROW = 38 };
+    float    src[H][SRC_ROW][4];
+    uint32_t dst[H][DST_ROW],
+             want[W];
+    for (int y = 0; y < H; y++)
+    for (int x = 0; x < SRC_ROW; x++)
+    for (int c = 0; c < 4; c++) {
+        src[y][x][c] = (float)((x*7 + y*13 + c*29) % 256) * (1/255.0f);
+    }
+
+    // Without dithering, each row matches skcms_Transform(), leftover pixels and all.
+    expect(skcms_TransformImage(src, sizeof(*src), skcms_PixelFormat_RGBA_ffff,
+                                     skcms_AlphaFormat_Unpremul, NULL,
+                                dst, sizeof(*dst), skcms_PixelFormat_RGBA_8888,
+                                     skcms_AlphaFormat_Unpremul, NULL,
+                                W, H, skcms_Dither_None));
+    for (int y = 0; y < H; y++) {
+        expect(skcms_Transform(src[y], skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, NULL,
+                               want,   skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL,
+                               W));
+        expect(0 == memcmp(dst[y], want, sizeof(want)));
+    }
+
+    // A quarter of the way from 100 to 101, dithering should round a quarter of each tile up.
+    enum { DW = 48, DH = 16 };
+    static float    flat[DH][DW][4];
+    static uint32_t dithered[DH][DW];
+    for (int y = 0; y < DH; y++)
+    for (int x = 0; x < DW; x++) {
+        flat[y][x][0] = flat[y][x][1] = flat[y][x][2] = 100.25f * (1/255.0f);
+        flat[y][x][3] = 1.0f;
+    }
+    for (int d = skcms_Dither_Ordered; d <= skcms_Dither_BlueNoise; d++) {
+        expect(skcms_TransformImage(flat,     sizeof(*flat), skcms_PixelFormat_RGBA_ffff,
+                                              skcms_AlphaFormat_Unpremul, NULL,
+                                    dithered, sizeof(*dithered), skcms_PixelFormat_RGBA_8888,
+                                              skcms_AlphaFormat_Unpremul, NULL,
+                                    DW, DH, (skcms_Dither)d));
+        int ups[3] = {0,0,0};
+        for (int y = 0; y < DH; y++)
+        for (int x = 0; x < DW; x++) {
+            uint32_t px = dithered[y][x];
+            expect((px >> 24) == 0xff);  // Alpha isn't dithered.
+            for (int c = 0; c < 3; c++) {
+                uint32_t v = (px >> (8*c)) & 0xff;
+                expect(v == 100 || v == 101);
+                ups[c] += (v == 101);
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            expect(ups[c] == DW*DH/4);
+        }
+    }
+
+    // Dithered premultiplied color never passes alpha, even where alpha is just short of a level.
+    for (int y = 0; y < DH; y++)
+    for (int x = 0; x < DW; x++) {
+        flat[y][x][0] = flat[y][x][1] = flat[y][x][2] = 1.0f;
+        flat[y][x][3] = 100.4f * (1/255.0f);
+    }
+    for (int d = skcms_Dither_Ordered; d <= skcms_Dither_BlueNoise; d++) {
+        expect(skcms_TransformImage(flat,     sizeof(*flat), skcms_PixelFormat_RGBA_ffff,
+                                              skcms_AlphaFormat_Unpremul, NULL,
+                                    dithered, sizeof(*dithered), skcms_PixelFormat_RGBA_8888,
+                                              skcms_AlphaFormat_PremulAsEncoded, NULL,
+                                    DW, DH, (skcms_Dither)d));
+        for (int y = 0; y < DH; y++)
+        for (int x = 0; x < DW; x++) {
+            uint32_t px = dithered[y][x];
+            expect((px >> 24) == 100);
+            for (int c = 0; c < 3; c++) {
+                uint32_t v = (px >> (8*c)) & 0xff;
+                expect(v == 99 || v == 100);
+            }
+        }
+    }
+
+    // Rows can't be aliased at different strides.
+    expect(!skcms_TransformImage(dst, sizeof(*dst), skcms_PixelFormat_RGBA_8888,
+                                      skcms_AlphaFormat_Unpremul, NULL,
+                                 dst, 4*W,          skcms_PixelFormat_RGBA_8888,
+                                      skcms_AlphaFormat_Unpremul, NULL,
+                                 W, H, skcms_Dither_None));
+}
+
+static void test_TransformStream(void) {
+    enum { N = 1000 };
+    static uint32_t src[N];
+    static float    want[N][4],
+                    got [N][4];
+    for (int i = 0; i < N; i++) {
+        src[i] = (uint32_t)i * 0x01020305u;
+    }
+    expect(skcms_Transform(src,  skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 skcms_sRGB_profile(),
+                           want, skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                 skcms_XYZD50_profile(),
+                           N));
+
+    // Push the pixels in ragged chunks, some smaller than a block, some empty.
+    memset(got, 0xff, sizeof(got));
+    skcms_TransformStream stream;
+    expect(skcms_TransformStreamBegin(&stream,
+                                      skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                      skcms_sRGB_profile(),
+                                      got,
+                                      skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                      skcms_XYZD50_profile()));
+    const int chunks[] = { 1, 3, 0, 17, 20, 300, 5, 11, 400 };
+    int pushed = 0;
+    for (int i = 0; i < ARRAY_COUNT(chunks); i++) {
+        expect(skcms_TransformStreamPush(&stream, src + pushed, (size_t)chunks[i]));
+        pushed += chunks[i];
+    }
+    expect(skcms_TransformStreamPush(&stream, src + pushed, (size_t)(N - pushed)));
+
+    // Only whole blocks have been written so far.
+    const int written = N - N % 16;
+    expect(0 == memcmp(got, want, sizeof(float)*4*written));
+    uint32_t untouched;
+    memcpy(&untouched, &got[written][0], sizeof(untouched));
+    expect(untouched == 0xffffffff);
+
+    skcms_TransformStreamEnd(&stream);
+    expect(0 == memcmp(got, want, sizeof(got)));
+
+    // Transforming in place needs the formats to be the same size.
+    expect(skcms_TransformStreamBegin(&stream,
+                                      skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                      NULL,
+                                      src,
+                                      skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                      NULL));
+    expect(!skcms_TransformStreamPush(&stream, src, N));
+
+    // A stream that fails to begin refuses pushes, and ending it writes nothing.
+    skcms_ICCProfile unusable;
+    memset(&unusable, 0, sizeof(unusable));
+    memset(&stream, 0xff, sizeof(stream));
+    memset(got, 0xff, sizeof(got));
+    expect(!skcms_TransformStreamBegin(&stream,
+                                       skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                       skcms_sRGB_profile(),
+                                       got,
+                                       skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                       &unusable));
+    expect(!skcms_TransformStreamPush(&stream, src, N));
+    skcms_TransformStreamEnd(&stream);
+    memcpy(&untouched, &got[0][0], sizeof(untouched));
+    expect(untouched == 0xffffffff);
+}
+
+static void halve_red(float* r, float* g, float* b, float* a, int n, void* ctx) {
+    (void)g;
+    (void)b;
+    (void)a;
+    for (int i = 0; i < n; i++) {
+        r[i] *= 0.5f;
+    }
+    *(int*)ctx += n;
+}
+
+static void test_TransformBuilder(void) {
+    enum { N = 1000 };
+    static float src[N][4],
+                 dst[N][4];
+    for (int i = 0; i < N; i++) {
+        for (int c = 0; c < 4; c++) {
+            src[i][c] = (float)((i*7 + c*61) % 256) * (1/255.0f);
+        }
+    }
+
+    // Double red and offset blue, halve red again in a callback, then square r,g,b.
+    skcms_TransformBuilder builder;
+    skcms_TransformBuilder_Init(&builder,
+                                skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, NULL,
+                                skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, NULL);
+    const skcms_Matrix3x4 m = {{
+        { 2, 0, 0, 0.0f },
+        { 0, 1, 0, 0.0f },
+        { 0, 0, 1, 0.1f },
+    }};
+    int seen = 0;
+    skcms_Curve square[3];
+    for (int c = 0; c < 3; c++) {
+        square[c].table_entries = 0;
+        square[c].parametric = (skcms_TransferFunction){2, 1, 0, 0, 0, 0, 0};
+    }
+    expect(skcms_TransformBuilder_AppendMatrix(&builder, &m));
+    expect(skcms_TransformBuilder_AppendStage (&builder, halve_red, &seen));
+    expect(skcms_TransformBuilder_AppendCurves(&builder, square));
+    expect(skcms_TransformBuilder_Run(&builder, src, dst, N));
+
+    expect(seen >= N);
+    for (int i = 0; i < N; i++) {
+        const float want[4] = {
+            src[i][0] * src[i][0],
+            src[i][1] * src[i][1],
+            (src[i][2] + 0.1f) * (src[i][2] + 0.1f),
+            src[i][3],
+        };
+        for (int c = 0; c < 4; c++) {
+            expect(fabsf_(dst[i][c] - want[c]) < 0.002f);
+        }
+    }
+
+    // An identity CLUT, with inputs clamped to [0,1] first.
+    static const uint8_t grid_points[3] = { 2, 2, 2 };
+    static const uint8_t grid_8[2*2*2*3] = {
+          0,  0,  0,    0,  0,255,    0,255,  0,    0,255,255,
+        255,  0,  0,  255,  0,255,  255,255,  0,  255,255,255,
+    };
+    skcms_TransformBuilder_Init(&builder,
+                                skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, NULL,
+                                skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, NULL);
+    expect(!skcms_TransformBuilder_AppendCLUT(&builder, grid_points, NULL, NULL));
+    expect( skcms_TransformBuilder_AppendCLUT(&builder, grid_points, grid_8, NULL));
+    expect(skcms_TransformBuilder_Run(&builder, src, dst, N));
+    for (int i = 0; i < N; i++) {
+        for (int c = 0; c < 3; c++) {
+            expect(fabsf_(dst[i][c] - src[i][c]) < 0.0001f);
+        }
+    }
+
+    // Programs can run longer than skcms' own, up to 32 appended ops.
+    const skcms_Matrix3x4 I = {{
+        { 1, 0, 0, 0 },
+        { 0, 1, 0, 0 },
+        { 0, 0, 1, 0 },
+    }};
+    skcms_TransformBuilder_Init(&builder,
+                                skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                skcms_sRGB_profile(),
+                                skcms_PixelFormat_RGBA_8888_sRGB, skcms_AlphaFormat_PremulAsEncoded,
+                                skcms_XYZD50_profile());
+    for (int i = 0; i < 32; i++) {
+        expect(skcms_TransformBuilder_AppendMatrix(&builder, &I));
+    }
+    expect(!skcms_TransformBuilder_AppendMatrix(&builder, &I));
+
+    uint32_t px[N], want[N], got[N];
+    for (int i = 0; i < N; i++) {
+        px[i] = (uint32_t)i * 0x01030507u;
+    }
+    expect(skcms_Transform(px,   skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 skcms_sRGB_profile(),
+                           want, skcms_PixelFormat_RGBA_8888_sRGB,
+                                 skcms_AlphaFormat_PremulAsEncoded, skcms_XYZD50_profile(),
+                           N));
+    expect(skcms_TransformBuilder_Run(&builder, px, got, N));
+    expect(0 == memcmp(got, want, sizeof(got)));
+}
+
+static int max_channel_diff(const uint32_t* x, const uint32_t* y, int n) {
+    int worst = 0;
+    for (int i = 0; i < n; i++)
+    for (int c = 0; c < 32; c += 8) {
+        int d = (int)((x[i] >> c) & 0xff) - (int)((y[i] >> c) & 0xff);
+        d = d < 0 ? -d : d;
+        worst = d > worst ? d : worst;
+    }
+    return worst;
+}
+
+static void test_TransformChain(void) {
+    const char* filenames[] = {
+        "profiles/misc/US_Web_Coated_SWOP_CMYK.icc",
+        "profiles/misc/Coated_FOGRA39_CMYK.icc",
+    };
+    void*            bufs[2];
+    skcms_ICCProfile cmyk[2];
+    for (int i = 0; i < 2; i++) {
+        size_t len;
+        expect(load_file(filenames[i], &bufs[i], &len));
+        expect(skcms_Parse(bufs[i], len, &cmyk[i]));
+    }
+
+    enum { N = 300 };
+    static uint32_t src[N], want[N], got[N];
+    static float    a[N][4], b[N][4];
+    for (int i = 0; i < N; i++) {
+        src[i] = (uint32_t)i * 0x00030507u | 0xff000000u;
+    }
+
+    // sRGB -> SWOP -> FOGRA39 -> sRGB, first the long way through float buffers.
+    expect(skcms_Transform(src,  skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 skcms_sRGB_profile(),
+                           a,    skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                 &cmyk[0], N));
+    expect(skcms_Transform(a,    skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                 &cmyk[0],
+                           b,    skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                 &cmyk[1], N));
+    expect(skcms_Transform(b,    skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul,
+                                 &cmyk[1],
+                           want, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 skcms_sRGB_profile(), N));
+
+    const skcms_ICCProfile* chain[] = {
+        skcms_sRGB_profile(), &cmyk[0], &cmyk[1], skcms_sRGB_profile(),
+    };
+    expect(skcms_TransformChain(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                chain, ARRAY_COUNT(chain),
+                                got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                N));
+    expect(max_channel_diff(got, want, N) <= 1);
+
+    // A device-link CLUT baked from a chain approximates it, and matches it at grid points.
+    // (With 18 grid points, those fall on multiples of 15.)
+    static uint8_t grid_16[18*18*18*6];
+    const uint8_t grid_points[3] = { 18, 18, 18 };
+    expect(skcms_MakeDeviceLinkCLUT(chain, ARRAY_COUNT(chain), 18, grid_16));
+
+    skcms_TransformBuilder builder;
+    skcms_TransformBuilder_Init(&builder,
+                                skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL,
+                                skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL);
+    expect(skcms_TransformBuilder_AppendCLUT(&builder, grid_points, NULL, grid_16));
+    expect(skcms_TransformBuilder_Run(&builder, src, got, N));
+    expect(max_channel_diff(got, want, N) <= 6);
+
+    static uint32_t nodes[N];
+    for (int i = 0; i < N; i++) {
+        nodes[i] = (uint32_t)(15 * (i % 18)        ) <<  0
+                 | (uint32_t)(15 * (i / 18 % 18)   ) <<  8
+                 | (uint32_t)(15 * (i * 7 % 18)    ) << 16
+                 | 0xff000000u;
+    }
+    expect(skcms_TransformChain(nodes, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                chain, ARRAY_COUNT(chain),
+                                want, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                N));
+    expect(skcms_TransformBuilder_Run(&builder, nodes, got, N));
+    expect(max_channel_diff(got, want, N) <= 1);
+
+    // Chains need at least a src and dst, and at most 8 profiles.
+    const skcms_ICCProfile* long_chain[9];
+    for (int i = 0; i < 9; i++) {
+        long_chain[i] = skcms_sRGB_profile();
+    }
+    expect(!skcms_TransformChain(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 long_chain, 1,
+                                 got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 N));
+    expect(!skcms_TransformChain(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 long_chain, 9,
+                                 got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 N));
+    expect( skcms_TransformChain(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 long_chain, 8,
+                                 got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 N));
+    expect(0 == memcmp(got, src, sizeof(got)));
+
+    // Eight profiles with distinct per-channel curves, so each hop takes six curve ops.
+    // Going back and forth between two lands where going straight from the first to the last does.
+    skcms_ICCProfile gammas[2];
+    const float g[2][3] = { {2.2f, 2.3f, 2.4f}, {2.5f, 2.6f, 2.7f} };
+    for (int k = 0; k < 2; k++) {
+        gammas[k] = *skcms_sRGB_profile();
+        for (int c = 0; c < 3; c++) {
+            skcms_TransferFunction tf = {g[k][c], 1,0,0,0,0,0};
+            gammas[k].trc[c].parametric = tf;
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        long_chain[i] = &gammas[i % 2];
+    }
+    expect(skcms_Transform(src,  skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 &gammas[0],
+                           want, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                 &gammas[1], N));
+    expect(skcms_TransformChain(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                long_chain, 8,
+                                got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                N));
+    expect(max_channel_diff(got, want, N) <= 1);
+    static uint8_t long_grid_16[5*5*5*6];
+    expect(skcms_MakeDeviceLinkCLUT(long_chain, 8, 5, long_grid_16));
+
+    for (int i = 0; i < 2; i++) {
+        free(bufs[i]);
+    }
+}
+
+// Writes chain out as a device link, reads it back, and returns how far transforming src through
+// it lands from running the chain itself.  CMYK pixels are RGBA_8888 too, with K in alpha.
+static int device_link_error(const skcms_ICCProfile* const* chain, int nchain,
+                             uint8_t grid_points, int bytes_per_sample,
+                             const uint32_t* src, int n) {
+    size_t len = 0;
+    expect(skcms_WriteDeviceLink(chain, nchain, grid_points, bytes_per_sample, NULL, &len));
+
+    void* buf = malloc(len);
+    size_t short_len = len - 1;
+    expect(!skcms_WriteDeviceLink(chain, nchain, grid_points, bytes_per_sample, buf, &short_len));
+    expect( skcms_WriteDeviceLink(chain, nchain, grid_points, bytes_per_sample, buf, &len));
+
+    skcms_ICCProfile link, lazy;
+    expect(skcms_Parse    (buf, len, &link));
+    expect(skcms_ParseLazy(buf, len, &lazy));
+
+    uint32_t* want = malloc((size_t)n * sizeof(uint32_t));
+    uint32_t* got  = malloc((size_t)n * sizeof(uint32_t));
+    expect(skcms_TransformChain(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                chain, nchain,
+                                want, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                                (size_t)n));
+    expect(skcms_Transform(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &link,
+                           got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL,
+                           (size_t)n));
+    int err = max_channel_diff(got, want, n);
+
+    // Lazily parsed links work too, and a link is its own dst.
+    expect(skcms_Transform(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &lazy,
+                           want, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &lazy,
+                           (size_t)n));
+    expect(0 == memcmp(got, want, (size_t)n * sizeof(uint32_t)));
+
+    // But a link is the whole conversion, so it can't convert on to another dst.
+    expect(!skcms_Transform(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &link,
+                            got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                            skcms_sRGB_profile(), (size_t)n));
+
+    free(want);
+    free(got);
+    free(buf);
+    return err;
+}
+
+static void test_WriteDeviceLink(void) {
+    const char* filenames[] = {
+        "profiles/misc/US_Web_Coated_SWOP_CMYK.icc",
+        "profiles/misc/Coated_FOGRA39_CMYK.icc",
+    };
+    void*            bufs[2];
+    skcms_ICCProfile cmyk[2];
+    for (int i = 0; i < 2; i++) {
+        size_t len;
+        expect(load_file(filenames[i], &bufs[i], &len));
+        expect(skcms_Parse(bufs[i], len, &cmyk[i]));
+    }
+
+    enum { N = 300 };
+    static uint32_t src[N], opaque[N], nodes[N];
+    for (int i = 0; i < N; i++) {
+        src[i]    = (uint32_t)i * 0x07050301u + 0x0f0d0b09u;
+        opaque[i] = src[i] | 0xff000000u;
+        // With 18 grid points, nodes fall on multiples of 15.
+        nodes[i] = (uint32_t)(15 * (i % 18)     ) <<  0
+                 | (uint32_t)(15 * (i / 18 % 18)) <<  8
+                 | (uint32_t)(15 * (i * 7 % 18) ) << 16
+                 | 0xff000000u;
+    }
+
+    const skcms_ICCProfile* to_cmyk[]   = { skcms_sRGB_profile(), &cmyk[0] };
+    const skcms_ICCProfile* from_cmyk[] = { &cmyk[0], skcms_sRGB_profile() };
+    const skcms_ICCProfile* rgb[]       = { skcms_sRGB_profile(), &cmyk[0], &cmyk[1],
+                                            skcms_sRGB_profile() };
+
+    // Links approximate their chains between grid points, and match them on the grid.
+    // (Chains through CMYK come out opaque, where RGB -> RGB links keep src alpha.)
+    expect(device_link_error(to_cmyk,   2, 18, 2, opaque, N) <=  6);
+    expect(device_link_error(to_cmyk,   2, 18, 1, nodes,  N) <=  1);
+    expect(device_link_error(from_cmyk, 2,  9, 2, src,    N) <= 10);
+    expect(device_link_error(from_cmyk, 2, 18, 1, nodes,  N) <=  1);
+    expect(device_link_error(rgb,       4, 18, 1, opaque, N) <=  5);
+    expect(device_link_error(rgb,       4, 18, 2, nodes,  N) <=  1);
+
+    // Samples are 1 or 2 bytes, and ends must be RGB or CMYK.
+    size_t len = 0;
+    skcms_ICCProfile gray_profile = *skcms_sRGB_profile();
+    gray_profile.data_color_space = skcms_Signature_Gray;
+    const skcms_ICCProfile* gray[] = { skcms_sRGB_profile(), &gray_profile };
+    expect(!skcms_WriteDeviceLink(to_cmyk, 2, 18, 4, NULL, &len));
+    expect(!skcms_WriteDeviceLink(to_cmyk, 2,  1, 2, NULL, &len));
+    expect(!skcms_WriteDeviceLink(gray,    2, 18, 2, NULL, &len));
+
+    for (int i = 0; i < 2; i++) {
+        free(bufs[i]);
+    }
+}
+
+static void test_Precision(void) {
+    skcms_TransferFunction gamma = {2.2f, 1,0,0,0,0,0}, hlg;
+    expect(skcms_TransferFunction_makeHLG(&hlg));
+
+    skcms_ICCProfile srgb   = *skcms_XYZD50_profile(),
+                     gam    = *skcms_XYZD50_profile(),
+                     hdr    = *skcms_XYZD50_profile(),
+                     linear = *skcms_XYZD50_profile();
+    skcms_SetTransferFunction(&srgb, skcms_sRGB_TransferFunction());
+    skcms_SetTransferFunction(&gam , &gamma);
+    skcms_SetTransferFunction(&hdr , &hlg);
+
+    // Each decodes (0.5, 0.75, 1.0, 1.0), with these exact results.
+    const struct {
+        const skcms_ICCProfile* profile;
+        float                   want[4];
+    } cases[] = {
+        {&srgb, {0.21404114f, 0.52252155f, 1.0f, 1.0f}},
+        {&gam,  {0.21763764f, 0.53104923f, 1.0f, 1.0f}},
+        {&hdr,  {1.0f,        3.17955072f, 12.0f, 1.0f}},
+    };
+
+    // Every precision should be good enough for 8-bit output, and precise much better.
+    const float tol[] = { 1/1024.0f, 1/1024.0f, 1/1048576.0f };
+    for (int p = 0; p < 3; p++)
+    for (int i = 0; i < ARRAY_COUNT(cases); i++) {
+        const float src[] = { 0.5f, 0.75f, 1.0f, 1.0f };
+        float dst[4];
+        expect(skcms_TransformWithPrecision(
+                    src, skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, cases[i].profile,
+                    dst, skcms_PixelFormat_RGBA_ffff, skcms_AlphaFormat_Unpremul, &linear,
+                    1, (skcms_Precision)p));
+        for (int j = 0; j < 4; j++) {
+            float scale = cases[i].want[2];  // Tolerances are relative to full range.
+            expect(fabsf_(dst[j] - cases[i].want[j]) <= tol[p] * scale);
+        }
+    }
+
+    // The default precision is what skcms_Transform() uses, and short of running in half
+    // floats, the fast precision is the same.
+    const uint8_t src[] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0 };
+    uint16_t want[4*2], got[4*2];
+    expect(skcms_Transform(
+                src,  skcms_PixelFormat_RGBA_8888,       skcms_AlphaFormat_Unpremul, &srgb,
+                want, skcms_PixelFormat_RGBA_16161616LE, skcms_AlphaFormat_Unpremul, &gam, 2));
+    for (int p = 0; p < 2; p++) {
+        expect(skcms_TransformWithPrecision(
+                    src,  skcms_PixelFormat_RGBA_8888,       skcms_AlphaFormat_Unpremul, &srgb,
+                    got,  skcms_PixelFormat_RGBA_16161616LE, skcms_AlphaFormat_Unpremul, &gam, 2,
+                    p == 0 ? skcms_Precision_Default : skcms_Precision_Fast));
+        expect(0 == memcmp(want, got, sizeof(want)));
+    }
+}
+
+static void test_Precision_HalfFloat(void) {
+    // skcms_Precision_Fast may run big enough 8- and 10-bit transforms in half floats,
+    // but only when that stays within 1 LSB of the float pipeline.
+    skcms_TransferFunction gamma = {2.2f, 1,0,0,0,0,0};
+    skcms_ICCProfile srgb = *skcms_XYZD50_profile(),
+                     gam  = *skcms_XYZD50_profile();
+    skcms_SetTransferFunction(&srgb, skcms_sRGB_TransferFunction());
+    skcms_SetTransferFunction(&gam , &gamma);
+
+    const skcms_PixelFormat fmts[] = {
+        skcms_PixelFormat_RGB_888,
+        skcms_PixelFormat_RGBA_8888,
+        skcms_PixelFormat_BGRA_8888,
+        skcms_PixelFormat_RGBA_1010102,
+    };
+
+    const int n = 32768 + 7;
+    uint8_t* src  = malloc(4 * (size_t)n);
+    uint8_t* want = malloc(4 * (size_t)n);
+    uint8_t* got  = malloc(4 * (size_t)n);
+    for (int i = 0; i < 4*n; i++) {
+        src[i] = skcms_252_random_bytes[i % 252];
+    }
+
+    for (int i = 0; i < ARRAY_COUNT(fmts); i++) {
+        expect(skcms_TransformWithPrecision(
+                    src,  fmts[i], skcms_AlphaFormat_Unpremul, &srgb,
+                    want, fmts[i], skcms_AlphaFormat_Unpremul, &gam,
+                    (size_t)n, skcms_Precision_Default));
+        expect(skcms_TransformWithPrecision(
+                    src,  fmts[i], skcms_AlphaFormat_Unpremul, &srgb,
+                    got,  fmts[i], skcms_AlphaFormat_Unpremul, &gam,
+                    (size_t)n, skcms_Precision_Fast));
+
+        if (fmts[i] == skcms_PixelFormat_RGBA_1010102) {
+            for (int j = 0; j < n; j++) {
+                uint32_t w, g;
+                memcpy(&w, want + 4*j, 4);
+                memcpy(&g, got  + 4*j, 4);
+                for (int shift = 0; shift < 32; shift += 10) {
+                    const int mask = shift == 30 ? 0x3 : 0x3ff;
+                    expect(abs((int)(w >> shift & mask) - (int)(g >> shift & mask)) <= 1);
+                }
+            }
+        } else {
+            const int bytes = n * (fmts[i] == skcms_PixelFormat_RGB_888 ? 3 : 4);
+            for (int j = 0; j < bytes; j++) {
+                expect(abs((int)want[j] - (int)got[j]) <= 1);
+            }
+        }
+    }
+
+    free(src);
+    free(want);
+    free(got);
+
+    // Wide-to-narrow gamut conversions mix channels in their matrix and then encode steeply
+    // near 0, where half floats would land several LSB off (Display P3 0x00ff77 to sRGB, say).
+    // Those pixels lie on the faces of the cube, so check every pixel with a channel at 0.
+    const char* wide[] = {
+        "profiles/mobile/Display_P3_parametric.icc",
+        "profiles/misc/AdobeRGB.icc",
+    };
+    const int face = 3 * 65536;
+    uint32_t* face_src  = malloc(sizeof(uint32_t) * (size_t)face);
+    uint32_t* face_want = malloc(sizeof(uint32_t) * (size_t)face);
+    uint32_t* face_got  = malloc(sizeof(uint32_t) * (size_t)face);
+    for (int i = 0; i < face; i++) {
+        const uint32_t lo = (uint32_t)i & 0xff,
+                       hi = (uint32_t)i >> 8 & 0xff;
+        switch (i / 65536) {
+            case 0: face_src[i] = 0xff000000 |             hi << 16 | lo << 8; break;
+            case 1: face_src[i] = 0xff000000 | hi << 16 |              lo     ; break;
+            case 2: face_src[i] = 0xff000000 |             hi <<  8 | lo     ; break;
+        }
+    }
+
+    for (int i = 0; i < ARRAY_COUNT(wide); i++) {
+        void*  ptr;
+        size_t len;
+        skcms_ICCProfile profile;
+        expect(load_file(wide[i], &ptr, &len));
+        expect(skcms_Parse(ptr, len, &profile));
+
+        expect(skcms_TransformWithPrecision(
+                    face_src,  skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &profile,
+                    face_want, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                    skcms_sRGB_profile(), (size_t)face, skcms_Precision_Default));
+        expect(skcms_TransformWithPrecision(
+                    face_src,  skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &profile,
+                    face_got,  skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                    skcms_sRGB_profile(), (size_t)face, skcms_Precision_Fast));
+        for (int j = 0; j < face; j++)
+        for (int shift = 0; shift < 32; shift += 8) {
+            expect(abs((int)(face_want[j] >> shift & 0xff) -
+                       (int)(face_got [j] >> shift & 0xff)) <= 1);
+        }
+        free(ptr);
+    }
+
+    free(face_src);
+    free(face_want);
+    free(face_got);
+}
+
+static void test_JIT(void) {
+    // With the JIT enabled, long transforms may run through JIT-compiled code.  It should match
+    // the interpreter, which runs the short transforms here, with AVX-512 code where the machine
+    // has it, and with AVX2 code.
+    skcms_TransferFunction gamma = {2.2f, 1,0,0,0,0,0};
+    skcms_ICCProfile srgb = *skcms_XYZD50_profile(),
+                     gam  = *skcms_XYZD50_profile();
+    skcms_SetTransferFunction(&srgb, skcms_sRGB_TransferFunction());
+    skcms_SetTransferFunction(&gam , &gamma);
+
+    const struct {
+        skcms_PixelFormat       fmt;
+        skcms_AlphaFormat       srcAlpha, dstAlpha;
+        const skcms_ICCProfile* srcProfile;
+        const skcms_ICCProfile* dstProfile;
+    } cases[] = {
+        { skcms_PixelFormat_RGBA_8888,    skcms_AlphaFormat_Unpremul,
+                                          skcms_AlphaFormat_Unpremul,        &srgb, &gam  },
+        { skcms_PixelFormat_BGRA_8888,    skcms_AlphaFormat_PremulAsEncoded,
+                                          skcms_AlphaFormat_Unpremul,        &gam,  &srgb },
+        { skcms_PixelFormat_RGBA_8888,    skcms_AlphaFormat_Unpremul,
+                                          skcms_AlphaFormat_PremulAsEncoded, &srgb, NULL  },
+        { skcms_PixelFormat_RGBA_1010102, skcms_AlphaFormat_Unpremul,
+                                          skcms_AlphaFormat_Opaque,          &gam,  &srgb },
+    };
+
+    const int n = 4096 + 5,
+              chunk = 255;
+    uint32_t* src  = malloc(4 * (size_t)n);
+    uint32_t* want = malloc(4 * (size_t)n);
+    uint32_t* got  = malloc(4 * (size_t)n);
+    for (int i = 0; i < n; i++) {
+        const uint8_t* b = skcms_252_random_bytes + (i*4 + i/63) % 248;
+        src[i] = (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+    }
+
+    skcms_EnableJIT(true);
+    for (int avx512 = 1; avx512 >= 0; avx512--)
+    for (int c = 0; c < ARRAY_COUNT(cases); c++) {
+        skcms_AllowJITAVX512(avx512);
+        expect(skcms_Transform(src, cases[c].fmt, cases[c].srcAlpha, cases[c].srcProfile,
+                               got, cases[c].fmt, cases[c].dstAlpha, cases[c].dstProfile,
+                               (size_t)n));
+        for (int i = 0; i < n; i += chunk) {
+            const int len = n - i < chunk ? n - i : chunk;
+            expect(skcms_Transform(src  + i, cases[c].fmt, cases[c].srcAlpha, cases[c].srcProfile,
+                                   want + i, cases[c].fmt, cases[c].dstAlpha, cases[c].dstProfile,
+                                   (size_t)len));
+        }
+        expect(0 == memcmp(want, got, 4 * (size_t)n));
+    }
+    skcms_AllowJITAVX512(true);
+    skcms_EnableJIT(false);
+
+    free(src);
+    free(want);
+    free(got);
+}
+
+static void test_Blocks(void) {
+    // Whole-image transforms may run their programs in blocks of vectors, and in the gcc.blocks
+    // and gcc.noblocks builds always or never do.  Either way they should match transforming a
+    // pixel at a time, which never does.  These cases cover a short program, a long one, and
+    // one with a CLUT.
+    void  *lut_ptr, *adobe_ptr, *cmyk_ptr;
+    size_t lut_len,  adobe_len,  cmyk_len;
+    skcms_ICCProfile lut, adobe, cmyk;
+    expect(load_file("profiles/mobile/sRGB_LUT.icc", &lut_ptr, &lut_len));
+    expect(load_file("profiles/misc/AdobeRGB.icc", &adobe_ptr, &adobe_len));
+    expect(load_file("profiles/misc/Coated_FOGRA39_CMYK.icc", &cmyk_ptr, &cmyk_len));
+    expect(skcms_Parse(lut_ptr, lut_len, &lut));
+    expect(skcms_Parse(adobe_ptr, adobe_len, &adobe));
+    expect(skcms_Parse(cmyk_ptr, cmyk_len, &cmyk));
+
+    skcms_TransferFunction gamma = {2.2f, 1,0,0,0,0,0};
+    skcms_ICCProfile gam = *skcms_sRGB_profile();
+    skcms_SetTransferFunction(&gam, &gamma);
+
+    const struct {
+        const skcms_ICCProfile* srcProfile;
+        const skcms_ICCProfile* dstProfile;
+    } cases[] = {
+        { skcms_sRGB_profile(), &gam                },
+        { &lut,                 &adobe              },
+        { &cmyk,                skcms_sRGB_profile() },
+    };
+
+    enum { n = 1000 + 3 };
+    uint32_t src[n], want[n], got[n];
+    for (int i = 0; i < n; i++) {
+        const uint8_t* b = skcms_252_random_bytes + (i*4 + i/63) % 248;
+        src[i] = (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+    }
+
+    for (int c = 0; c < ARRAY_COUNT(cases); c++) {
+        expect(skcms_Transform(src, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                               cases[c].srcProfile,
+                               got, skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul,
+                               cases[c].dstProfile,
+                               n));
+        for (int i = 0; i < n; i++) {
+            expect(skcms_Transform(src  + i, skcms_PixelFormat_RGBA_8888,
+                                   skcms_AlphaFormat_Unpremul, cases[c].srcProfile,
+                                   want + i, skcms_PixelFormat_RGBA_8888,
+                                   skcms_AlphaFormat_Unpremul, cases[c].dstProfile,
+                                   1));
+        }
+        expect(0 == memcmp(want, got, sizeof(got)));
+    }
+
+    free(lut_ptr);
+    free(adobe_ptr);
+    free(cmyk_ptr);
+}
+
+static void test_Planar(void) {
+    // Planar transforms should match interleaved ones exactly, leftover pixels and all.
+    const struct {
+        skcms_PlaneFormat plane;
+        skcms_PixelFormat interleaved;
+        size_t            bytes;
+    } fmts[] = {
+        {skcms_PlaneFormat_8,  skcms_PixelFormat_RGBA_8888,       1},
+        {skcms_PlaneFormat_16, skcms_PixelFormat_RGBA_16161616LE, 2},
+        {skcms_PlaneFormat_h,  skcms_PixelFormat_RGBA_hhhh,       2},
+        {skcms_PlaneFormat_f,  skcms_PixelFormat_RGBA_ffff,       4},
+    };
+
+    skcms_TransferFunction gamma = {2.2f, 1,0,0,0,0,0};
+    skcms_ICCProfile gam = *skcms_sRGB_profile();
+    skcms_SetTransferFunction(&gam, &gamma);
+
+    enum { n = 63 };  // Three 16-pixel blocks and 15 more.
+    float src[4*n], src_planes[4][n],
+          want[4*n], dst_planes[4][n];
+
+    for (int s = 0; s < ARRAY_COUNT(fmts); s++)
+    for (int d = 0; d < ARRAY_COUNT(fmts); d++)
+    for (int alpha = 0; alpha < 2; alpha++) {
+        const size_t sb = fmts[s].bytes,
+                     db = fmts[d].bytes;
+
+        expect(skcms_Transform(skcms_252_random_bytes, skcms_PixelFormat_RGBA_8888,
+                               skcms_AlphaFormat_Unpremul, NULL,
+                               src, fmts[s].interleaved, skcms_AlphaFormat_Unpremul, NULL, n));
+        for (int i = 0; i < n; i++)
+        for (int c = 0; c < 4; c++) {
+            memcpy((char*)src_planes[c] + (size_t)i*sb, (const char*)src + (size_t)(4*i+c)*sb, sb);
+        }
+
+        expect(skcms_Transform(src,  fmts[s].interleaved,
+                               alpha ? skcms_AlphaFormat_Unpremul : skcms_AlphaFormat_Opaque,
+                               skcms_sRGB_profile(),
+                               want, fmts[d].interleaved, skcms_AlphaFormat_Unpremul, &gam, n));
+
+        const void* srcs[4] = { src_planes[0], src_planes[1], src_planes[2],
+                                alpha ? src_planes[3] : NULL };
+        void*       dsts[4] = { dst_planes[0], dst_planes[1], dst_planes[2],
+                                alpha ? dst_planes[3] : NULL };
+        expect(skcms_TransformPlanar(srcs, fmts[s].plane, skcms_AlphaFormat_Unpremul,
+                                     skcms_sRGB_profile(),
+                                     dsts, fmts[d].plane, skcms_AlphaFormat_Unpremul, &gam, n));
+
+        for (int i = 0; i < n; i++)
+        for (int c = 0; c < (alpha ? 4 : 3); c++) {
+            expect(0 == memcmp((const char*)dst_planes[c] + (size_t)i*db,
+                               (const char*)want + (size_t)(4*i+c)*db, db));
+        }
+    }
+
+    // Only alpha planes may be missing, and planes transform in place only if their size holds.
+    const void* srcs[4] = { src_planes[0], NULL, src_planes[2], NULL };
+    void*       dsts[4] = { dst_planes[0], dst_planes[1], dst_planes[2], NULL };
+    expect(!skcms_TransformPlanar(srcs, skcms_PlaneFormat_f, skcms_AlphaFormat_Unpremul, NULL,
+                                  dsts, skcms_PlaneFormat_f, skcms_AlphaFormat_Unpremul, NULL, n));
+
+    const void* same[4] = { dst_planes[0], dst_planes[1], dst_planes[2], NULL };
+    expect( skcms_TransformPlanar(same, skcms_PlaneFormat_f, skcms_AlphaFormat_Unpremul, NULL,
+                                  dsts, skcms_PlaneFormat_f, skcms_AlphaFormat_Unpremul, NULL, n));
+    expect(!skcms_TransformPlanar(same, skcms_PlaneFormat_f, skcms_AlphaFormat_Unpremul, NULL,
+                                  dsts, skcms_PlaneFormat_8, skcms_AlphaFormat_Unpremul, NULL, n));
+}
+
+static void test_YCbCr(void) {
+    // sRGB, but with its pixels in BT.709 limited-range YCbCr.
+    skcms_ICCProfile ycbcr = *skcms_sRGB_profile();
+    const skcms_CICP bt709 = { 1, 13, 1, 0 };
+    ycbcr.has_CICP = true;
+    ycbcr.CICP     = bt709;
+
+    // Black, white, gray, and red.
+    const uint8_t src[] = {
+         16,128,128,
+        235,128,128,
+        126,128,128,
+         63,102,240,
+    };
+    const uint8_t want[] = {
+          0,  0,  0,
+        255,255,255,
+        128,128,128,
+        255,  0,  0,
+    };
+    uint8_t dst[ARRAY_COUNT(src)];
+    expect(skcms_Transform(src, skcms_PixelFormat_RGB_888, skcms_AlphaFormat_Unpremul, &ycbcr,
+                           dst, skcms_PixelFormat_RGB_888, skcms_AlphaFormat_Unpremul, NULL,
+                           ARRAY_COUNT(src)/3));
+    for (int i = 0; i < ARRAY_COUNT(src); i++) {
+        expect(abs((int)dst[i] - (int)want[i]) <= 1);
+    }
+
+    // RGB should round trip through full-range BT.2020 YCbCr in 10-bit planes,
+    // and through each matrix and range in 16-bit.
+    skcms_ICCProfile full = ycbcr;
+    full.CICP.matrix_coefficients   = 9;
+    full.CICP.video_full_range_flag = 1;
+
+    enum { n = 84 };
+    uint16_t planes[3][n];
+    uint8_t back[3*n];
+    const void* rgb_src[4] = { NULL };
+    void*       yuv_dst[4] = { planes[0], planes[1], planes[2], NULL };
+    uint8_t rgb_planes[3][n];
+    for (int i = 0; i < n; i++)
+    for (int c = 0; c < 3; c++) {
+        rgb_planes[c][i] = skcms_252_random_bytes[3*i+c];
+    }
+    for (int c = 0; c < 3; c++) {
+        rgb_src[c] = rgb_planes[c];
+    }
+    expect(skcms_TransformPlanar(rgb_src, skcms_PlaneFormat_8,  skcms_AlphaFormat_Unpremul, NULL,
+                                 yuv_dst, skcms_PlaneFormat_10, skcms_AlphaFormat_Unpremul, &full,
+                                 n));
+    for (int c = 0; c < 3; c++)
+    for (int i = 0; i < n; i++) {
+        expect(planes[c][i] <= 1023);
+    }
+
+    const void* yuv_src[4] = { planes[0], planes[1], planes[2], NULL };
+    void*       rgb_dst[4] = { back, back + n, back + 2*n, NULL };
+    expect(skcms_TransformPlanar(yuv_src, skcms_PlaneFormat_10, skcms_AlphaFormat_Unpremul, &full,
+                                 rgb_dst, skcms_PlaneFormat_8,  skcms_AlphaFormat_Unpremul, NULL,
+                                 n));
+    for (int c = 0; c < 3; c++)
+    for (int i = 0; i < n; i++) {
+        expect(back[c*n + i] == rgb_planes[c][i]);
+    }
+
+    const uint8_t mcs[] = { 1, 5, 6, 9 };
+    for (int m = 0; m < ARRAY_COUNT(mcs); m++)
+    for (int range = 0; range < 2; range++) {
+        skcms_ICCProfile p = ycbcr;
+        p.CICP.matrix_coefficients   = mcs[m];
+        p.CICP.video_full_range_flag = (uint8_t)range;
+
+        uint16_t yuv[3*n];
+        expect(skcms_Transform(skcms_252_random_bytes, skcms_PixelFormat_RGB_888,
+                               skcms_AlphaFormat_Unpremul, NULL,
+                               yuv, skcms_PixelFormat_RGB_161616LE,
+                               skcms_AlphaFormat_Unpremul, &p, n));
+        expect(skcms_Transform(yuv,  skcms_PixelFormat_RGB_161616LE,
+                               skcms_AlphaFormat_Unpremul, &p,
+                               back, skcms_PixelFormat_RGB_888,
+                               skcms_AlphaFormat_Unpremul, NULL, n));
+        expect(0 == memcmp(back, skcms_252_random_bytes, sizeof(back)));
+    }
+
+    // Premultiplied YCbCr and unknown matrix coefficients are rejected.
+    expect(!skcms_Transform(src, skcms_PixelFormat_RGBA_8888,
+                            skcms_AlphaFormat_PremulAsEncoded, &ycbcr,
+                            dst, skcms_PixelFormat_RGBA_8888,
+                            skcms_AlphaFormat_Unpremul, NULL, 1));
+    ycbcr.CICP.matrix_coefficients = 10;
+    expect(!skcms_Transform(src, skcms_PixelFormat_RGB_888, skcms_AlphaFormat_Unpremul, &ycbcr,
+                            dst, skcms_PixelFormat_RGB_888, skcms_AlphaFormat_Unpremul, NULL, 1));
+}
+
+// Upsample one channel of chroma for pixel (x,y) the way skcms_TransformYUV() should.
+static float upsample_chroma(const uint16_t* plane, int stride, int cw, int ch,
+                             bool is_420, bool bilinear, int x, int y) {
+    int cx0 = x/2,
+        cx1 = bilinear && cx0 + (x&1) < cw ? cx0 + (x&1) : cx0;
+    int cy0 = is_420 ? y/2 : y,
+        cy1 = cy0;
+    float t = 0;
+    if (is_420 && bilinear) {
+        cy0 = (y&1) ? y/2 : y/2 - 1;
+        cy1 = cy0 + 1;
+        t   = (y&1) ? 0.25f : 0.75f;
+        cy0 = cy0 < 0  ? 0    : cy0;
+        cy1 = cy1 < ch ? cy1  : ch-1;
+    }
+    float c0 = 0.5f * (plane[cy0*stride + cx0] + plane[cy0*stride + cx1]),
+          c1 = 0.5f * (plane[cy1*stride + cx0] + plane[cy1*stride + cx1]);
+    return c0 + (c1 - c0) * t;
+}
+
+static void test_YUV(void) {
+    skcms_ICCProfile ycbcr = *skcms_sRGB_profile();
+    const skcms_CICP bt709 = { 1, 13, 1, 0 };
+    ycbcr.has_CICP = true;
+    ycbcr.CICP     = bt709;
+
+    // Odd sizes, so rows end partway through a block and chroma covers half a pixel at the edges.
+    enum { W = 37, H = 5, CW = (W+1)/2, CH = (H+1)/2, S = W+3 };
+
+    for (int filter = 0; filter < 2; filter++)
+    for (int sub = 0; sub < 2; sub++)
+    for (int interleaved = 0; interleaved < 2; interleaved++)
+    for (int wide = 0; wide < 2; wide++) {
+        const bool is_420   = sub == 0,
+                   bilinear = filter == 1;
+        const int  ch       = is_420 ? CH : H;
+
+        // Chroma stays a multiple of 8, so our bilinear reference is exact.
+        uint16_t y[H][S], cb[H][CW], cr[H][CW];
+        for (int j = 0; j < H; j++)
+        for (int i = 0; i < S; i++) {
+            uint16_t v = skcms_252_random_bytes[(j*S + i) % 252];
+            y[j][i] = wide ? (uint16_t)(v * 257) : v;
+        }
+        for (int j = 0; j < ch; j++)
+        for (int i = 0; i < CW; i++) {
+            uint16_t u = skcms_252_random_bytes[(3*(j*CW + i) + 1) % 252] & 0xf8,
+                     v = skcms_252_random_bytes[(3*(j*CW + i) + 2) % 252] & 0xf8;
+            cb[j][i] = wide ? (uint16_t)(u * 64 + 20000) : u;
+            cr[j][i] = wide ? (uint16_t)(v * 64 + 20000) : v;
+        }
+
+        // Lay the planes out as skcms_YUVImage wants them.
+        uint8_t  y8[H][S], c8[H][2*CW], cr8[H][CW];
+        uint16_t c16[H][2*CW], cr16[H][CW];
+        for (int j = 0; j < H; j++)
+        for (int i = 0; i < S; i++) {
+            y8[j][i] = (uint8_t)y[j][i];
+        }
+        for (int j = 0; j < ch; j++)
+        for (int i = 0; i < CW; i++) {
+            int cbi = interleaved ? 2*i : i;
+            c8 [j][cbi] = (uint8_t)cb[j][i];  c16 [j][cbi] = cb[j][i];
+            cr8[j][i]   = (uint8_t)cr[j][i];  cr16[j][i]   = cr[j][i];
+            if (interleaved) {
+                c8[j][2*i+1] = (uint8_t)cr[j][i];  c16[j][2*i+1] = cr[j][i];
+            }
+        }
+
+        skcms_YUVImage img;
+        img.y           = wide ? (const void*)y : (const void*)y8;
+        img.cb          = wide ? (const void*)c16 : (const void*)c8;
+        img.cr          = interleaved ? NULL : wide ? (const void*)cr16 : (const void*)cr8;
+        img.y_stride    = wide ? sizeof(y[0])    : sizeof(y8[0]);
+        img.cb_stride   = wide ? sizeof(c16[0])  : sizeof(c8[0]);
+        img.cr_stride   = wide ? sizeof(cr16[0]) : sizeof(cr8[0]);
+        img.width       = W;
+        img.height      = H;
+        img.format      = wide ? skcms_PlaneFormat_16 : skcms_PlaneFormat_8;
+        img.subsampling = is_420 ? skcms_ChromaSubsampling_420 : skcms_ChromaSubsampling_422;
+
+        uint32_t dst[H][W+2];
+        expect(skcms_TransformYUV(&img, bilinear ? skcms_ChromaFilter_Bilinear
+                                                 : skcms_ChromaFilter_Nearest, &ycbcr,
+                                  dst, sizeof(dst[0]), skcms_PixelFormat_RGBA_8888,
+                                  skcms_AlphaFormat_Unpremul, NULL));
+
+        // Compare each row against the same YCbCr upsampled by hand into 4:4:4 planes.
+        for (int j = 0; j < H; j++) {
+            uint16_t py[W], pcb[W], pcr[W];
+            uint8_t  py8[W], pcb8[W], pcr8[W];
+            for (int i = 0; i < W; i++) {
+                py [i] = y[j][i];
+                pcb[i] = (uint16_t)upsample_chroma(cb[0], CW, CW, ch, is_420, bilinear, i, j);
+                pcr[i] = (uint16_t)upsample_chroma(cr[0], CW, CW, ch, is_420, bilinear, i, j);
+                py8[i] = (uint8_t)py[i]; pcb8[i] = (uint8_t)pcb[i]; pcr8[i] = (uint8_t)pcr[i];
+            }
+            const void* planes[4] = { py,  pcb,  pcr,  NULL },
+                      * planes8[4] = { py8, pcb8, pcr8, NULL };
+
+            uint32_t want[W];
+            void* want_planes[4] = { NULL, NULL, NULL, NULL };
+            uint8_t r[W], g[W], b[W];
+            want_planes[0] = r;
+            want_planes[1] = g;
+            want_planes[2] = b;
+            expect(skcms_TransformPlanar(wide ? planes : planes8,
+                                         wide ? skcms_PlaneFormat_16 : skcms_PlaneFormat_8,
+                                         skcms_AlphaFormat_Unpremul, &ycbcr,
+                                         want_planes, skcms_PlaneFormat_8,
+                                         skcms_AlphaFormat_Unpremul, NULL, W));
+            for (int i = 0; i < W; i++) {
+                want[i] = (uint32_t)r[i] | (uint32_t)g[i] << 8 | (uint32_t)b[i] << 16 | 0xffu << 24;
+                expect(dst[j][i] == want[i]);
+            }
+        }
+    }
+
+    // Only YCbCr profiles and integer samples make sense here.
+    const uint8_t luma[2] = { 16, 16 },
+                  chroma  = 128;
+    skcms_YUVImage img;
+    img.y  = luma;
+    img.cb = img.cr = &chroma;
+    img.y_stride = img.cb_stride = img.cr_stride = 2;
+    img.width       = 2;
+    img.height      = 1;
+    img.format      = skcms_PlaneFormat_8;
+    img.subsampling = skcms_ChromaSubsampling_420;
+    uint32_t dst[2];
+    expect( skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &ycbcr, dst, 8,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    expect(dst[0] == 0xff000000 && dst[1] == 0xff000000);
+    expect(!skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, skcms_sRGB_profile(), dst, 8,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+
+    // dst rows can't overlap, and neither can source rows.
+    expect(!skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &ycbcr, dst, 7,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    img.y_stride = 1;
+    expect(!skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &ycbcr, dst, 8,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    img.y_stride  = 2;
+    img.cr_stride = 0;
+    expect(!skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &ycbcr, dst, 8,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    img.cr        = NULL;  // Interleaved Cb,Cr take two samples per chroma pixel.
+    img.cb_stride = 1;
+    expect(!skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &ycbcr, dst, 8,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    img.cr        = &chroma;
+    img.cb_stride = img.cr_stride = 2;
+    img.format = skcms_PlaneFormat_f;
+    expect(!skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &ycbcr, dst, 8,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    img.format = skcms_PlaneFormat_8;
+
+    // skcms_ParseLazy() leaves CICP for skcms_TransformYUV() to read.  Set this profile's
+    // matrix coefficients to BT.2020 to make it YCbCr, and it should work parsed either way.
+    void*  ptr;
+    size_t len;
+    expect(load_file("profiles/misc/Rec2020_PQ_cicp.icc", &ptr, &len));
+    skcms_ICCProfile eager, lazy;
+    skcms_ICCTag cicp;
+    expect(skcms_ParseLazy(ptr, len, &lazy));
+    expect(!skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &lazy, dst, 8,
+                               skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    expect(skcms_GetTagBySignature(&lazy, 0x63696370/*'cicp'*/, &cicp));
+    ((uint8_t*)ptr)[(cicp.buf - (const uint8_t*)ptr) + 10] = 9;
+
+    expect(skcms_Parse    (ptr, len, &eager));
+    expect(skcms_ParseLazy(ptr, len, &lazy));
+    expect(!lazy.has_CICP);
+    uint32_t lazy_dst[2];
+    expect(skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &eager, dst, 8,
+                              skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    expect(skcms_TransformYUV(&img, skcms_ChromaFilter_Nearest, &lazy, lazy_dst, 8,
+                              skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, NULL));
+    expect(0 == memcmp(dst, lazy_dst, sizeof(dst)));
+    free(ptr);
+}
+
 static void test_RGBA_8888_sRGB(void) {
     // We'll convert sRGB to Display P3 two ways and test they're equivalent.
 
@@ -1859,6 +3220,279 @@ static void test_B2A(void) {
     free(ptr);
 }
 
+static void test_GetTagBySignature(void) {
+    const char* filenames[] = {
+        "profiles/mobile/sRGB_parametric.icc",
+        "profiles/misc/US_Web_Coated_SWOP_CMYK.icc",
+        "profiles/misc/DisplayCal_ASUS_NonMonotonic.icc",
+    };
+    for (int f = 0; f < ARRAY_COUNT(filenames); f++) {
+        void*  ptr;
+        size_t len;
+        expect(load_file(filenames[f], &ptr,&len));
+
+        skcms_ICCProfile profile;
+        expect(skcms_Parse(ptr, len, &profile));
+        expect(profile.has_tag_index);
+
+        // Without the index we search the tag table, which should always agree.
+        skcms_ICCProfile unindexed = profile;
+        unindexed.has_tag_index = false;
+
+        for (uint32_t i = 0; i < profile.tag_count; i++) {
+            skcms_ICCTag by_index, by_sig, by_search;
+            skcms_GetTagByIndex(&profile, i, &by_index);
+            expect(skcms_GetTagBySignature(&profile,   by_index.signature, &by_sig));
+            expect(skcms_GetTagBySignature(&unindexed, by_index.signature, &by_search));
+            expect(by_sig.buf  == by_search.buf);
+            expect(by_sig.size == by_search.size);
+        }
+
+        skcms_ICCTag tag;
+        expect(!skcms_GetTagBySignature(&profile,   0x6E6F7065/*'nope'*/, &tag));
+        expect(!skcms_GetTagBySignature(&unindexed, 0x6E6F7065/*'nope'*/, &tag));
+
+        free(ptr);
+    }
+
+    // Pad out sRGB's tag table with extra tags sharing its first tag's data, to just inside
+    // and then past the 255 tags we'll index.
+    void*  ptr;
+    size_t len;
+    expect(load_file("profiles/mobile/sRGB_parametric.icc", &ptr,&len));
+    const uint8_t* icc = (const uint8_t*)ptr;
+    const uint32_t tags = (uint32_t)icc[128] << 24 | (uint32_t)icc[129] << 16
+                        | (uint32_t)icc[130] <<  8 | (uint32_t)icc[131];
+    const size_t data = 132 + 12*(size_t)tags;
+
+    const uint32_t counts[] = { 80, 255, 256, 300 };
+    for (int c = 0; c < ARRAY_COUNT(counts); c++) {
+        const uint32_t count = counts[c];
+        const size_t   shift = 12 * (size_t)(count - tags),
+                       size  = len + shift;
+        uint8_t* padded = malloc(size);
+        memcpy(padded, icc, 132);
+        memcpy(padded + data + shift, icc + data, len - data);
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t* entry = padded + 132 + 12*i;
+            memcpy(entry, icc + 132 + 12*(i < tags ? i : 0), 12);
+            if (i >= tags) {
+                const uint32_t sig = 0x7A000000u + i;  // 'z' and then i
+                for (int b = 0; b < 4; b++) { entry[b] = (uint8_t)(sig >> (24 - 8*b)); }
+            }
+            uint32_t offset = (uint32_t)entry[4] << 24 | (uint32_t)entry[5] << 16
+                            | (uint32_t)entry[6] <<  8 | (uint32_t)entry[7];
+            offset += (uint32_t)shift;
+            for (int b = 0; b < 4; b++) { entry[4+b] = (uint8_t)(offset >> (24 - 8*b)); }
+        }
+        for (int b = 0; b < 4; b++) {
+            padded[  0+b] = (uint8_t)(size  >> (24 - 8*b));
+            padded[128+b] = (uint8_t)(count >> (24 - 8*b));
+        }
+
+        skcms_ICCProfile profile;
+        expect(skcms_Parse(padded, size, &profile));
+        expect(profile.tag_count == count);
+        expect(profile.has_tag_index == (count <= 255));
+        expect(profile.has_trc && profile.has_toXYZD50);
+
+        for (uint32_t i = 0; i < count; i++) {
+            skcms_ICCTag by_index, by_sig;
+            skcms_GetTagByIndex(&profile, i, &by_index);
+            expect(skcms_GetTagBySignature(&profile, by_index.signature, &by_sig));
+            expect(by_sig.buf == by_index.buf);
+        }
+        skcms_ICCTag tag;
+        expect(!skcms_GetTagBySignature(&profile, 0x6E6F7065/*'nope'*/, &tag));
+        free(padded);
+    }
+    free(ptr);
+}
+
+static void test_ParseLazy(void) {
+    void*  ptr;
+    size_t len;
+    expect(load_file("profiles/misc/US_Web_Coated_SWOP_CMYK.icc", &ptr,&len));
+
+    skcms_ICCProfile eager, lazy;
+    expect(skcms_Parse    (ptr, len, &eager));
+    expect(skcms_ParseLazy(ptr, len, &lazy));
+    expect( eager.has_A2B &&  eager.has_B2A);
+    expect(!lazy .has_A2B && !lazy .has_B2A);
+
+    // skcms_Transform() resolves lazy profiles on its own.
+    const uint8_t* src = skcms_252_random_bytes;
+    uint8_t eager_dst[252],
+             lazy_dst[252];
+    expect(skcms_Transform(src,       skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &eager,
+                           eager_dst, skcms_PixelFormat_RGB_888,   skcms_AlphaFormat_Unpremul, NULL,
+                           252/4));
+    expect(skcms_Transform(src,       skcms_PixelFormat_RGBA_8888, skcms_AlphaFormat_Unpremul, &lazy,
+                           lazy_dst,  skcms_PixelFormat_RGB_888,   skcms_AlphaFormat_Unpremul, NULL,
+                           252/4));
+    expect(0 == memcmp(eager_dst, lazy_dst, 3*(252/4)));
+
+    // Once resolved, a lazy profile is identical to an eager one.
+    expect(skcms_ResolveProfile(&lazy));
+    expect(0 == memcmp(&eager, &lazy, sizeof(lazy)));
+    expect(skcms_ResolveProfile(&lazy));
+    expect(0 == memcmp(&eager, &lazy, sizeof(lazy)));
+
+    // Failing to resolve leaves the profile as it was, even past a good A2B.
+    skcms_ICCTag b2a;
+    expect(skcms_GetTagBySignature(&eager, 0x42324130/*'B2A0'*/, &b2a));
+    ((uint8_t*)ptr)[b2a.buf - (const uint8_t*)ptr] ^= 0xff;  // Corrupt its type.
+    expect(skcms_ParseLazy(ptr, len, &lazy));
+    skcms_ICCProfile before = lazy;
+    expect(!skcms_ResolveProfile(&lazy));
+    expect(0 == memcmp(&before, &lazy, sizeof(lazy)));
+    expect(!skcms_MakeUsableAsDestination(&lazy));
+    expect(0 == memcmp(&before, &lazy, sizeof(lazy)));
+    free(ptr);
+
+    // So does failing to make one usable as a destination after it resolves fine.
+    expect(load_file("profiles/color.org/Upper_Right.icc", &ptr, &len));
+    expect(skcms_ParseLazy(ptr, len, &lazy));
+    before = lazy;
+    expect(!skcms_MakeUsableAsDestination(&lazy));
+    expect(0 == memcmp(&before, &lazy, sizeof(lazy)));
+    expect(!skcms_MakeUsableAsDestinationWithSingleCurve(&lazy));
+    expect(0 == memcmp(&before, &lazy, sizeof(lazy)));
+    expect(skcms_ResolveProfile(&lazy));
+    expect(lazy.has_A2B);
+    free(ptr);
+}
+
+// A skcms_ParallelFor that's not parallel, but does work out of order.
+static void backwards_for(void* ctx, int n, void (*fn)(void* arg, int i), void* arg) {
+    *(int*)ctx += n;
+    for (int i = n-1; i >= 0; i--) {
+        fn(arg, i);
+    }
+}
+
+static void test_ParseBatch(void) {
+    const char* filenames[] = {
+        "profiles/mobile/sRGB_parametric.icc",
+        "profiles/misc/US_Web_Coated_SWOP_CMYK.icc",
+        "profiles/mobile/sRGB_parametric.icc",
+        "profiles/misc/US_Web_Coated_SWOP_CMYK.icc",
+        "profiles/misc/AdobeRGB.icc",
+        "profiles/mobile/sRGB_parametric.icc",
+    };
+    enum { N = ARRAY_COUNT(filenames) + 2 };
+
+    // Each file gets its own buffer, and we add two identical unparseable buffers at the end.
+    skcms_ProfileData data[N];
+    void* bufs[N];
+    for (int i = 0; i < N-2; i++) {
+        expect(load_file(filenames[i], &bufs[i], &data[i].len));
+        data[i].buf = bufs[i];
+    }
+    uint8_t junk[2][200] = {{0}};
+    for (int i = N-2; i < N; i++) {
+        bufs[i]     = NULL;
+        data[i].buf = junk[i - (N-2)];
+        data[i].len = sizeof(junk[0]);
+    }
+
+    uint32_t* scratch = malloc(skcms_ParseBatchScratchCount(N) * sizeof(uint32_t));
+
+    for (int parallel = 0; parallel < 2; parallel++) {
+        skcms_ICCProfile profiles[N];
+        memset(profiles, 0xab, sizeof(profiles));
+        const skcms_ICCProfile untouched = profiles[N-1];
+        bool ok[N];
+        int unique = 0;
+        expect(4 == skcms_ParseBatch(data, N, profiles, ok, scratch,
+                                     parallel ? backwards_for : NULL, &unique));
+        expect(unique == (parallel ? N-4 : 0));
+
+        // Each profile should be exactly as if we'd parsed it on its own.
+        for (int i = 0; i < N; i++) {
+            skcms_ICCProfile profile;
+            expect(ok[i] == skcms_Parse(data[i].buf, data[i].len, &profile));
+            if (ok[i]) {
+                expect(0 == memcmp(&profile, &profiles[i], sizeof(profile)));
+            }
+        }
+        // Copies of a buffer that failed to parse are left alone.
+        expect(!ok[N-2] && !ok[N-1]);
+        expect(0 == memcmp(&untouched, &profiles[N-1], sizeof(untouched)));
+    }
+
+    // Batches too big for our table are refused up front.
+    expect(0 == skcms_ParseBatchScratchCount((1 << 30) + 1));
+    expect(0 == skcms_ParseBatchScratchCount(0));
+    bool ok;
+    skcms_ICCProfile profile;
+    expect(0 == skcms_ParseBatch(data, (1 << 30) + 1, &profile, &ok, scratch, NULL, NULL));
+
+    free(scratch);
+    for (int i = 0; i < N; i++) {
+        free(bufs[i]);
+    }
+}
+
+static void test_MakeUsableAsDestinationCached(void) {
+    const char* filenames[] = {
+        "profiles/color.org/sRGB2014.icc",
+        "profiles/mobile/sRGB_LUT.icc",
+        "profiles/mobile/Display_P3_LUT.icc",
+        "profiles/misc/AdobeRGB.icc",
+    };
+
+    // Each pass parses the files into fresh buffers, all kept alive so their addresses differ.
+    // The cache matches curves by content, so the second pass should still hit.
+    void*            bufs   [2][ARRAY_COUNT(filenames)];
+    skcms_ICCProfile profile[ARRAY_COUNT(filenames)];
+
+    skcms_CurveFitCache cache;
+    memset(&cache, 0, sizeof(cache));
+
+    // Running twice over the files makes sure we see both cache misses and hits.
+    for (int pass = 0; pass < 2; pass++)
+    for (int i = 0; i < ARRAY_COUNT(filenames); i++) {
+        size_t len;
+        expect(load_file(filenames[i], &bufs[pass][i], &len));
+        expect(skcms_Parse(bufs[pass][i], len, &profile[i]));
+
+        // Cached results should be exactly what we'd get without the cache.
+        skcms_ICCProfile want = profile[i],
+                          got = profile[i];
+        expect(skcms_MakeUsableAsDestination(&want));
+        expect(skcms_MakeUsableAsDestinationCached(&got, &cache));
+        expect(0 == memcmp(&want, &got, sizeof(want)));
+
+        want = got = profile[i];
+        expect(skcms_MakeUsableAsDestinationWithSingleCurve(&want));
+        expect(skcms_MakeUsableAsDestinationWithSingleCurveCached(&got, &cache));
+        expect(0 == memcmp(&want, &got, sizeof(want)));
+    }
+
+    // The three LUT profiles share one sRGB table, so they need just one table fit and one
+    // single-curve pick between them, and AdobeRGB one more pick.  The second pass, with every
+    // table at a new address, must have hit the cache for all of them.
+    expect(cache.next_fit    == 1);
+    expect(cache.next_single == 2);
+
+    // A match on the first hash alone mustn't hand back another curve's fit.  Forge one by
+    // changing the check of the LUT profiles' entry, and giving it a fit that's clearly wrong.
+    cache.fit[0].check ^= 1;
+    cache.fit[0].tf.g  += 0.25f;
+    skcms_ICCProfile want = profile[2],
+                      got = profile[2];
+    expect(skcms_MakeUsableAsDestination(&want));
+    expect(skcms_MakeUsableAsDestinationCached(&got, &cache));
+    expect(0 == memcmp(&want, &got, sizeof(want)));
+    expect(cache.next_fit == 2);  // So it fit the curve afresh.
+
+    for (int i = 0; i < ARRAY_COUNT(filenames); i++) {
+        free(bufs[0][i]);
+        free(bufs[1][i]);
+    }
+}
+
 int main(int argc, char** argv) {
     bool regenTestData = false;
     for (int i = 1; i < argc; ++i) {
@@ -1892,6 +3526,8 @@ int main(int argc, char** argv) {
     test_Programmatic_sRGB();
     test_ExactlyEqual();
     test_GrayscaleAndRGBCanBeEqual();
+    test_Fingerprint();
+    test_IdentifyProfile();
     test_AliasedTransforms();
     test_TF_invert();
     test_Clamp();
@@ -1901,9 +3537,27 @@ int main(int argc, char** argv) {
     test_scaled_HLG();
     test_PQ_invert();
     test_HLG_invert();
+    test_ToneMap();
+    test_GamutMapping();
+    test_TransformImage();
+    test_TransformStream();
+    test_TransformBuilder();
+    test_TransformChain();
+    test_WriteDeviceLink();
     test_RGBA_8888_sRGB();
+    test_Precision();
+    test_Precision_HalfFloat();
+    test_JIT();
+    test_Blocks();
+    test_Planar();
+    test_YCbCr();
+    test_YUV();
     test_ParseWithA2BPriority();
     test_B2A();
+    test_GetTagBySignature();
+    test_ParseLazy();
+    test_ParseBatch();
+    test_MakeUsableAsDestinationCached();
 
     test_Parse(regenTestData);
     test_sRGB_AllBytes();